@@ -0,0 +1,353 @@
+// times the memory operations against a synthetic child process with a known layout,
+// so that the numbers stay comparable between runs, read backends and kernels
+//
+// usage: harava_bench [--heap MB] [--mappings COUNT] [--density FRACTION] [--mutations COUNT]
+//                     [--tick MS] [--repeats COUNT] [--threads COUNT] [--backend vm|pread] [--seed SEED]
+
+#include "Filter.hpp"
+#include "Memory.hpp"
+#include "Options.hpp"
+#include "Snapshot.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace harava;
+
+struct bench_options
+{
+	u64 heap_size = 256;		// megabytes
+	u64 mappings = 16;
+	double density = 0.001;		// fraction of the 4 byte slots that hold the searched value
+	u64 mutations = 1000;		// slots changed on each tick
+	u64 tick = 10;				// milliseconds
+	u64 repeats = 3;
+	u32 threads = 0;
+	u64 seed = 1234;
+	read_backend backend = read_backend::vm;
+};
+
+static constexpr i32 searched_value = 123456;
+
+// a library that gets removed after it's mapped, the kernel marks its mapping
+// as deleted and it has to be left out like any other library
+static constexpr u64 library_size = 4096;
+
+// fill the mappings and keep changing them until the parent goes away, the
+// values are small with plenty of zeroes like in a typical process
+[[noreturn]]
+static void run_child(const bench_options& bench, const int ready_fd)
+{
+	prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+	std::mt19937_64 random(bench.seed);
+	std::vector<i32*> mappings;
+	const u64 mapping_size = std::max<u64>(bench.heap_size * 1024 * 1024 / bench.mappings, 4096) & ~4095ULL;
+	const u64 slots = mapping_size / sizeof(i32);
+
+	for (u64 i = 0; i < bench.mappings; ++i)
+	{
+		void* mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mapping == MAP_FAILED)
+			_exit(1);
+
+		i32* values = static_cast<i32*>(mapping);
+		for (u64 slot = 0; slot < slots; ++slot)
+		{
+			const double roll = std::uniform_real_distribution<double>(0, 1)(random);
+			values[slot] = roll < bench.density ? searched_value : (random() % 2 == 0 ? 0 : random() % 1000);
+		}
+
+		mappings.push_back(values);
+	}
+
+	const std::string library_path = (std::filesystem::temp_directory_path() / "libharava_bench.so").string();
+	const int library_fd = open(library_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (library_fd == -1 || ftruncate(library_fd, library_size) != 0)
+		_exit(1);
+
+	void* library = mmap(nullptr, library_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, library_fd, 0);
+	close(library_fd);
+	unlink(library_path.c_str());
+	if (library == MAP_FAILED)
+		_exit(1);
+
+	std::fill_n(static_cast<i32*>(library), library_size / sizeof(i32), searched_value);
+
+	// the parent gets the address of the library once everything is in place
+	const u64 library_address = reinterpret_cast<u64>(library);
+	if (write(ready_fd, &library_address, sizeof(library_address)) != sizeof(library_address))
+		_exit(1);
+
+	while (true)
+	{
+		for (u64 i = 0; i < bench.mutations; ++i)
+			++mappings[random() % mappings.size()][random() % slots];
+
+		usleep(bench.tick * 1000);
+	}
+}
+
+// the memory class reports its progress to stdout, which would drown out the numbers
+class quiet_output
+{
+public:
+	quiet_output()
+	:previous(std::cout.rdbuf(sink.rdbuf()))
+	{}
+
+	~quiet_output()
+	{
+		std::cout.rdbuf(previous);
+	}
+
+private:
+	std::ostringstream sink;
+	std::streambuf* previous;
+};
+
+template<typename F>
+static double best_time(const u64 repeats, F&& f)
+{
+	double best = 1e30;
+	for (u64 i = 0; i < repeats; ++i)
+	{
+		quiet_output quiet;
+		const auto start = std::chrono::steady_clock::now();
+		f();
+		const auto end = std::chrono::steady_clock::now();
+		best = std::min(best, std::chrono::duration<double>(end - start).count());
+	}
+
+	return best;
+}
+
+static u64 peak_rss_megabytes()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024;
+}
+
+// a checksum that changes if the results, their order or their values change
+static u64 results_checksum(const results& results)
+{
+	u64 checksum{0};
+	results.for_each([&checksum](const result& r)
+	{
+		const u64 fields[] = { r.region_id, r.location, static_cast<u64>(r.type), static_cast<u64>(r.value._long) };
+		for (const u64 field : fields)
+			checksum = (checksum ^ field) * 0x100000001b3ULL;
+	});
+
+	return checksum;
+}
+
+static void print_row(const std::string& stage, const double seconds, const double gigabytes, const u64 candidates)
+{
+	std::cout << std::left << std::setw(22) << stage << std::right << std::fixed << std::setprecision(2)
+		<< std::setw(10) << seconds * 1000
+		<< std::setw(10);
+
+	if (gigabytes > 0)
+		std::cout << gigabytes / seconds;
+	else
+		std::cout << "-";
+
+	std::cout << std::setw(14);
+	if (candidates > 0)
+		std::cout << candidates / seconds / 1e6;
+	else
+		std::cout << "-";
+
+	std::cout << std::setw(10) << peak_rss_megabytes() << '\n';
+}
+
+int main(int argc, char** argv)
+{
+	bench_options bench;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		const std::string flag = argv[i];
+		const std::string value = argv[i + 1];
+
+		if (flag == "--heap")
+			bench.heap_size = std::stoull(value);
+		else if (flag == "--mappings")
+			bench.mappings = std::max<u64>(std::stoull(value), 1);
+		else if (flag == "--density")
+			bench.density = std::stod(value);
+		else if (flag == "--mutations")
+			bench.mutations = std::stoull(value);
+		else if (flag == "--tick")
+			bench.tick = std::stoull(value);
+		else if (flag == "--repeats")
+			bench.repeats = std::max<u64>(std::stoull(value), 1);
+		else if (flag == "--threads")
+			bench.threads = std::stoul(value);
+		else if (flag == "--seed")
+			bench.seed = std::stoull(value);
+		else if (flag == "--backend")
+			bench.backend = value == "pread" ? read_backend::pread : read_backend::vm;
+		else
+		{
+			std::cout << "unknown flag: " << flag << '\n';
+			return 1;
+		}
+	}
+
+	// fork before anything big gets allocated, so that the child doesn't inherit it
+	int ready_pipe[2];
+	if (pipe(ready_pipe) != 0)
+	{
+		std::cout << "can't create a pipe\n";
+		return 1;
+	}
+
+	const pid_t child = fork();
+	if (child == 0)
+	{
+		close(ready_pipe[0]);
+		run_child(bench, ready_pipe[1]);
+	}
+
+	close(ready_pipe[1]);
+
+	u64 library_address{0};
+	if (child == -1 || read(ready_pipe[0], &library_address, sizeof(library_address)) != sizeof(library_address))
+	{
+		std::cout << "the child process couldn't be started\n";
+		return 1;
+	}
+
+	options opts;
+	opts.pid = child;
+	opts.threads = bench.threads;
+	opts.backend = bench.backend;
+
+	std::unique_ptr<memory> process_memory;
+	{
+		quiet_output quiet;
+		process_memory = std::make_unique<memory>(child, opts);
+	}
+
+	const filter filter;
+	const type_bundle value(std::to_string(searched_value));
+
+	std::cout << "heap: " << bench.heap_size << "MB in " << bench.mappings << " mappings, density: " << bench.density
+		<< ", mutations: " << bench.mutations << " every " << bench.tick << "ms, backend: "
+		<< (bench.backend == read_backend::vm ? "vm" : "pread") << ", best of " << bench.repeats << "\n\n";
+
+	std::cout << std::left << std::setw(22) << "stage" << std::right
+		<< std::setw(10) << "ms" << std::setw(10) << "GB/s" << std::setw(14) << "candidates/s" << std::setw(10) << "rss MB" << '\n';
+	std::cout << std::setw(46) << "(millions)" << '\n';
+
+	// the snapshot tells how many bytes a full pass over the regions reads
+	snapshot snapshot;
+	const double snapshot_time = best_time(bench.repeats, [&] { snapshot = process_memory->take_snapshot(); });
+	const double gigabytes = snapshot.byte_count() / 1e9;
+	print_row("take_snapshot", snapshot_time, gigabytes, 0);
+
+	results found;
+	const double search_time = best_time(bench.repeats, [&] { found = process_memory->search(opts, filter, value, comparison::eq); });
+	print_row("search (= value)", search_time, gigabytes, 0);
+
+	// the deleted library is full of the value, so any of it getting scanned shows up here
+	bool library_scanned{false};
+	found.for_each([&](const result& r)
+	{
+		const u64 address = process_memory->address(r);
+		library_scanned |= address >= library_address && address < library_address + library_size;
+	});
+
+	if (library_scanned)
+	{
+		std::cout << "the deleted library was searched\n";
+		kill(child, SIGKILL);
+		waitpid(child, nullptr, 0);
+		return 1;
+	}
+
+	results all_greater;
+	const double search_gt_time = best_time(bench.repeats, [&] { all_greater = process_memory->search(opts, filter, type_bundle("0"), comparison::gt); });
+	print_row("search (> 0)", search_gt_time, gigabytes, 0);
+
+	const double refine_time = best_time(bench.repeats, [&] { results refined = process_memory->refine_search(value, found, comparison::eq); });
+	print_row("refine_search", refine_time, 0, found.count());
+
+	const double refine_wide_time = best_time(bench.repeats, [&] { results refined = process_memory->refine_search(type_bundle("0"), all_greater, comparison::gt); });
+	print_row("refine_search (> 0)", refine_wide_time, 0, all_greater.count());
+
+	const double change_time = best_time(bench.repeats, [&] { results refined = process_memory->refine_search_change(all_greater, value_change::unchanged); });
+	print_row("refine_search_change", change_time, 0, all_greater.count());
+
+	const double snapshot_refine_time = best_time(bench.repeats, [&] { results refined = process_memory->refine_snapshot(opts, filter, snapshot, value_change::changed); });
+	print_row("refine_snapshot", snapshot_refine_time, gigabytes, 0);
+
+	// a search over every region has to load back from a session as it was
+	const std::string session_path = (std::filesystem::temp_directory_path() / "harava_bench.hrv").string();
+	results loaded;
+	harava::snapshot loaded_snapshot;
+	bool session_loaded{false};
+	const double session_time = best_time(bench.repeats, [&]
+	{
+		session_loaded = process_memory->save(session_path, all_greater, harava::snapshot())
+			&& process_memory->load(session_path, loaded, loaded_snapshot);
+	});
+	print_row("save + load", session_time, 0, all_greater.count());
+
+	if (!session_loaded || loaded.count() != all_greater.count() || results_checksum(loaded) != results_checksum(all_greater))
+	{
+		std::cout << "the saved session didn't load back with the same results\n";
+		kill(child, SIGKILL);
+		waitpid(child, nullptr, 0);
+		return 1;
+	}
+
+	loaded.clear();
+	std::filesystem::remove(session_path);
+
+	// the values are written back as they were, so the layout doesn't change
+	constexpr u64 max_single_sets = 10000;
+	const u64 single_sets = std::min<u64>(found.count(), max_single_sets);
+	const double set_time = best_time(bench.repeats, [&]
+	{
+		for (u64 i = 0; i < single_sets; ++i)
+		{
+			result r = found.at(i).value();
+			process_memory->set(r, value);
+		}
+	});
+	print_row("set", set_time, 0, single_sets);
+
+	std::array<std::vector<u8>, 4> values;
+	for (u8 i = 0; i < datatypes.size(); ++i)
+	{
+		const u8* data = reinterpret_cast<const u8*>(value.str_ptr.at(i));
+		values[i].assign(data, data + type_size(datatypes[i]));
+	}
+
+	const double set_all_time = best_time(bench.repeats, [&] { process_memory->set_all(found, values, false); });
+	print_row("set_all", set_all_time, 0, found.count());
+
+	std::cout << "\nresults: " << found.count() << " equal, " << all_greater.count() << " greater than zero\n";
+
+	kill(child, SIGKILL);
+	waitpid(child, nullptr, 0);
+}
@@ -0,0 +1,181 @@
+// compares the scan kernels that are specialized for each (type, comparison, skip_zeroes)
+// combination against a generic loop that checks the comparison and skip_zeroes for every value
+//
+// usage: kernel_bench [megabytes] [repeats]
+
+#include "ScanKernels.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace harava;
+
+// the scan loop as it was before the kernels were specialized
+template<typename T>
+__attribute__((noinline))
+static void scan_blocks_generic(const u8* bytes, const u64 blocks, const T value, const comparison comparison, const bool skip_zeroes, u64* masks)
+{
+	for (u64 block = 0; block < blocks; ++block)
+	{
+		u64 mask{0};
+
+		for (u8 i = 0; i < scan_block_size; ++i)
+		{
+			T mem_value;
+			memcpy(&mem_value, bytes + block * scan_block_size + i, sizeof(T));
+
+			const bool match = cmp(value, mem_value, comparison) && !(skip_zeroes && mem_value == 0);
+			mask |= static_cast<u64>(match) << i;
+		}
+
+		masks[block] = mask;
+	}
+}
+
+// per candidate checks like the ones done when refining a list of results
+template<typename T>
+__attribute__((noinline))
+static u64 refine_generic(const u8* bytes, const std::vector<u32>& locations, const T value, const comparison comparison, const bool skip_zeroes)
+{
+	u64 count{0};
+	for (const u32 location : locations)
+	{
+		T mem_value;
+		memcpy(&mem_value, bytes + location, sizeof(T));
+		count += !(skip_zeroes && mem_value == 0) && cmp(value, mem_value, comparison);
+	}
+
+	return count;
+}
+
+template<typename T>
+__attribute__((noinline))
+static u64 refine_specialized(const u8* bytes, const std::vector<u32>& locations, const T value, const comparison comparison, const bool skip_zeroes)
+{
+	u64 count{0};
+	dispatch_variant(comparison, skip_zeroes, [&](const auto c, const auto skip)
+	{
+		for (const u32 location : locations)
+		{
+			T mem_value;
+			memcpy(&mem_value, bytes + location, sizeof(T));
+
+			bool match = cmp(value, mem_value, c.value);
+			if constexpr (skip.value)
+				match = match && mem_value != 0;
+
+			count += match;
+		}
+	});
+
+	return count;
+}
+
+template<typename F>
+static double best_time(const u64 repeats, F&& f)
+{
+	double best = 1e30;
+	for (u64 i = 0; i < repeats; ++i)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		f();
+		const auto end = std::chrono::steady_clock::now();
+		best = std::min(best, std::chrono::duration<double>(end - start).count());
+	}
+
+	return best;
+}
+
+static u64 mask_sum(const std::vector<u64>& masks)
+{
+	u64 sum{0};
+	for (const u64 mask : masks)
+		sum += __builtin_popcountll(mask);
+
+	return sum;
+}
+
+template<typename T>
+static void bench_type(const char* type_name, const std::vector<u8>& bytes, const std::vector<u32>& locations, const simd_level native_level, const u64 repeats)
+{
+	constexpr std::array<std::pair<comparison, const char*>, 3> comparisons = {{
+		{ comparison::eq, "eq" },
+		{ comparison::lt, "lt" },
+		{ comparison::gt, "gt" },
+	}};
+
+	const u64 blocks = (bytes.size() - sizeof(T)) / scan_block_size;
+	const double gigabytes = static_cast<double>(blocks * scan_block_size) / 1e9;
+	const T value = static_cast<T>(100);
+
+	std::vector<u64> generic(blocks);
+	std::vector<u64> specialized(blocks);
+
+	for (const auto& [comparison, comparison_name] : comparisons)
+	{
+		for (const bool skip_zeroes : { false, true })
+		{
+			const double generic_time = best_time(repeats, [&] { scan_blocks_generic<T>(bytes.data(), blocks, value, comparison, skip_zeroes, generic.data()); });
+
+			force_simd_level(simd_level::scalar);
+			const double scalar_time = best_time(repeats, [&] { scan_blocks<T>(bytes.data(), blocks, value, comparison, skip_zeroes, specialized.data()); });
+			const bool scalar_ok = generic == specialized;
+
+			force_simd_level(native_level);
+			const double simd_time = best_time(repeats, [&] { scan_blocks<T>(bytes.data(), blocks, value, comparison, skip_zeroes, specialized.data()); });
+			const bool simd_ok = generic == specialized;
+
+			u64 generic_count{0}, specialized_count{0};
+			const double refine_generic_time = best_time(repeats, [&] { generic_count = refine_generic<T>(bytes.data(), locations, value, comparison, skip_zeroes); });
+			const double refine_specialized_time = best_time(repeats, [&] { specialized_count = refine_specialized<T>(bytes.data(), locations, value, comparison, skip_zeroes); });
+
+			std::cout << std::left << std::setw(4) << type_name << std::setw(3) << comparison_name << std::setw(6) << (skip_zeroes ? "skip" : "")
+				<< std::right << std::fixed << std::setprecision(2)
+				<< std::setw(10) << gigabytes / generic_time
+				<< std::setw(10) << gigabytes / scalar_time
+				<< std::setw(10) << gigabytes / simd_time
+				<< std::setw(8) << generic_time / simd_time << 'x'
+				<< std::setw(10) << locations.size() / refine_generic_time / 1e6
+				<< std::setw(10) << locations.size() / refine_specialized_time / 1e6
+				<< std::setw(8) << refine_generic_time / refine_specialized_time << 'x'
+				<< "  " << mask_sum(generic)
+				<< ((scalar_ok && simd_ok && generic_count == specialized_count) ? "" : "  MISMATCH") << '\n';
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const u64 megabytes = argc > 1 ? std::stoull(argv[1]) : 64;
+	const u64 repeats = argc > 2 ? std::stoull(argv[2]) : 5;
+
+	// small values with plenty of zeroes, like in a typical process
+	std::mt19937_64 random(1234);
+	std::vector<u8> bytes(megabytes * 1024 * 1024);
+	for (u8& byte : bytes)
+		byte = random() % 4 == 0 ? random() % 200 : 0;
+
+	std::vector<u32> locations(bytes.size() / 16);
+	for (u32& location : locations)
+		location = random() % (bytes.size() - 8);
+
+	const simd_level native_level = detect_simd_level();
+
+	std::cout << "simd level: " << simd_level_name(native_level) << ", " << megabytes << "MB, best of " << repeats << "\n\n";
+	std::cout << std::left << std::setw(13) << "" << std::right
+		<< std::setw(10) << "generic" << std::setw(10) << "scalar" << std::setw(10) << "simd" << std::setw(9) << "speedup"
+		<< std::setw(10) << "generic" << std::setw(10) << "special" << std::setw(9) << "speedup" << "  matches\n";
+	std::cout << std::left << std::setw(13) << "" << std::right
+		<< std::setw(30) << "scan GB/s" << std::setw(9) << ""
+		<< std::setw(20) << "refine M/s" << '\n';
+
+	bench_type<i32>("i32", bytes, locations, native_level, repeats);
+	bench_type<i64>("i64", bytes, locations, native_level, repeats);
+	bench_type<f32>("f32", bytes, locations, native_level, repeats);
+	bench_type<f64>("f64", bytes, locations, native_level, repeats);
+}
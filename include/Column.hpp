@@ -0,0 +1,186 @@
+#pragma once
+
+#include "SpillFile.hpp"
+#include "Types.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <span>
+#include <vector>
+
+namespace harava
+{
+	// an array of values that lives either in a vector or in a spill file
+	//
+	// the elements are always accessed through a pointer, so reading a
+	// spilled column costs the same as reading one that is in the memory
+	template<typename T>
+	class column
+	{
+	public:
+		column() = default;
+
+		column(std::vector<T>&& values)
+		:values(std::move(values))
+		{
+			sync();
+		}
+
+		column(const column& other)
+		:values(other.values), elements(other.elements), count(other.count), spilled(other.spilled)
+		{
+			if (!spilled)
+				sync();
+		}
+
+		column(column&& other) noexcept
+		:values(std::move(other.values)), elements(other.elements), count(other.count), spilled(other.spilled)
+		{
+			if (!spilled)
+				sync();
+
+			other.elements = nullptr;
+			other.count = 0;
+			other.spilled = false;
+		}
+
+		column& operator=(column other) noexcept
+		{
+			values = std::move(other.values);
+			elements = other.elements;
+			count = other.count;
+			spilled = other.spilled;
+
+			if (!spilled)
+				sync();
+
+			return *this;
+		}
+
+		T& operator[](const u64 index) { return elements[index]; }
+		const T& operator[](const u64 index) const { return elements[index]; }
+
+		T* data() { return elements; }
+		const T* data() const { return elements; }
+
+		u64 size() const { return count; }
+		bool empty() const { return count == 0; }
+
+		T* begin() { return elements; }
+		T* end() { return elements + count; }
+		const T* begin() const { return elements; }
+		const T* end() const { return elements + count; }
+
+		T& back() { return elements[count - 1]; }
+		const T& back() const { return elements[count - 1]; }
+
+		operator std::span<const T>() const { return { elements, count }; }
+
+		void push_back(const T& value)
+		{
+			load();
+			values.push_back(value);
+			sync();
+		}
+
+		void resize(const u64 size, const T& value = T())
+		{
+			load();
+			values.resize(size, value);
+			sync();
+		}
+
+		void shrink_to_fit()
+		{
+			values.shrink_to_fit();
+			sync_if_loaded();
+		}
+
+		// amount of bytes that the column keeps in the memory
+		u64 memory_size() const
+		{
+			return values.capacity() * sizeof(T);
+		}
+
+		bool is_spilled() const
+		{
+			return spilled;
+		}
+
+		// move the elements to the spill file, returns false if
+		// there wasn't any space left in the file
+		bool spill(spill_file& file)
+		{
+			if (spilled || values.empty())
+				return true;
+
+			T* address = reinterpret_cast<T*>(file.store(values.data(), values.size() * sizeof(T)));
+			if (address == nullptr) [[unlikely]]
+				return false;
+
+			values = std::vector<T>();
+			elements = address;
+			spilled = true;
+			return true;
+		}
+
+		// use zeroed space from the spill file as the storage
+		bool spill_allocate(spill_file& file, const u64 size)
+		{
+			T* address = reinterpret_cast<T*>(file.allocate(size * sizeof(T)));
+			if (address == nullptr) [[unlikely]]
+				return false;
+
+			values = std::vector<T>();
+			elements = address;
+			count = size;
+			spilled = true;
+			return true;
+		}
+
+		// use elements that live in a mapped file as the storage, the
+		// file has to stay mapped for as long as the column uses it
+		void use_mapped(T* address, const u64 size)
+		{
+			values = std::vector<T>();
+			elements = address;
+			count = size;
+			spilled = true;
+		}
+
+		// let the kernel drop the spilled elements from the ram until they are needed again
+		void release() const
+		{
+			if (spilled)
+				spill_file::release(elements, count * sizeof(T));
+		}
+
+	private:
+		// bring the spilled elements back to the memory so that the column can grow
+		void load()
+		{
+			if (!spilled)
+				return;
+
+			values.assign(elements, elements + count);
+			spilled = false;
+		}
+
+		void sync()
+		{
+			elements = values.data();
+			count = values.size();
+		}
+
+		void sync_if_loaded()
+		{
+			if (!spilled)
+				sync();
+		}
+
+		std::vector<T> values;
+		T* elements{nullptr};
+		u64 count{0};
+		bool spilled{false};
+	};
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Types.hpp"
+#include "Writer.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace harava
+{
+	// keeps writing the frozen values to the target process from a background
+	// thread, all of the values get written with a single batch on each tick
+	class freezer
+	{
+	public:
+		// rate is the amount of ticks per second
+		freezer(const i32 pid, const u32 rate);
+		~freezer();
+
+		freezer(const freezer&) = delete;
+		freezer& operator=(const freezer&) = delete;
+
+		struct frozen_value
+		{
+			u64 address;
+			std::vector<u8> bytes;
+			std::string description;	// shown when listing the frozen values
+		};
+
+		// freezing an address that is already frozen replaces the old value
+		void freeze(const u64 address, const std::vector<u8>& bytes, const std::string& description);
+
+		// the frozen values in address order, indices refer to this order
+		std::vector<frozen_value> values() const;
+		bool unfreeze(const u64 index);
+		void clear();
+
+		u32 rate() const;
+
+		// amount of bytes that couldn't be written during the latest tick
+		u64 failed_bytes() const;
+
+	private:
+		void run();
+
+		writer value_writer;
+		const u32 tick_rate;
+
+		mutable std::mutex mutex;
+		std::condition_variable wake_up;
+		bool stopping{false};
+
+		std::map<u64, frozen_value> frozen;
+
+		// bumped whenever the frozen values change so that the
+		// thread knows when to rebuild its write batch
+		u64 generation{0};
+
+		std::atomic<u64> failed{0};
+		std::thread thread;
+	};
+}
@@ -1,48 +1,41 @@
 #pragma once
 
 #include "Filter.hpp"
+#include "Metrics.hpp"
 #include "Options.hpp"
+#include "PointerScan.hpp"
+#include "ProcMaps.hpp"
+#include "Reader.hpp"
+#include "Results.hpp"
+#include "Snapshot.hpp"
+#include "SoftDirty.hpp"
+#include "SpillFile.hpp"
+#include "ThreadPool.hpp"
 #include "Types.hpp"
+#include "Writer.hpp"
 
 #include <array>
-#include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 namespace harava
 {
+	class byte_pattern;
+	class query;
+	class text_pattern;
+
 	struct memory_region
 	{
-		memory_region() = default;
-		memory_region(const std::string& range_str);
 		size_t start, end;
-	};
 
-	// the first 4 bits of the datatype indicate the type
-	// 1. int
-	// 2. long
-	// 3. float
-	// 4. double
-	//
-	// and the latter 4 bits indicate the size
-	// (big endian)
-	enum class datatype : u8
-	{
-		INT		= 0x04,
-		LONG	= 0x18,
-		FLOAT	= 0x24,
-		DOUBLE	= 0x38
-	};
-
-	constexpr std::array<const std::string, 4> datatype_names = {
-		"i32",
-		"i64",
-		"f32",
-		"f64"
+		// shared mappings can be written to by other processes
+		bool shared{false};
 	};
 
 	struct type_bundle
@@ -74,38 +67,13 @@ namespace harava
 		ge  // greater than or equal to
 	};
 
-	union type_union
-	{
-		i32 _int;
-		i64 _long;
-		f32 _float;
-		f64 _double;
-		u8 bytes[8];
-	};
-
-	struct result
+	// how a value should have changed between two scans
+	enum class value_change
 	{
-		type_union value;
-		u32 location;
-		u16 region_id;
-		datatype type;
-
-		__attribute__((hot))
-		bool compare_bytes(const std::vector<u8>& bytes) const noexcept;
-	};
-
-	struct results
-	{
-		u64 total_size() const;
-		u64 count() const;
-		std::optional<result*> at(const u64 index);
-		void clear();
-		std::array<std::pair<u8, std::vector<result>*>, 4> result_vecs() noexcept;
-
-		std::vector<result> int_results;
-		std::vector<result> long_results;
-		std::vector<result> float_results;
-		std::vector<result> double_results;
+		unchanged,
+		changed,
+		increased,
+		decreased
 	};
 
 	template<typename T>
@@ -142,58 +110,196 @@ namespace harava
 		results search(const options opts, const filter filter, const type_bundle value, const comparison comparison);
 
 		__attribute__((warn_unused_result))
-		results refine_search(const type_bundle new_value, results& old_results, const comparison comparison);
+		results refine_search(const type_bundle new_value, const results& old_results, const comparison comparison);
+
+		// search with a query that can combine multiple comparisons, all of
+		// the terms are checked during a single pass over the memory
+		__attribute__((warn_unused_result))
+		results search(const options opts, const filter filter, const query& query);
 
 		__attribute__((warn_unused_result))
-		results refine_search_change(results& old_results, const bool expected_result);
+		results refine_search(const query& query, const results& old_results);
+
+		// find the addresses where a byte pattern appears, the matches are stored
+		// as i64 results if the pattern is at least 8 bytes long, and as i32 otherwise
+		__attribute__((warn_unused_result))
+		results search_pattern(const options opts, const byte_pattern& pattern);
+
+		// find the addresses where a text appears, the results remember the
+		// encoding and the size of the text so that it can be listed and set
+		__attribute__((warn_unused_result))
+		results search_text(const options opts, const text_pattern& pattern);
+
+		// keep the text results that still contain the text
+		__attribute__((warn_unused_result))
+		results refine_text(const text_pattern& pattern, const results& old_results);
+
+		__attribute__((warn_unused_result))
+		results refine_search_change(const results& old_results, const value_change change);
+
+		// copy the memory of all of the regions without looking for anything,
+		// the candidates get picked when the snapshot is compared to the memory later
+		__attribute__((warn_unused_result))
+		snapshot take_snapshot();
+
+		__attribute__((warn_unused_result))
+		results refine_snapshot(const options opts, const filter filter, const snapshot& old_snapshot, const value_change change);
 
 		void set(result& result, const type_bundle value);
+
+		// write bytes to the address of a result
+		void write(const result& result, const std::vector<u8>& bytes);
+
+		// write values[type index] to the address of every result of that type. the
+		// writes are sorted by address and the ones that touch or overlap are merged
+		// (later results win where they overlap), so everything goes out in a few
+		// process_vm_writev calls. if verify is set, the memory is read back
+		// afterwards and the return value is the amount of results that don't
+		// have the written bytes, otherwise the return value is 0
+		u64 set_all(const results& results, const std::array<std::vector<u8>, 4>& values, const bool verify);
+
+		// read bytes from the address of a result
+		std::vector<u8> read(const result& result, const u64 size);
 		u64 region_count() const;
 
-		template<typename T>
-		T get_result_value(const result result) noexcept
-		{
-			std::fstream mem(mem_path, std::ios::in | std::ios::binary);
-			if (!mem.is_open())
-			{
-				std::cout << "can't open " << mem_path;
-				exit(1);
-			}
+		// address of a result in the target process
+		u64 address(const result& result) const;
 
-			mem.seekg(result.location + regions.at(result.region_id).start, std::ios::beg);
+		// read size bytes from the address of each result in a single batch,
+		// the bytes of results[i] start from i * size in the returned buffer
+		std::vector<u8> read_results(std::span<const result> results, const u64 size);
 
-			T value;
-			mem.read((char*)&value, sizeof(T));
+		// print the amount of bytes read and the throughput of the read backend
+		void print_read_stats() const;
 
-			return value;
-		}
+		// stage by stage statistics of the latest scan or refinement
+		const scan_metrics& last_metrics() const;
+
+		// save the regions, the results and the snapshot (if it isn't empty) to a file
+		bool save(const std::string& path, const results& results, const snapshot& snapshot) const;
+
+		// find pointer chains from the static variables of the modules to the target address,
+		// the pointers are looked for in the regions and the offsets are at most max_offset
+		__attribute__((warn_unused_result))
+		pointer_chains pointer_scan(const u64 target, const u8 max_depth, const u32 max_offset);
+
+		// follow the chains in the process, each chain leads to the returned
+		// address at the same index or to 0 if any of its pointers can't be read
+		std::vector<u64> follow(const pointer_chains& chains);
+
+		// continue a saved session, the regions that aren't mapped in the process
+		// anymore are left out along with their results. returns false and leaves
+		// everything as it was if the file can't be loaded
+		bool load(const std::string& path, results& results, snapshot& snapshot);
+
+		// update the regions from the current memory map of the process without
+		// starting over. the regions that are still mapped keep their ids and grow
+		// along with their mappings, and the results and the snapshot pages in the
+		// ranges that aren't mapped anymore are dropped. if the snapshot isn't empty,
+		// only the new and the grown ranges are read into it. returns false and
+		// leaves everything as it was if the memory map can't be read
+		bool refresh(results& results, snapshot& snapshot);
 
 	private:
 		static constexpr u8 max_type_size = 8;
 
-		template<typename T>
-		union type_as_bytes
+		// region ids are 16 bits
+		static constexpr u32 max_regions = 65536;
+
+		// read a range of bytes from the target process
+		std::vector<u8> read_region(const size_t start, const size_t end);
+
+		// a range of bytes in a region
+		struct region_range
 		{
-			T type;
-			u8 bytes[max_type_size] = { 0, 0, 0, 0, 0, 0, 0, 0};
+			u16 region_id;
+			u64 location;
+			u64 size;
 		};
 
-		// read a range of bytes from a file
-		std::vector<u8> read_region(std::ifstream& file, const size_t start, const size_t end);
+		// copy the ranges into a new snapshot, used_memory is the amount of
+		// memory that already counts against the memory limit
+		snapshot snapshot_ranges(const std::vector<region_range>& ranges, const u64 used_memory);
 
-		struct region_snapshot
+		static constexpr u64 page_size = 4096;
+
+		// copy of the pages that contain the results of a single segment,
+		// pages next to each other are coalesced into a single run
+		struct segment_snapshot
 		{
-			memory_region* region;
-			std::vector<u8> bytes;
+			struct page_run
+			{
+				u64 location;
+				u64 size;
+				u64 offset;	// where the run starts in the bytes
+			};
+
+			std::vector<page_run> runs;
+			column<u8> bytes;
+
+			// the bytes at a location and the amount of bytes left in the
+			// run from there, the location has to be in one of the runs
+			std::pair<const u8*, u64> at(const u64 location) const;
+
+			// same as at(), but returns nullptr if the location isn't in any of the runs
+			//
+			// the search starts from the run at run_index and moves it forward,
+			// so consecutive calls have to be made in ascending location order
+			std::pair<const u8*, u64> find(const u64 location, u64& run_index) const;
+
+			// copy the bytes of the runs that overlap [location, location + size),
+			// the rest of the destination is left as it is
+			void copy_to(const u64 location, u8* destination, const u64 size) const;
 		};
 
-		std::unordered_map<u16, region_snapshot> snapshot_regions(results& results);
-		void trim_region_range(const result result);
+		// scan the regions for a byte_pattern or a text_pattern, the
+		// matches are stored as results of the type at type_index
+		template<typename Pattern>
+		results find_pattern(const options opts, const Pattern& pattern, const u8 type_index);
+
+		// read the pages around the results of each segment, the pages
+		// that don't fit into the budget are read to a spill file
+		//
+		// if skip_clean_pages is set and the values of the results were read
+		// while the soft-dirty bits were tracked, only the pages that have
+		// been written to since then are read, so the results on the pages
+		// that are left out have the same values as before
+		std::vector<segment_snapshot> snapshot_segments(const results& results, memory_budget& budget, const bool skip_clean_pages);
+
+		// mark the pages in [location, location + pages * page_size) of a region
+		// that have to be read again, which are the pages that have been written to
+		// since the soft-dirty bits were cleared and their neighbours, because values
+		// can cross page boundaries. returns false if all of the pages have to be read
+		bool changed_pages(const u16 region_id, const u64 location, const u64 pages, std::vector<u64>& changed) const;
+
+		// the current mappings of the process in address order
+		std::vector<mapping> read_mappings() const;
+
+		// true if the results can be looked for in a mapping
+		bool suitable(const mapping& mapping) const;
+
+		// print how much data had to be moved to the spill files
+		void print_spill_stats(const memory_budget& budget) const;
+
+		// start and finish measuring an operation, the reader stats get reset
+		void begin_metrics(const std::string& operation);
+		void end_metrics(const u64 matches);
 
 		const i32 pid;
 		const std::string proc_path;
-		const std::string mem_path;
+		std::unique_ptr<reader> mem_reader;
+		writer mem_writer;
+		thread_pool pool;
+		const u64 chunk_size;
+		const u64 memory_limit;
+		const bool stack_scan;
+		soft_dirty_tracker dirty_tracker;
+		scan_metrics metrics;
 
 		std::map<u16, memory_region> regions;
+
+		// the ids only count up so that the results of a region that is gone
+		// can't end up pointing to a new one, until they run out in refresh()
+		u32 next_region_id{0};
 	};
 }
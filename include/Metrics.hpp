@@ -0,0 +1,116 @@
+#pragma once
+
+#include "Reader.hpp"
+#include "Types.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace harava
+{
+	enum class stage : u8
+	{
+		read,		// copying the memory of the target
+		scan,		// comparing the values
+		merge,		// putting the results together
+		allocate	// waiting for buffers and moving results to the spill files
+	};
+
+	constexpr std::array<const char*, 4> stage_names = { "read", "scan", "merge", "allocate" };
+
+	// cpu cycles and cache misses of every thread in this process, counted
+	// with perf_event_open when the kernel allows it
+	class hardware_counters
+	{
+	public:
+		~hardware_counters();
+
+		// open and enable the counters for all of the current threads,
+		// returns false if the counters aren't available
+		bool start();
+
+		// stop counting and return the cycles and the cache misses
+		std::pair<u64, u64> stop();
+
+	private:
+		void close_all();
+
+		std::vector<int> cycle_fds;
+		std::vector<int> miss_fds;
+	};
+
+	// statistics of the latest scan or refinement, broken down into stages. the
+	// stage times are summed over all of the threads, so they show where the work
+	// went rather than how long the operation took
+	class scan_metrics
+	{
+	public:
+		// the metrics of each operation get appended to the json file as a
+		// single line if a path is given
+		scan_metrics(const std::string& json_path, const bool count_hardware_events);
+
+		void begin(const std::string& operation, const u32 region_count);
+		void end(const reader_stats& reads, const u64 matches);
+
+		void add_time(const stage stage, const u64 nanoseconds);
+
+		// how long reading the given region took, only the full passes over the memory time their regions
+		void add_region_time(const u16 region_id, const u64 nanoseconds);
+
+		void buffer_allocated(const u64 bytes);
+		void buffer_released(const u64 bytes);
+
+		void print() const;
+
+	private:
+		std::string json() const;
+
+		std::string operation;
+		std::chrono::steady_clock::time_point start;
+		u64 wall_nanoseconds{0};
+
+		std::array<std::atomic<u64>, stage_names.size()> stage_nanoseconds{};
+		std::unique_ptr<std::atomic<u64>[]> region_nanoseconds;
+		u32 regions{0};
+
+		// log2 buckets of the per region read times in microseconds
+		static constexpr u8 histogram_buckets = 24;
+		std::array<u64, histogram_buckets> region_histogram{};
+
+		std::atomic<u64> buffer_bytes{0};
+		std::atomic<u64> peak_buffer_bytes{0};
+
+		reader_stats read_stats;
+		u64 match_count{0};
+
+		const bool count_hardware_events;
+		bool hardware_events_counted{false};
+		hardware_counters counters;
+		u64 cycles{0};
+		u64 cache_misses{0};
+
+		std::ofstream json_file;
+	};
+
+	// adds the time from construction to destruction (or to stop()) to a stage
+	class stage_timer
+	{
+	public:
+		stage_timer(scan_metrics& metrics, const stage stage);
+		~stage_timer();
+
+		// add the time so far to the stage and return it
+		u64 stop();
+
+	private:
+		scan_metrics& metrics;
+		const stage timed_stage;
+		const std::chrono::steady_clock::time_point start;
+		bool stopped{false};
+	};
+}
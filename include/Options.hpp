@@ -2,14 +2,30 @@
 
 #include "Types.hpp"
 
+#include <string>
+
 namespace harava
 {
+	enum class read_backend
+	{
+		vm,		// process_vm_readv
+		pread	// pread on /proc/<pid>/mem
+	};
+
 	struct options
 	{
 		i32 pid{};
 		u64 memory_limit = 8; // limit in gigabytes
+		u64 chunk_size = 4; // size of a single scan chunk in megabytes
+		u64 chunk_budget = 256; // limit for the chunk buffers in megabytes
+		u32 threads = 0; // worker thread count (0 = hardware concurrency)
 		bool skip_zeroes = false;
 		bool skip_null_regions = false;
 		bool stack_scan = false;
+		bool soft_dirty = true; // skip the pages that haven't been written to during refinements
+		u32 freeze_rate = 50; // how many times per second the frozen values are written
+		std::string metrics_json; // file that the metrics of each scan get appended to
+		bool hardware_counters = false; // count cpu cycles and cache misses with perf_event_open
+		read_backend backend = read_backend::vm;
 	};
 }
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Types.hpp"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace harava
+{
+	// a sequence of bytes where some of the nibbles can be anything, written
+	// as hex bytes like "48 8B ?? ?? 00 FF" where ? matches any nibble
+	class byte_pattern
+	{
+	public:
+		// prints the reason and returns nothing if the text isn't a valid pattern
+		static std::optional<byte_pattern> parse(const std::string& text);
+
+		u64 size() const;
+
+		// offsets of the two bytes without wildcards that are the least likely
+		// to appear in memory, the candidates for the pattern are found by
+		// looking for these two bytes before the whole pattern is compared
+		u64 first_anchor() const;
+		u64 second_anchor() const;
+		u8 at(const u64 offset) const;
+
+		// compare the whole pattern, bytes needs to have at least size() bytes
+		bool matches(const u8* bytes) const;
+
+	private:
+		std::vector<u8> values;
+		std::vector<u8> masks;
+		u64 anchors[2]{};
+	};
+}
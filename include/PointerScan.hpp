@@ -0,0 +1,82 @@
+#pragma once
+
+#include "ThreadPool.hpp"
+#include "Types.hpp"
+
+#include <array>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace harava
+{
+	// a path from a static address in a module to a target address. the first
+	// pointer is read from the start of the module + base_offset, and each of
+	// the offsets is added to the pointer that was read before following it
+	struct pointer_chain
+	{
+		static constexpr u8 max_depth = 8;
+
+		u32 module;			// index to pointer_chains::modules
+		u64 base_offset;
+		u8 depth{0};
+		std::array<u32, max_depth> offsets{};
+	};
+
+	struct pointer_chains
+	{
+		// module names without the directories, so that the chains
+		// still work if the executable gets moved
+		std::vector<std::string> modules;
+		std::vector<pointer_chain> chains;
+
+		// text form of a chain like "game+1a2b0 -> 18 -> 0", the numbers are in hex
+		std::string format(const pointer_chain& chain) const;
+
+		// one chain per line in the text form
+		bool write(const std::string& path) const;
+
+		// nullopt if the file can't be read or any of the lines isn't a chain
+		static std::optional<pointer_chains> read(const std::string& path);
+	};
+
+	// a pointer sized value in the target that points to a mapped address
+	struct pointer_entry
+	{
+		u64 value;
+		u64 address;
+	};
+
+	// the part of the memory of a module where its static variables are,
+	// the base address of the module is the start of its first mapping
+	struct pointer_module
+	{
+		std::string name;
+		u64 base;
+		u64 start;
+		u64 end;
+	};
+
+	struct pointer_search
+	{
+		u64 target;
+		u8 max_depth;
+		u32 max_offset;
+
+		// the candidates of a level are cut off once they would take more memory than this
+		u64 memory_budget;
+		u64 max_chains;
+	};
+
+	// search backwards from the target one level at a time: the pointers that point to
+	// at most max_offset bytes before any address of a level form the next level, until a
+	// pointer is found in the static part of a module. the addresses outside of the modules
+	// that were already reached on an earlier level aren't followed again, but the static
+	// pointers end a chain on every level where they are reached, since a longer chain from
+	// the same static pointer goes through different objects and isn't redundant
+	//
+	// the index has to be sorted by value and the modules by address
+	pointer_chains find_pointer_chains(thread_pool& pool, std::span<const pointer_entry> index,
+			const std::vector<pointer_module>& modules, const pointer_search& search);
+}
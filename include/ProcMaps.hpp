@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Types.hpp"
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace harava
+{
+	// a line of /proc/<pid>/maps
+	struct mapping
+	{
+		u64 start, end;
+		bool readable, writable;
+
+		// shared mappings can be written to by other processes
+		bool shared;
+
+		// can contain spaces, the " (deleted)" that the kernel adds
+		// after the files that are gone isn't a part of it
+		std::string path;
+		bool deleted;
+	};
+
+	// parse the contents of a maps file in a single pass without copying the
+	// lines, the lines that don't look like mappings are skipped
+	std::vector<mapping> parse_maps(const std::string_view text);
+
+	// read the whole maps file with a few read calls and parse it,
+	// nullopt if the file can't be read
+	std::optional<std::vector<mapping>> read_maps(const std::string& path);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "Memory.hpp"
+#include "Results.hpp"
+#include "Types.hpp"
+
+#include <array>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace harava
+{
+	constexpr type_mask all_types = 0b1111;
+
+	// a single comparison against a value for the types in the type mask
+	struct query_term
+	{
+		comparison op;
+		type_bundle value;
+		type_mask types{all_types};
+
+		template<typename T>
+		T value_as() const
+		{
+			if constexpr (std::is_same_v<T, i32>)
+				return value._int;
+			else if constexpr (std::is_same_v<T, i64>)
+				return value._long;
+			else if constexpr (std::is_same_v<T, f32>)
+				return value._float;
+			else
+				return value._double;
+		}
+	};
+
+	// a condition that values are searched with, the clauses are or'ed
+	// together and the terms inside of a clause are and'ed
+	//
+	// query  := clause ("or" clause)*
+	// clause := term ("and" term)*
+	// term   := [i32|i64|f32|f64] (= | < | > | <= | >=) value
+	//         | [i32|i64|f32|f64] between low high
+	//
+	// for example "between 100 200", "> 5 and < 9" or "i32 = 7 or f32 = 7.5"
+	class query
+	{
+	public:
+		using clause = std::vector<query_term>;
+
+		// prints the reason and returns nothing if the text isn't a valid query
+		static std::optional<query> parse(const std::string& text);
+
+		// a query with a single comparison for all of the types
+		static query single(const type_bundle& value, const comparison op);
+
+		const std::vector<clause>& clauses() const;
+
+		// the term of a query that is just a single comparison for all of the
+		// types, those can be checked for all types at once with the fused kernels
+		const query_term* single_term() const;
+
+		// a clause can only match the types that all of its terms apply to
+		static bool applies_to(const clause& clause, const u8 type_index);
+
+		// the value that every match of each type has, if the query
+		// only matches a single value for the types it can match
+		std::optional<std::array<type_union, 4>> known_values() const;
+
+		template<typename T>
+		bool matches(const u8* bytes, const u8 type_index, const bool skip_zeroes) const
+		{
+			T mem_value;
+			memcpy(&mem_value, bytes, sizeof(T));
+
+			if (skip_zeroes && mem_value == 0)
+				return false;
+
+			for (const clause& clause : clauses_list)
+			{
+				if (!applies_to(clause, type_index))
+					continue;
+
+				bool match = true;
+				for (const query_term& term : clause)
+					match = match && cmp(term.value_as<T>(), mem_value, term.op);
+
+				if (match)
+					return true;
+			}
+
+			return false;
+		}
+
+	private:
+		std::vector<clause> clauses_list;
+	};
+}
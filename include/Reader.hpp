@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Options.hpp"
+#include "Types.hpp"
+
+#include <atomic>
+#include <memory>
+#include <span>
+#include <string>
+
+namespace harava
+{
+	// a contiguous range of bytes in the target process that should
+	// be copied to the given destination buffer
+	struct read_span
+	{
+		size_t address;
+		size_t size;
+		u8* destination;
+	};
+
+	struct reader_stats
+	{
+		u64 bytes{0};
+		u64 syscalls{0};
+		u64 nanoseconds{0};
+	};
+
+	class reader
+	{
+	public:
+		virtual ~reader() = default;
+
+		// read all of the given spans from the target process
+		//
+		// parts of the spans that can't be read are filled with zeroes
+		// and the return value is the amount of bytes that could be read
+		virtual size_t read(std::span<const read_span> spans) = 0;
+		size_t read(const size_t address, u8* destination, const size_t size);
+
+		virtual std::string name() const = 0;
+
+		reader_stats stats() const;
+		void reset_stats();
+
+	protected:
+		void record(const u64 bytes, const u64 syscalls, const u64 nanoseconds);
+
+	private:
+		std::atomic<u64> bytes_read{0};
+		std::atomic<u64> syscall_count{0};
+		std::atomic<u64> read_nanoseconds{0};
+	};
+
+	// batches the spans into as few process_vm_readv calls as possible
+	class vm_reader : public reader
+	{
+	public:
+		vm_reader(const i32 pid);
+		size_t read(std::span<const read_span> spans) override;
+		std::string name() const override;
+
+	private:
+		const i32 pid;
+	};
+
+	// fallback for systems where process_vm_readv is not available,
+	// reads with pread from a persistent /proc/<pid>/mem file descriptor
+	class pread_reader : public reader
+	{
+	public:
+		pread_reader(const i32 pid);
+		~pread_reader();
+		size_t read(std::span<const read_span> spans) override;
+		std::string name() const override;
+
+	private:
+		const std::string mem_path;
+		int fd{-1};
+	};
+
+	std::unique_ptr<reader> make_reader(const i32 pid, const read_backend backend);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Types.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace harava
+{
+	// the locations [first, last) of a region that are still mapped after the memory
+	// map has changed, and where they are now. a region keeps its id for the part that
+	// starts from its start unless the ids get renumbered, and the parts after a hole
+	// become regions of their own
+	struct region_move
+	{
+		u16 region_id;
+		u64 first;
+		u64 last;
+		u16 new_region_id;
+		u64 new_first;
+	};
+
+	// the first move of a region that ends after the location
+	inline std::vector<region_move>::const_iterator first_move(const std::vector<region_move>& moves, const u16 region_id, const u64 location)
+	{
+		return std::lower_bound(moves.begin(), moves.end(), std::make_pair(region_id, location), [](const region_move& move, const auto& key)
+		{
+			return move.region_id < key.first || (move.region_id == key.first && move.last <= key.second);
+		});
+	}
+}
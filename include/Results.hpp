@@ -0,0 +1,402 @@
+#pragma once
+
+#include "Column.hpp"
+#include "RegionMove.hpp"
+#include "SpillFile.hpp"
+#include "Text.hpp"
+#include "Types.hpp"
+
+#include <array>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace harava
+{
+	// the first 4 bits of the datatype indicate the type
+	// 1. int
+	// 2. long
+	// 3. float
+	// 4. double
+	//
+	// and the latter 4 bits indicate the size
+	// (big endian)
+	enum class datatype : u8
+	{
+		INT		= 0x04,
+		LONG	= 0x18,
+		FLOAT	= 0x24,
+		DOUBLE	= 0x38
+	};
+
+	constexpr std::array<const std::string, 4> datatype_names = {
+		"i32",
+		"i64",
+		"f32",
+		"f64"
+	};
+
+	constexpr std::array<datatype, 4> datatypes = {
+		datatype::INT,
+		datatype::LONG,
+		datatype::FLOAT,
+		datatype::DOUBLE
+	};
+
+	constexpr u8 type_index(const datatype type)
+	{
+		return (static_cast<u8>(type) & 0xF0) >> 4UL;
+	}
+
+	constexpr u8 type_size(const datatype type)
+	{
+		return static_cast<u8>(type) & 0x0F;
+	}
+
+	// bit n of a type mask is set if the value at an address
+	// matched as datatypes[n]
+	using type_mask = u8;
+
+	// the types that need 8 bytes (i64 and f64)
+	constexpr type_mask wide_types = 0b1010;
+
+	constexpr u8 type_mask_size(const type_mask mask)
+	{
+		return (mask & wide_types) ? 8 : 4;
+	}
+
+	union type_union
+	{
+		i32 _int;
+		i64 _long;
+		f32 _float;
+		f64 _double;
+		u8 bytes[8];
+	};
+
+	struct result
+	{
+		type_union value;
+		u32 location;
+		u16 region_id;
+		datatype type;
+	};
+
+	enum class segment_kind
+	{
+		list,	// delta encoded locations with a type mask for each address
+		bitmap	// a bit for each type at each location in the covered range
+	};
+
+	// the results found from a consecutive range of a single region
+	//
+	// sparse results are stored as a list where each address is stored only
+	// once with a type mask, the locations are delta encoded and the values
+	// live in separate columns
+	//
+	// dense results are stored as a bitmap with a bit plane per type and
+	// a copy of the bytes in the covered range as the values, for bitmaps
+	// the entry of a result is its offset from the start of the range
+	class result_segment
+	{
+	public:
+		u16 region_id{};
+
+		// build a bitmap segment from the bit planes that cover the locations
+		// [first_location, first_location + span), planes of the types that
+		// aren't present can be left empty
+		//
+		// values should be a copy of the span + 7 bytes starting from the first
+		// location, or empty if the values don't need to be stored
+		static result_segment from_bitmap(const u16 region_id, const u32 first_location, const u32 span,
+				std::array<std::vector<u64>, 4>&& planes, std::vector<u8>&& values);
+
+		// estimate if a bitmap would take less memory than a list
+		static bool prefer_bitmap(const u64 entries, const u64 span, const type_mask types, const bool store_values);
+
+		// convert a bitmap that has become sparse into a list
+		void compact();
+
+		segment_kind kind() const;
+		u32 first_location() const;
+		u32 span() const;
+		std::span<const u64> plane(const u8 type_index) const;
+		std::span<const u8> values() const;
+
+		u64 entry_count() const;
+		u64 result_count() const;
+
+		// amount of bytes that the segment keeps in the memory
+		u64 total_size() const;
+
+		// move the columns of the segment to a spill file, the segment keeps
+		// the file alive for as long as it needs it
+		bool spill(const std::shared_ptr<spill_file>& file);
+		bool spilled() const;
+
+		// let the kernel drop the spilled columns from the ram after a refinement pass
+		void release() const;
+
+		u32 location(const u64 entry) const;
+		type_mask mask(const u64 entry) const;
+
+		// all of the types that appear in the segment
+		type_mask types() const;
+
+		bool has_values() const;
+		bool has_wide_values() const;
+
+		// the stored bytes of an entry, bytes above the width
+		// of the value columns are zero
+		u64 value_bits(const u64 entry) const;
+
+		// find the entry and the type index of the nth result in the segment
+		std::pair<u64, u8> find_result(const u64 n) const;
+
+		// call f(entry, location, mask) for each entry in order
+		template<typename F>
+		void for_each_entry(F&& f) const
+		{
+			for_each_entry(0, entry_range(), f);
+		}
+
+		// call f(entry, location, mask) for each entry in [first, last) in order,
+		// for bitmaps the range is in locations relative to the first location
+		template<typename F>
+		void for_each_entry(const u64 first, const u64 last, F&& f) const
+		{
+			if (representation == segment_kind::bitmap)
+			{
+				for (u64 word = first / 64; word < (last + 63) / 64; ++word)
+				{
+					u64 bits = combined_word(word);
+					if (word == first / 64)
+						bits &= ~0ULL << (first % 64);
+					if (word == last / 64)
+						bits &= (1ULL << (last % 64)) - 1;
+
+					for (; bits != 0; bits &= bits - 1)
+					{
+						const u64 entry = word * 64 + __builtin_ctzll(bits);
+						f(entry, bitmap_first + entry, mask(entry));
+					}
+				}
+				return;
+			}
+
+			if (first >= last)
+				return;
+
+			// start from the closest checkpoint and skip to the first entry
+			const checkpoint& cp = checkpoints[first / checkpoint_interval];
+			u64 offset = cp.delta_offset;
+			u32 location = cp.location;
+
+			for (u64 entry = first - first % checkpoint_interval; entry < first; ++entry)
+				location += decode_delta(offset);
+
+			for (u64 entry = first; entry < last; ++entry)
+			{
+				location += decode_delta(offset);
+				f(entry, location, type_masks[entry]);
+			}
+		}
+
+		// the end of the range that for_each_entry(first, last, f) accepts
+		u64 entry_range() const
+		{
+			return representation == segment_kind::bitmap ? bitmap_span : type_masks.size();
+		}
+
+	private:
+		u64 bitmap_words() const
+		{
+			return (bitmap_span + 63) / 64;
+		}
+
+		// all of the locations in a bitmap word that have at least one result
+		u64 combined_word(const u64 word) const
+		{
+			u64 combined{0};
+			for (const column<u64>& plane : planes)
+				if (!plane.empty())
+					combined |= plane[word];
+			return combined;
+		}
+
+		// results in the bitmap words [word, word + count)
+		u64 bitmap_result_count(const u64 word, const u64 count) const;
+
+		friend class segment_builder;
+		friend class results;
+		friend class session;
+
+		u32 decode_delta(u64& offset) const
+		{
+			u32 value{0};
+			u8 shift{0};
+
+			while (true)
+			{
+				const u8 byte = location_deltas[offset++];
+				value |= static_cast<u32>(byte & 0x7F) << shift;
+
+				if (!(byte & 0x80))
+					return value;
+
+				shift += 7;
+			}
+		}
+
+		// location of the entry before every 64th entry and
+		// where its delta starts in the delta stream
+		struct checkpoint
+		{
+			u64 delta_offset;
+			u32 location;
+		};
+		static constexpr u8 checkpoint_interval = 64;
+
+		// entry (or bitmap block) that contains every 1024th result in the segment
+		struct result_sample
+		{
+			u64 entry;
+			u64 results_before;
+		};
+		static constexpr u16 sample_interval = 1024;
+
+		column<u8> location_deltas;
+		column<checkpoint> checkpoints;
+		column<type_mask> type_masks;
+		column<result_sample> result_samples;
+
+		column<u32> value_low;
+		column<u32> value_high;
+
+		segment_kind representation{segment_kind::list};
+
+		// bitmap representation
+		u32 bitmap_first{0};
+		u32 bitmap_span{0};
+		u64 bitmap_entries{0};
+		std::array<column<u64>, 4> planes;
+		column<u8> value_bytes;
+
+		// results before every 8th bitmap word
+		column<u64> block_results_before;
+		static constexpr u8 bitmap_block_words = 8;
+
+		u64 results_total{0};
+		type_mask combined_types{0};
+
+		std::shared_ptr<spill_file> spill_storage;
+	};
+
+	class segment_builder
+	{
+	public:
+		// values can be left out if they are known beforehand, and
+		// the wide value column is only needed for i64 and f64 values
+		segment_builder(const u16 region_id, const bool store_values, const bool wide_values);
+
+		// entries have to be added in ascending location order, value
+		// needs to have at least type_mask_size(mask) bytes
+		void add(const u32 location, const type_mask mask, const u8* value);
+
+		u64 entry_count() const;
+		result_segment finish();
+
+	private:
+		result_segment segment;
+		const bool store_values;
+		const bool wide_values;
+		u32 previous_location{0};
+	};
+
+	class results
+	{
+	public:
+		u64 total_size() const;
+		u64 count() const;
+		std::optional<result> at(const u64 index) const;
+		void clear();
+
+		// segments have to be added in region and location order
+		void add_segment(result_segment&& segment);
+
+		// move the results to where their memory is now and drop the ones that
+		// aren't in any of the moves or don't fit in them completely, the moves have
+		// to be sorted by region and location. returns the amount of dropped results
+		u64 move_regions(const std::vector<region_move>& moves);
+		const std::vector<result_segment>& segments() const;
+
+		// results where all of the values are known beforehand (like after an
+		// equality search) don't need to store the values of each address
+		void set_uniform_values(const std::array<type_union, 4>& values);
+		const std::optional<std::array<type_union, 4>>& uniform() const;
+
+		// the soft-dirty epoch that the values were read in, 0 if the
+		// values weren't read while the target was being tracked
+		void set_soft_dirty_epoch(const u64 epoch);
+		u64 soft_dirty_epoch() const;
+
+		// the results of a text search point to the first byte of each match,
+		// the values of the results are only the first bytes of the text
+		struct text_match
+		{
+			text_encoding encoding;
+			u64 size;	// in bytes
+		};
+
+		void set_text(const text_match& text);
+		const std::optional<text_match>& text() const;
+
+		// value of a single type for a segment entry
+		type_union value(const result_segment& segment, const u64 entry, const u8 type_index) const;
+
+		// update the value that is remembered for a result
+		void update_value(const u64 index, const type_union new_value);
+
+		// update the remembered values of all results to the value of their type
+		void update_all_values(const std::array<type_union, 4>& new_values);
+
+		// call f(result) for each result in index order
+		template<typename F>
+		void for_each(F&& f) const
+		{
+			for (const result_segment& segment : segment_list)
+			{
+				segment.for_each_entry([&](const u64 entry, const u32 location, const type_mask mask)
+				{
+					for (u8 i = 0; i < datatypes.size(); ++i)
+					{
+						if (!(mask & (1 << i)))
+							continue;
+
+						f(result{ value(segment, entry, i), location, segment.region_id, datatypes[i] });
+					}
+				});
+			}
+		}
+
+	private:
+		// fill in the value columns from the uniform values
+		void materialize_values();
+
+		static void write_value(result_segment& segment, const u64 entry, const u8 type_index, const type_union new_value);
+
+		std::vector<result_segment> segment_list;
+		std::vector<u64> segment_first_result;
+
+		// segment that contains every 1024th result
+		std::vector<u32> segment_samples;
+		static constexpr u16 sample_interval = 1024;
+
+		u64 total_results{0};
+		u64 dirty_epoch{0};
+		std::optional<std::array<type_union, 4>> uniform_values;
+		std::optional<text_match> text_info;
+	};
+}
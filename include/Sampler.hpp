@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Options.hpp"
+#include "Reader.hpp"
+#include "Types.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace harava
+{
+	// reads a set of addresses at a fixed rate on a background thread with a single
+	// batched read per tick. the samples go to a preallocated ring buffer that the
+	// thread writes to and a single consumer reads from without any locking
+	class sampler
+	{
+	public:
+		// each address gets value_size bytes per sample
+		sampler(const i32 pid, const read_backend backend, const std::vector<u64>& addresses, const u32 rate);
+		~sampler();
+
+		sampler(const sampler&) = delete;
+		sampler& operator=(const sampler&) = delete;
+
+		static constexpr u64 value_size = 8;
+
+		// samples per second, the rate given to the constructor is clamped to 1 - max_rate
+		static constexpr u32 max_rate = 10000;
+
+		// a sample is the nanoseconds since the sampling started
+		// followed by value_size bytes for each address
+		u64 sample_size() const;
+
+		// copy the oldest sample to the destination, returns false if there are none
+		bool pop(u8* destination);
+
+		// samples that were thrown away because the ring buffer was full
+		u64 dropped() const;
+
+		u32 rate() const;
+
+	private:
+		void run();
+
+		std::unique_ptr<reader> sample_reader;
+		std::vector<read_span> spans;
+		const u32 tick_rate;
+		const u64 record_size;
+
+		// capacity is a power of two, head is only written by the
+		// sampling thread and tail only by the consumer
+		std::vector<u8> ring;
+		u64 capacity;
+		std::atomic<u64> head{0};
+		std::atomic<u64> tail{0};
+		std::atomic<u64> dropped_samples{0};
+
+		std::mutex mutex;
+		std::condition_variable wake_up;
+		bool stopping{false};
+		std::thread thread;
+	};
+}
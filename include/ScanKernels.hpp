@@ -0,0 +1,105 @@
+#pragma once
+
+#include "Filter.hpp"
+#include "Memory.hpp"
+#include "Types.hpp"
+
+#include <array>
+#include <type_traits>
+
+namespace harava
+{
+	enum class simd_level
+	{
+		scalar,
+		avx2,
+		avx512
+	};
+
+	// the best instruction set supported by the cpu, checked only once
+	simd_level detect_simd_level();
+	const char* simd_level_name(const simd_level level);
+
+	// use a specific instruction set instead of the detected one, the
+	// level has to be supported by the cpu (used by the benchmarks)
+	void force_simd_level(const simd_level level);
+
+	// call f with the comparison as a compile time constant, so that the
+	// comparison gets resolved once per call instead of once per value
+	template<typename F>
+	__attribute__((always_inline))
+	inline void dispatch_comparison(const comparison comparison, F&& f)
+	{
+		switch (comparison)
+		{
+			case comparison::eq:
+				f(std::integral_constant<harava::comparison, comparison::eq>{});
+				return;
+
+			case comparison::lt:
+				f(std::integral_constant<harava::comparison, comparison::lt>{});
+				return;
+
+			case comparison::gt:
+				f(std::integral_constant<harava::comparison, comparison::gt>{});
+				return;
+
+			case comparison::le:
+				f(std::integral_constant<harava::comparison, comparison::le>{});
+				return;
+
+			case comparison::ge:
+				f(std::integral_constant<harava::comparison, comparison::ge>{});
+				return;
+		}
+	}
+
+	// same as dispatch_comparison, but with skip_zeroes
+	// also passed to f as a compile time constant
+	template<typename F>
+	__attribute__((always_inline))
+	inline void dispatch_variant(const comparison comparison, const bool skip_zeroes, F&& f)
+	{
+		dispatch_comparison(comparison, [&](const auto c)
+		{
+			if (skip_zeroes)
+				f(c, std::true_type{});
+			else
+				f(c, std::false_type{});
+		});
+	}
+
+	// amount of byte positions covered by a single match mask
+	constexpr u8 scan_block_size = 64;
+
+	// compute a match mask for each block of 64 byte positions, bit n of
+	// masks[i] is set if the value at position i * 64 + n matches
+	//
+	// the caller has to make sure that there are at least
+	// blocks * 64 + sizeof(T) - 1 readable bytes
+	template<typename T>
+	__attribute__((hot))
+	void scan_blocks(const u8* bytes, const u64 blocks, const T value, const comparison comparison, const bool skip_zeroes, u64* masks);
+
+	// fused version of scan_blocks that evaluates all of the types enabled
+	// in the filter for a block while it is still in the cache
+	//
+	// the masks are in the same order as the results vectors (i32, i64, f32, f64)
+	// and the masks of disabled types are left untouched
+	__attribute__((hot))
+	void scan_blocks_fused(const u8* bytes, const u64 blocks, const type_bundle& value, const filter filter,
+			const comparison comparison, const bool skip_zeroes, const std::array<u64*, 4>& masks);
+
+	// compute a mask for each block of 64 bytes where bit n of masks[i]
+	// is set if the bytes at position i * 64 + n differ between a and b
+	__attribute__((hot))
+	void diff_blocks(const u8* a, const u8* b, const u64 blocks, u64* masks);
+
+	// compute a mask for each block of 64 bytes where bit n of masks[i] is set if
+	// (first[i * 64 + n] | first_fold) == first_value and the same for the second
+	// byte, used to find the candidates for a pattern from two of its bytes. the
+	// folds are 0x20 for ascii letters that should match in either case
+	__attribute__((hot))
+	void anchor_blocks(const u8* first, const u8* second, const u8 first_value, const u8 second_value,
+			const u8 first_fold, const u8 second_fold, const u64 blocks, u64* masks);
+}
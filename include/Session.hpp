@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Memory.hpp"
+#include "Results.hpp"
+#include "Snapshot.hpp"
+#include "Types.hpp"
+
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+
+namespace harava
+{
+	// a search saved to a file so that it can be continued after a restart
+	//
+	// the file starts with a header, followed by a record for each region,
+	// result segment and snapshot chunk, and then the data of their columns.
+	// each column starts from a 64 byte boundary in native byte order, so the
+	// loaded results and the snapshot use the mapped file in place and loading
+	// takes about the same time no matter how many results there are
+	class session
+	{
+	public:
+		static constexpr char magic[4] = { 'H', 'R', 'V', 'S' };
+		static constexpr u32 version = 1;
+
+		i32 pid{0};
+		std::map<u16, memory_region> regions;
+		results saved_results;
+		snapshot saved_snapshot;
+
+		// results of the regions that were left out
+		u64 dropped_results{0};
+
+		// the snapshot is only saved if it isn't empty. returns false if the file can't be written
+		static bool save(const std::string& path, const i32 pid, const std::map<u16, memory_region>& regions,
+				const results& results, const snapshot& snapshot);
+
+		// keep_region gets called for each saved region, and the results and the snapshot
+		// chunks of the regions that it returns false for are left out. nullopt if the
+		// file can't be mapped or it isn't a valid session file
+		static std::optional<session> load(const std::string& path, const std::function<bool(const memory_region&)>& keep_region);
+
+	private:
+		// call f(column) for each column of a segment in the order that they are stored
+		template<typename Segment, typename F>
+		static void for_each_column(Segment& segment, F&& f);
+	};
+}
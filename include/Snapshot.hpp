@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Column.hpp"
+#include "RegionMove.hpp"
+#include "SpillFile.hpp"
+#include "Types.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace harava
+{
+	// a copy of the memory regions taken by an unknown initial value scan
+	//
+	// most of the memory in a typical process is zeroes, so pages that
+	// only contain zeroes are left out and read back as zeroes
+	class snapshot
+	{
+	public:
+		static constexpr u64 page_size = 4096;
+
+		// a consecutive range of bytes from a single region
+		struct chunk
+		{
+			u16 region_id;
+			u64 location;
+			u64 size;
+
+			// index of each page in the page store, zero pages aren't stored
+			column<u32> page_indices;
+			column<u8> pages;
+
+			std::shared_ptr<spill_file> spill_storage;
+
+			// move the pages to a spill file
+			bool spill(const std::shared_ptr<spill_file>& file);
+		};
+
+		static constexpr u32 zero_page = 0xFFFFFFFF;
+
+		static chunk compress(const u16 region_id, const u64 location, const u8* bytes, const u64 size);
+
+		// chunks have to be added in region and location order
+		void add_chunk(chunk&& chunk);
+
+		// move the chunks of another snapshot into this one, the chunks
+		// of the two snapshots can't overlap
+		void merge(snapshot&& other);
+
+		// move the bytes to where their memory is now and drop the ones that
+		// aren't in any of the moves, the moves have to be sorted by region and location
+		void move_regions(const std::vector<region_move>& moves);
+
+		// copy a range of bytes from a region, bytes that
+		// aren't in the snapshot are filled with zeroes
+		void read(const u16 region_id, const u64 location, u8* destination, const u64 size) const;
+
+		bool empty() const;
+		void clear();
+
+		// the soft-dirty epoch that the snapshot was taken in, 0 if
+		// the target wasn't being tracked
+		void set_soft_dirty_epoch(const u64 epoch);
+		u64 soft_dirty_epoch() const;
+
+		// amount of bytes covered by the snapshot
+		u64 byte_count() const;
+
+		// amount of memory used by the snapshot, excluding the spilled pages
+		u64 total_size() const;
+
+	private:
+		friend class session;
+
+		// copy bytes from [offset, offset + size) of a chunk
+		static void copy_bytes(const chunk& chunk, const u64 offset, u8* destination, const u64 size);
+
+		std::vector<chunk> chunks;
+		u64 dirty_epoch{0};
+	};
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Types.hpp"
+
+#include <string>
+
+namespace harava
+{
+	// keeps track of the pages that the target process writes to
+	//
+	// the kernel keeps a soft-dirty bit for each page of a process, writing 4 to
+	// /proc/<pid>/clear_refs clears all of the bits and /proc/<pid>/pagemap
+	// reports them. after a clear, the pages that still don't have the bit set
+	// are known to have the same bytes as anything read from them after the clear
+	class soft_dirty_tracker
+	{
+	public:
+		static constexpr u64 page_size = 4096;
+
+		soft_dirty_tracker(const i32 pid, const bool enabled);
+		~soft_dirty_tracker();
+
+		soft_dirty_tracker(const soft_dirty_tracker&) = delete;
+		soft_dirty_tracker& operator=(const soft_dirty_tracker&) = delete;
+
+		// false if the kernel doesn't support soft-dirty bits or
+		// the files of the target process can't be accessed
+		bool available() const;
+
+		// clear the bits of the whole process and start a new epoch
+		void clear();
+
+		// the epoch started by the latest clear, 0 if nothing is tracked
+		u64 epoch() const;
+
+		// set the bit n of dirty for every page n in [address, address + pages * page_size)
+		// that has been written to since the last clear, returns false if the pagemap
+		// can't be read, in which case every page should be treated as dirty
+		bool dirty_pages(const size_t address, const u64 pages, u64* dirty) const;
+
+	private:
+		const std::string clear_refs_path;
+		int pagemap_fd{-1};
+		u64 current_epoch{0};
+	};
+}
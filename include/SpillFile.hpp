@@ -0,0 +1,101 @@
+#pragma once
+
+#include "Types.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace harava
+{
+	// an unlinked temporary file that is mapped to memory
+	//
+	// data that doesn't fit into the memory limit gets moved here, and since
+	// the mapped pages are backed by the file, the kernel can drop them from
+	// the ram whenever it needs to and read them back in when they are used
+	class spill_file
+	{
+	public:
+		spill_file(const std::string& directory);
+		~spill_file();
+
+		spill_file(const spill_file&) = delete;
+		spill_file& operator=(const spill_file&) = delete;
+
+		// map an existing file to memory as a whole, so that the data in it can
+		// be used in place. changes to the mapped bytes stay in this process and
+		// nothing can be allocated from the file. nullptr if the file can't be mapped
+		static std::shared_ptr<spill_file> map_existing(const std::string& path);
+
+		// false if the file couldn't be created or mapped
+		bool valid() const;
+
+		// start of a file mapped with map_existing()
+		u8* data() const;
+
+		// reserve zeroed space from the file, the returned pointer stays
+		// valid for as long as the spill file exists
+		u8* allocate(const u64 size);
+
+		// copy bytes to the file
+		u8* store(const void* bytes, const u64 size);
+
+		// amount of bytes allocated from the file
+		u64 size() const;
+
+		// tell the kernel that the bytes aren't needed in the ram for now
+		static void release(const void* address, const u64 size);
+
+	private:
+		spill_file() = default;
+
+		// the existing mappings can't be moved without breaking the pointers
+		// to them, so the file grows by mapping new extents at its end
+		struct extent
+		{
+			u8* address;
+			u64 size;
+			u64 used;
+		};
+
+		int fd{-1};
+		u64 file_size{0};
+		u64 allocated{0};
+		std::vector<extent> extents;
+		mutable std::mutex mutex;
+	};
+
+	// keeps track of the memory used during a search or a refinement and
+	// hands out spill files for the data that doesn't fit within the limit
+	class memory_budget
+	{
+	public:
+		memory_budget(const u64 limit, const u64 used);
+
+		// returns false if the bytes don't fit within the limit
+		bool reserve(const u64 bytes);
+
+		// file for the data that outlives the search, like the results,
+		// nullptr if a spill file can't be created
+		std::shared_ptr<spill_file> results_file();
+
+		// file for the data that is only needed during the search
+		std::shared_ptr<spill_file> scratch_file();
+
+		// amount of bytes moved to the spill files
+		u64 spilled() const;
+
+	private:
+		std::shared_ptr<spill_file> open_file(std::shared_ptr<spill_file>& file);
+
+		const u64 limit;
+		std::atomic<u64> used;
+
+		std::shared_ptr<spill_file> results_spill;
+		std::shared_ptr<spill_file> scratch_spill;
+		bool spill_failed{false};
+		mutable std::mutex mutex;
+	};
+}
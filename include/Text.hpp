@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Types.hpp"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace harava
+{
+	enum class text_encoding
+	{
+		utf8,
+		utf16	// little endian
+	};
+
+	// convert utf-8 text to the given encoding, prints the reason and
+	// returns nothing if the text isn't valid utf-8
+	std::optional<std::vector<u8>> encode_text(const std::string& text, const text_encoding encoding);
+
+	// convert encoded text to utf-8 for printing, characters that
+	// can't be decoded or printed are replaced with dots
+	std::string decode_text(const u8* bytes, const u64 size, const text_encoding encoding);
+
+	// text to search for, optionally ignoring the case of ascii letters
+	class text_pattern
+	{
+	public:
+		static std::optional<text_pattern> parse(const std::string& text, const text_encoding encoding, const bool ignore_case);
+
+		text_encoding encoding() const;
+
+		// size of the encoded text in bytes
+		u64 size() const;
+
+		// the first and the last character are used to find the candidates
+		u64 first_anchor() const;
+		u64 second_anchor() const;
+
+		// the byte at an offset with ascii letters in lower case, and the bits
+		// that have to be set in the memory before comparing it to the byte
+		u8 at(const u64 offset) const;
+		u8 fold(const u64 offset) const;
+
+		bool matches(const u8* bytes) const;
+
+	private:
+		text_encoding text_encoding_type{text_encoding::utf8};
+		std::vector<u8> values;
+		std::vector<u8> folds;
+	};
+}
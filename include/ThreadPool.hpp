@@ -0,0 +1,123 @@
+#pragma once
+
+#include "Types.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace harava
+{
+	// fixed size pool of worker threads where each worker has its own task
+	// queue and idle workers steal tasks from the queues of other workers
+	class thread_pool
+	{
+	public:
+		// a thread count of zero uses the hardware concurrency
+		thread_pool(const u32 thread_count);
+		~thread_pool();
+
+		thread_pool(const thread_pool&) = delete;
+		thread_pool& operator=(const thread_pool&) = delete;
+
+		void submit(std::function<void()> task);
+
+		// try to run a single queued task on the calling thread,
+		// returns false if there was nothing to do
+		bool run_pending_task();
+
+		u32 size() const;
+
+		// index of the calling thread in the pool, threads outside
+		// of the pool share the index size()
+		u32 worker_index() const;
+
+	private:
+		struct task_queue
+		{
+			std::mutex mutex;
+			std::deque<std::function<void()>> tasks;
+		};
+
+		void worker_loop(const u32 index);
+		bool pop_task(const u32 index, std::function<void()>& task);
+
+		// one queue per worker and an extra one for tasks
+		// submitted from outside of the pool
+		std::vector<std::unique_ptr<task_queue>> queues;
+		std::vector<std::thread> threads;
+
+		std::atomic<u64> queued_tasks{0};
+		std::mutex sleep_mutex;
+		std::condition_variable wake_up;
+		bool stopping{false};
+	};
+
+	// a set of tasks that can be waited on together
+	class task_group
+	{
+	public:
+		task_group(thread_pool& pool);
+		~task_group();
+
+		void run(std::function<void()> task);
+
+		// wait for all of the tasks in the group to finish, the calling
+		// thread runs queued tasks while waiting
+		void wait();
+
+	private:
+		thread_pool& pool;
+		std::atomic<u64> remaining{0};
+
+		// the last task notifies while holding the mutex so that
+		// the group can't get destroyed under it
+		std::mutex finish_mutex;
+		std::condition_variable finished;
+	};
+
+	// run task(i) for each i in [0, count) and wait for all of them to finish
+	void parallel_for(thread_pool& pool, const u64 count, const std::function<void(const u64)>& task);
+
+	// sort blocks of the elements in parallel and then merge them in pairs, each
+	// round of merges is done in parallel too until a single block is left
+	template<typename T, typename Compare>
+	void parallel_sort(thread_pool& pool, std::vector<T>& elements, Compare compare)
+	{
+		constexpr u64 min_block_size = 1 << 16;
+		const u64 count = elements.size();
+		const u64 block_count = std::clamp<u64>(count / min_block_size, 1, pool.size() * 4);
+		const u64 block_size = (count + block_count - 1) / block_count;
+
+		if (block_count == 1)
+		{
+			std::sort(elements.begin(), elements.end(), compare);
+			return;
+		}
+
+		parallel_for(pool, block_count, [&](const u64 block)
+		{
+			std::sort(elements.begin() + std::min(count, block * block_size), elements.begin() + std::min(count, (block + 1) * block_size), compare);
+		});
+
+		std::vector<T> merged(count);
+		for (u64 width = block_size; width < count; width *= 2)
+		{
+			parallel_for(pool, (count + 2 * width - 1) / (2 * width), [&](const u64 pair)
+			{
+				const u64 first = pair * 2 * width;
+				const u64 middle = std::min(count, first + width);
+				const u64 last = std::min(count, first + 2 * width);
+				std::merge(elements.begin() + first, elements.begin() + middle, elements.begin() + middle, elements.begin() + last, merged.begin() + first, compare);
+			});
+
+			elements.swap(merged);
+		}
+	}
+}
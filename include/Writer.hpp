@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Types.hpp"
+
+#include <span>
+#include <string>
+
+namespace harava
+{
+	// a contiguous range of bytes that should be copied
+	// from the source buffer to the target process
+	struct write_span
+	{
+		size_t address;
+		size_t size;
+		const u8* source;
+	};
+
+	// batches the spans into as few process_vm_writev calls as possible, and
+	// falls back to pwrite on /proc/<pid>/mem for the spans that can't be written
+	// that way (like read-only pages that the mem file is still allowed to write to)
+	class writer
+	{
+	public:
+		writer(const i32 pid);
+		~writer();
+
+		writer(const writer&) = delete;
+		writer& operator=(const writer&) = delete;
+
+		// spans that continue where the previous span ended in both the target
+		// and the source get merged, so sorting them by address helps. returns
+		// the amount of bytes that could be written
+		size_t write(std::span<const write_span> spans);
+
+	private:
+		size_t write_fallback(const u8* source, const size_t address, const size_t size);
+
+		const i32 pid;
+		const std::string mem_path;
+		int fd{-1};
+	};
+}
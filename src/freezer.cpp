@@ -0,0 +1,149 @@
+#include "Freezer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+
+namespace harava
+{
+	static constexpr u32 max_rate = 1000;
+
+	freezer::freezer(const i32 pid, const u32 rate)
+	:value_writer(pid), tick_rate(std::clamp<u32>(rate, 1, max_rate))
+	{
+		thread = std::thread(&freezer::run, this);
+	}
+
+	freezer::~freezer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+
+		wake_up.notify_one();
+		thread.join();
+	}
+
+	void freezer::freeze(const u64 address, const std::vector<u8>& bytes, const std::string& description)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			frozen[address] = { address, bytes, description };
+			++generation;
+		}
+
+		wake_up.notify_one();
+	}
+
+	std::vector<freezer::frozen_value> freezer::values() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		std::vector<frozen_value> list;
+		list.reserve(frozen.size());
+		for (const auto& [address, value] : frozen)
+			list.push_back(value);
+
+		return list;
+	}
+
+	bool freezer::unfreeze(const u64 index)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (index >= frozen.size())
+			return false;
+
+		frozen.erase(std::next(frozen.begin(), index));
+		++generation;
+		return true;
+	}
+
+	void freezer::clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		frozen.clear();
+		++generation;
+	}
+
+	u32 freezer::rate() const
+	{
+		return tick_rate;
+	}
+
+	u64 freezer::failed_bytes() const
+	{
+		return failed.load(std::memory_order_relaxed);
+	}
+
+	void freezer::run()
+	{
+		using clock = std::chrono::steady_clock;
+		const clock::duration period = std::chrono::duration_cast<clock::duration>(std::chrono::seconds(1)) / tick_rate;
+
+		// the values are copied next to each other in address order, so
+		// values that are next to each other in the target become a single
+		// iovec and each tick is usually a single process_vm_writev call
+		std::vector<u8> buffer;
+		std::vector<write_span> spans;
+		u64 built_generation{0};
+		u64 total_size{0};
+
+		clock::time_point next_tick = clock::now();
+
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+
+				// sleep until there's something to write
+				if (frozen.empty())
+				{
+					wake_up.wait(lock, [this] { return stopping || !frozen.empty(); });
+					next_tick = clock::now();
+				}
+				else
+				{
+					// the deadlines are absolute so that the time taken by
+					// the writes doesn't add up into drift
+					wake_up.wait_until(lock, next_tick, [this] { return stopping; });
+				}
+
+				if (stopping)
+					return;
+
+				if (built_generation != generation)
+				{
+					total_size = 0;
+					for (const auto& [address, value] : frozen)
+						total_size += value.bytes.size();
+
+					buffer.resize(total_size);
+					spans.clear();
+
+					u64 offset{0};
+					for (const auto& [address, value] : frozen)
+					{
+						memcpy(buffer.data() + offset, value.bytes.data(), value.bytes.size());
+						spans.push_back({ address, value.bytes.size(), buffer.data() + offset });
+						offset += value.bytes.size();
+					}
+
+					built_generation = generation;
+				}
+			}
+
+			const u64 written = value_writer.write(spans);
+			failed.store(total_size - written, std::memory_order_relaxed);
+
+			// if the writes fall behind, skip the missed ticks instead of
+			// trying to catch up with a burst of writes
+			next_tick += period;
+			const clock::time_point now = clock::now();
+			if (next_tick < now)
+				next_tick = now + period;
+		}
+	}
+}
@@ -4,19 +4,29 @@
 
 #include <clipp.h>
 #include <iostream>
+#include <string>
 
 int main(int argc, char** argv)
 {
 	bool show_help = false;
+	std::string backend = "vm";
 	harava::options opts;
 
 	auto cli = (
 		clipp::option("--help", "-h").set(show_help) % "display help",
 		(clipp::option("--pid", "-p") & clipp::number("PID").set(opts.pid)) % "PID of the process to inspect",
-		(clipp::option("--memory", "-m") & clipp::number("GB").set(opts.memory_limit)) % "set the maximum memory usage in gigabytes",
+		(clipp::option("--memory", "-m") & clipp::number("GB").set(opts.memory_limit)) % "set the amount of results kept in memory in gigabytes, the rest are moved to a temporary file",
 		clipp::option("--skip-zeroes").set(opts.skip_zeroes) % "skip zeroes during the initial search to lower the memory usage (only really works for comparison searches)",
-		clipp::option("--skip-null-regions").set(opts.skip_null_regions) % "skip memory regions that are full of zeroes during the initial search",
-		clipp::option("--stack").set(opts.stack_scan) % "only scan the stack of the process"
+		(clipp::option("--chunk-size") & clipp::number("MB").set(opts.chunk_size)) % "size of the chunks that memory regions are scanned in",
+		(clipp::option("--chunk-budget") & clipp::number("MB").set(opts.chunk_budget)) % "maximum amount of memory used for chunk buffers during a scan",
+		(clipp::option("--threads", "-t") & clipp::number("COUNT").set(opts.threads)) % "amount of worker threads (default: hardware concurrency)",
+		clipp::option("--skip-null-regions").set(opts.skip_null_regions) % "skip memory chunks that are full of zeroes during the initial search",
+		clipp::option("--stack").set(opts.stack_scan) % "only scan the stack of the process",
+		clipp::option("--no-soft-dirty").set(opts.soft_dirty, false) % "read all of the results during refinements instead of only the pages that have been written to",
+		(clipp::option("--freeze-rate") & clipp::number("HZ").set(opts.freeze_rate)) % "how many times per second the frozen values are written (default: 50, at most 1000)",
+		(clipp::option("--metrics-json") & clipp::value("FILE", opts.metrics_json)) % "append the metrics of each scan to a file as json lines",
+		clipp::option("--hardware-counters").set(opts.hardware_counters) % "count cpu cycles and cache misses during the scans (needs perf_event_open)",
+		(clipp::option("--backend") & clipp::value("vm|pread", backend)) % "method used for reading the process memory (default: vm)"
 	);
 
 	if (!clipp::parse(argc, argv, cli))
@@ -32,6 +42,16 @@ int main(int argc, char** argv)
 		return 0;
 	}
 
+	if (backend == "vm")
+		opts.backend = harava::read_backend::vm;
+	else if (backend == "pread")
+		opts.backend = harava::read_backend::pread;
+	else
+	{
+		std::cout << "unknown read backend: " << backend << '\n';
+		return 1;
+	}
+
 	harava::run_shell(opts);
 
 	return 0;
@@ -1,33 +1,30 @@
 #include "Memory.hpp"
-
+#include "Pattern.hpp"
+#include "Query.hpp"
+#include "ScanKernels.hpp"
+#include "Session.hpp"
+#include "Text.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cassert>
 #include <cmath>
+#include <condition_variable>
 #include <cstring>
-#include <execution>
-#include <fstream>
-#include <future>
 #include <iostream>
+#include <mutex>
 #include <ostream>
-#include <regex>
-#include <sstream>
 #include <string>
 #include <unordered_map>
+#include <utility>
 
 constexpr u64 gigabyte = 1'000'000'000;
+constexpr u64 megabyte = 1'000'000;
 
 namespace harava
 {
-	static u16 memory_region_count = 0;
-
-	memory_region::memory_region(const std::string& range_str)
-	{
-		size_t line_pos = range_str.find('-');
-
-		std::stringstream hex_ss;
-		hex_ss << std::hex << range_str.substr(0, line_pos) << " " << range_str.substr(line_pos + 1, range_str.size() - line_pos - 1);
-		hex_ss >> start >> end;
-	}
-
 	type_bundle::type_bundle(const std::string& value)
 	{
 		try
@@ -49,507 +46,2205 @@ namespace harava
 		}
 	}
 
-	bool result::compare_bytes(const std::vector<u8>& bytes) const noexcept
+	memory::memory(const i32 pid, const options opts)
+	:pid(pid), proc_path("/proc/" + std::to_string(pid)),
+	 mem_reader(make_reader(pid, opts.backend)), mem_writer(pid), pool(opts.threads), chunk_size(std::max<u64>(opts.chunk_size * megabyte, max_type_size)),
+	 memory_limit(opts.memory_limit * gigabyte), stack_scan(opts.stack_scan), dirty_tracker(pid, opts.soft_dirty), metrics(opts.metrics_json, opts.hardware_counters)
 	{
-		const u8 type_size = static_cast<u8>(type) & 0x0F;
+		// Find suitable memory regions
+		const std::string maps_path = proc_path + "/maps";
+		const std::optional<std::vector<mapping>> mappings = read_maps(maps_path);
+
+		if (!mappings.has_value()) [[unlikely]]
+		{
+			std::cout << "can't open " << maps_path << '\n';
+			exit(1);
+		}
 
-		bool match = true;
-		for (u8 i = 0; i < type_size; ++i)
+		for (const mapping& mapping : mappings.value())
 		{
-			if (value.bytes[i] != bytes[i + location])
+			if (!suitable(mapping))
+				continue;
+
+			if (next_region_id == max_regions) [[unlikely]]
 			{
-				match = false;
+				std::cout << "the process has more than " << max_regions << " suitable regions, the rest are left out\n";
 				break;
 			}
+
+			regions[next_region_id++] = { mapping.start, mapping.end, mapping.shared };
+		}
+
+		if (regions.empty()) [[unlikely]]
+		{
+			std::cout << "no suitable memory regions could be found\n";
+			exit(1);
 		}
 
-		return match;
+		std::cout << "found " << regions.size() << " suitable regions\n";
 	}
 
-	u64 results::total_size() const
+	// library.so and versioned ones like library.so.1.2
+	static bool library_path(const std::string_view path)
 	{
-		return int_results.size() * sizeof(i32)
-			+ long_results.size() * sizeof(i64)
-			+ float_results.size() * sizeof(f32)
-			+ double_results.size() * sizeof(f64);
+		const size_t version_start = path.find_last_not_of(".0123456789") + 1;
+		if (version_start != path.size() && path[version_start] != '.')
+			return false;
+
+		return path.substr(0, version_start).ends_with(".so");
 	}
 
-	u64 results::count() const
+	bool memory::suitable(const mapping& mapping) const
 	{
-		return int_results.size()
-			+ long_results.size()
-			+ float_results.size()
-			+ double_results.size();
+		if (stack_scan && mapping.path != "[stack]")
+			return false;
+
+		// Skip memory regions that are not writable
+		if (!mapping.readable || !mapping.writable)
+			return false;
+
+		// Skip memory regions that are for external libraries
+		return !(mapping.path.starts_with("/lib")
+			|| mapping.path.starts_with("/usr/lib")
+			|| mapping.path.starts_with("/dev")
+			|| mapping.path.starts_with("/memfd")
+			|| mapping.path.ends_with(".dll")
+			|| mapping.path.ends_with("wine64")
+			|| mapping.path.ends_with("wine64-preloader")
+			|| mapping.path.ends_with(".drv")
+			|| library_path(mapping.path));
 	}
 
-	std::optional<result*> results::at(const u64 index)
+	// the comparison and skip_zeroes are template parameters so that the
+	// per value checks compile down to a single compare, the callers
+	// pick the variant once with dispatch_variant
+	template<typename T, comparison C, bool SkipZeroes>
+	__attribute__((always_inline))
+	static inline bool matches(const u8* bytes, const T value)
 	{
-		if (index >= count()) [[unlikely]]
+		T mem_value;
+		memcpy(&mem_value, bytes, sizeof(T));
+
+		if constexpr (SkipZeroes)
 		{
-			std::cout << "out-of-bounds index\n";
-			return {};
+			if (mem_value == 0)
+				return false;
 		}
 
-		auto vecs = result_vecs();
+		return cmp(value, mem_value, C);
+	}
+
+	// type mask of a single position in a set of bit planes
+	static inline type_mask plane_mask(const std::array<std::vector<u64>, 4>& planes, const u64 position)
+	{
+		type_mask mask{0};
+		for (u8 i = 0; i < planes.size(); ++i)
+			if (!planes[i].empty() && (planes[i][position / 64] >> (position % 64)) & 1)
+				mask |= 1 << i;
+
+		return mask;
+	}
+
+	// copy of the span + 7 bytes that bitmap segments use as their values,
+	// the bytes past the end of the region are left as zeroes
+	static std::vector<u8> bitmap_values(const u8* bytes, const u64 available, const u64 span)
+	{
+		std::vector<u8> values(span + sizeof(u64) - 1);
+		memcpy(values.data(), bytes, std::min<u64>(available, values.size()));
+		return values;
+	}
 
-		u64 total_elements{0};
-		std::vector<result>* target_vec = nullptr;
+	// turn the match planes of a chunk into a segment, bytes are the scanned bytes
+	// of the chunk and they are used as the values if those need to be stored
+	static result_segment segment_from_planes(const u16 region_id, const u64 base_location, const u64 positions,
+			std::array<std::vector<u64>, 4>&& planes, const u8* bytes, const u64 valid_size, const bool store_values, const bool wide_values)
+	{
+		const u64 words = (positions + 63) / 64;
+		std::vector<u64> combined(words);
+		type_mask types{0};
+		u64 entries{0};
 
-		for (auto& [vec_index, vec] : vecs)
+		for (u8 i = 0; i < planes.size(); ++i)
 		{
-			if (!vec->empty() && total_elements + vec->size() >= index)
+			for (u64 word = 0; word < planes[i].size(); ++word)
 			{
-				target_vec = vec;
-				break;
+				combined[word] |= planes[i][word];
+				if (planes[i][word] != 0)
+					types |= 1 << i;
 			}
+		}
+
+		for (const u64 word : combined)
+			entries += std::popcount(word);
 
-			total_elements += vec->size();
+		// broad scans match a large share of the positions, and then a bit per
+		// position is cheaper than storing each of the addresses separately
+		if (result_segment::prefer_bitmap(entries, positions, types, store_values))
+		{
+			return result_segment::from_bitmap(region_id, base_location, positions, std::move(planes),
+					store_values ? bitmap_values(bytes, valid_size, positions) : std::vector<u8>());
 		}
 
-		assert(target_vec != nullptr);
-		assert(!target_vec->empty());
-		assert(index < target_vec->size());
-		return &target_vec->at(index);
-	}
+		segment_builder builder(region_id, store_values, wide_values);
 
-	void results::clear()
-	{
-		int_results.clear();
-		long_results.clear();
-		float_results.clear();
-		double_results.clear();
+		for (u64 word = 0; word < words; ++word)
+		{
+			for (u64 bits = combined[word]; bits != 0; bits &= bits - 1)
+			{
+				const u64 i = word * 64 + __builtin_ctzll(bits);
+				builder.add(base_location + i, plane_mask(planes, i), &bytes[i]);
+			}
+		}
+
+		return builder.finish();
 	}
 
-	std::array<std::pair<u8, std::vector<result>*>, 4> results::result_vecs() noexcept
+	template<typename T>
+	static inline bool value_changed_as(const u8* old_bytes, const u8* new_bytes, const value_change change)
 	{
-		return {
-			std::make_pair( 0, &int_results ),
-			{ 1, &long_results },
-			{ 2, &float_results },
-			{ 3, &double_results }
-		};
+		// equality is checked bytewise so that changes between
+		// different nan values and +0 / -0 don't get missed
+		if (change == value_change::unchanged || change == value_change::changed)
+			return (memcmp(old_bytes, new_bytes, sizeof(T)) == 0) == (change == value_change::unchanged);
+
+		T old_value, new_value;
+		memcpy(&old_value, old_bytes, sizeof(T));
+		memcpy(&new_value, new_bytes, sizeof(T));
+
+		return change == value_change::increased
+			? new_value > old_value
+			: new_value < old_value;
 	}
 
-	memory::memory(const i32 pid, const options opts)
-	:pid(pid), proc_path("/proc/" + std::to_string(pid)), mem_path(proc_path + "/mem")
+	static bool value_changed_as(const u8* old_bytes, const u8* new_bytes, const u8 type_index, const value_change change)
 	{
-		// Find suitable memory regions
-		const std::string maps_path = proc_path + "/maps";
-		std::ifstream maps(maps_path);
-
-		if (!maps.is_open()) [[unlikely]]
+		switch (datatypes[type_index])
 		{
-			std::cout << "can't open " << maps_path << '\n';
-			exit(1);
+			case datatype::INT:
+				return value_changed_as<i32>(old_bytes, new_bytes, change);
+
+			case datatype::LONG:
+				return value_changed_as<i64>(old_bytes, new_bytes, change);
+
+			case datatype::FLOAT:
+				return value_changed_as<f32>(old_bytes, new_bytes, change);
+
+			case datatype::DOUBLE:
+				return value_changed_as<f64>(old_bytes, new_bytes, change);
 		}
 
-		const std::regex lib_regex("^.*\\.so$");
-		const std::regex lib_versioned_regex("^.*\\.so\\.[.0-9]*$");
+		return false;
+	}
 
-		std::string line;
-		while (std::getline(maps, line))
-		{
-			std::string range, perms, offset, ids, inode_id, file_path;
+	// bit n of masks[i] is set if the byte at position i * 64 + n differs,
+	// masks needs size / 64 + 2 words so that the next word can always be read
+	static void diff_bytes(const u8* a, const u8* b, const u64 size, u64* masks)
+	{
+		const u64 full_blocks = size / scan_block_size;
+		diff_blocks(a, b, full_blocks, masks);
 
-			std::stringstream ss;
-			ss << line;
-			ss >> range >> perms >> offset >> ids >> inode_id >> file_path;
+		masks[full_blocks] = 0;
+		masks[full_blocks + 1] = 0;
+		for (u64 i = full_blocks * scan_block_size; i < size; ++i)
+			masks[i / 64] |= static_cast<u64>(a[i] != b[i]) << (i % 64);
+	}
 
-			if (opts.stack_scan && file_path != "[stack]")
-				continue;
+	// positions in a byte mask word where the mask bit of any of the bytes
+	// of a value that starts from the position is set
+	static inline u64 any_value_byte(const u64* byte_masks, const u64 word, const u8 size)
+	{
+		u64 mask = byte_masks[word];
+		for (u8 k = 1; k < size; ++k)
+			mask |= (byte_masks[word] >> k) | (byte_masks[word + 1] << (64 - k));
 
-			// Skip memory regions that are not writable
-			if (!perms.starts_with("rw"))
-				continue;
+		return mask;
+	}
 
-			// Skip memory regions that are for external libraries
-			if (file_path.starts_with("/lib")
-				|| file_path.starts_with("/usr/lib")
-				|| file_path.starts_with("/dev")
-				|| file_path.starts_with("/memfd")
-				// need to use the full line for some things due to whitespace
-				|| line.ends_with(".dll")
-				|| line.ends_with("wine64")
-				|| line.ends_with("wine64-preloader")
-				|| line.ends_with(".drv"))
-				continue;
+	// narrow down the positions that have changed (or not changed) to the ones
+	// that match the expected change for a single type
+	static void refine_plane_change(std::vector<u64>& plane, const u64* diff, const u8* old_bytes, const u8* new_bytes,
+			const u8 type_index, const value_change change)
+	{
+		const u8 size = type_size(datatypes[type_index]);
+
+		for (u64 word = 0; word < plane.size(); ++word)
+		{
+			const u64 changed = any_value_byte(diff, word, size);
+			plane[word] &= change == value_change::unchanged ? ~changed : changed;
 
-			// Skip library files
-			if (std::regex_match(file_path, lib_regex) || std::regex_match(file_path, lib_versioned_regex))
+			if (change != value_change::increased && change != value_change::decreased)
 				continue;
 
-			this->regions[memory_region_count] = memory_region( range );
-			++memory_region_count;
-		}
+			for (u64 bits = plane[word]; bits != 0; bits &= bits - 1)
+			{
+				const u8 bit = __builtin_ctzll(bits);
+				const u64 i = word * 64 + bit;
 
-		if (regions.empty()) [[unlikely]]
-		{
-			std::cout << "no suitable memory regions could be found\n";
-			exit(1);
+				if (!value_changed_as(&old_bytes[i], &new_bytes[i], type_index, change))
+					plane[word] &= ~(1ULL << bit);
+			}
 		}
-
-		std::cout << "found " << regions.size() << " suitable regions\n";
 	}
 
-	results memory::search(const options opts, const filter filter, const type_bundle value, const comparison comparison)
+	// check the full blocks against a query for a single type, a slice of blocks
+	// at a time so that the bytes stay in the cache while each term is checked
+	template<typename T>
+	static void scan_query_blocks(const u8* bytes, const u64 blocks, const query& query, const u8 type_index, const bool skip_zeroes, u64* masks)
 	{
-		results aggregate_results;
-		std::mutex result_mutex;
-		bool cancel_search = false;
+		constexpr u64 slice_blocks = 256;
+		std::array<u64, slice_blocks> clause_masks;
+		std::array<u64, slice_blocks> term_masks;
 
-		std::vector<std::future<std::pair<u16, std::vector<u8>>>> region_futures;
-		for (const auto& region : regions)
+		for (u64 first = 0; first < blocks; first += slice_blocks)
 		{
-			region_futures.emplace_back(
-				std::async(std::launch::async,
-					[&](const u16 region_id, memory_region region)
-					{
-						std::ifstream mem(mem_path, std::ios::in | std::ios::binary);
-						if (!mem.is_open()) [[unlikely]]
-						{
-							std::cout << "can't open the memory file at " << mem_path << '\n';
-							exit(1);
-						}
-
-						return std::pair<u16, std::vector<u8>>(region_id, read_region(mem, region.start, region.end));
-					},
-				 region.first, region.second)
-			);
-		}
+			const u8* slice = bytes + first * scan_block_size;
+			const u64 count = std::min(slice_blocks, blocks - first);
+			u64* slice_masks = masks + first;
+			std::fill(slice_masks, slice_masks + count, 0);
 
-		std::for_each(region_futures.begin(), region_futures.end(),
-			[&](std::future<std::pair<u16, std::vector<u8>>>& region_future)
+			for (const query::clause& clause : query.clauses())
 			{
-				const auto& [region_id, bytes] = region_future.get();
+				if (!query::applies_to(clause, type_index))
+					continue;
+
+				scan_blocks<T>(slice, count, clause.front().value_as<T>(), clause.front().op, skip_zeroes, clause_masks.data());
 
-				if (opts.skip_null_regions && std::all_of(std::execution::par_unseq, bytes.begin(), bytes.end(), [](const u8 byte) { return byte == 0; })) [[unlikely]]
+				for (u64 term = 1; term < clause.size(); ++term)
 				{
-					std::cout << '0' << std::flush;
-					return;
+					scan_blocks<T>(slice, count, clause[term].value_as<T>(), clause[term].op, skip_zeroes, term_masks.data());
+
+					for (u64 block = 0; block < count; ++block)
+						clause_masks[block] &= term_masks[block];
 				}
 
-				results region_results;
+				for (u64 block = 0; block < count; ++block)
+					slice_masks[block] |= clause_masks[block];
+			}
+		}
+	}
 
-				std::future<void> int_res_future = std::async(std::launch::async,
-					[&]()
-					{
-						if (!filter.enable_i32)
-							return;
+	// scan a chunk for a single type with a query, including the positions that don't fill a whole block
+	template<typename T>
+	static void scan_query_plane(const u8* bytes, const u64 valid_size, const u64 positions, const u64 full_blocks,
+			const query& query, const u8 type_index, const bool skip_zeroes, std::vector<u64>& plane)
+	{
+		scan_query_blocks<T>(bytes, full_blocks, query, type_index, skip_zeroes, plane.data());
 
-						for (u32 i = 0; i < bytes.size() - sizeof(i32); ++i)
-						{
-							type_union res_value;
-							memcpy(res_value.bytes, &bytes[i], sizeof(i32));
+		for (u64 i = full_blocks * scan_block_size; i < positions; ++i)
+			if (valid_size - i >= sizeof(T) && query.matches<T>(&bytes[i], type_index, skip_zeroes))
+				plane[i / 64] |= 1ULL << (i % 64);
+	}
 
-							if (opts.skip_zeroes && res_value._int == 0)
-								continue;
+	__attribute__((hot))
+	static result_segment scan_chunk(const u8* bytes, const u64 valid_size, const u64 positions, const u64 base_location, const u16 region_id,
+			const filter filter, const query& query, const bool skip_zeroes, const bool store_values)
+	{
+		constexpr u8 max_type_size = 8;
 
-							if (!cmp(value._int, res_value._int, comparison))
-								continue;
+		// match masks of the enabled types for every position in the chunk,
+		// the planes of the disabled types stay empty
+		const u64 words = (positions + 63) / 64;
+		const std::array<bool, 4> enabled = { filter.enable_i32, filter.enable_i64, filter.enable_f32, filter.enable_f64 };
 
-							region_results.int_results.push_back({ res_value._int, i, region_id, datatype::INT });
-						}
-					});
+		std::array<std::vector<u64>, 4> planes;
+		std::array<u64*, 4> mask_ptrs{};
+		for (u8 i = 0; i < planes.size(); ++i)
+		{
+			if (!enabled[i])
+				continue;
 
-				std::future<void> long_res_future = std::async(std::launch::async,
-					[&]()
-					{
-						if (!filter.enable_i64)
-							return;
+			planes[i].resize(words);
+			mask_ptrs[i] = planes[i].data();
+		}
 
-						for (u32 i = 0; i < bytes.size() - sizeof(i64); ++i)
-						{
-							type_union res_value;
-							memcpy(res_value.bytes, &bytes[i], sizeof(i64));
+		const u64 full_blocks = valid_size < max_type_size ? 0 : std::min(positions, valid_size - max_type_size + 1) / scan_block_size;
 
-							if (opts.skip_zeroes && res_value._long == 0)
-								continue;
+		// queries with multiple terms are checked one type at a time
+		const query_term* term = query.single_term();
+		if (term == nullptr)
+		{
+			if (enabled[0])
+				scan_query_plane<i32>(bytes, valid_size, positions, full_blocks, query, 0, skip_zeroes, planes[0]);
 
-							if (!cmp(value._long, res_value._long, comparison))
-								continue;
+			if (enabled[1])
+				scan_query_plane<i64>(bytes, valid_size, positions, full_blocks, query, 1, skip_zeroes, planes[1]);
 
-							result r;
-							r.value._long = res_value._long;
-							r.location = i;
-							r.region_id = region_id;
-							r.type = datatype::LONG;
-							region_results.long_results.emplace_back(r);
-						}
-					});
+			if (enabled[2])
+				scan_query_plane<f32>(bytes, valid_size, positions, full_blocks, query, 2, skip_zeroes, planes[2]);
 
-				std::future<void> float_res_future = std::async(std::launch::async,
-					[&]()
-					{
-						if (!filter.enable_f32)
-							return;
+			if (enabled[3])
+				scan_query_plane<f64>(bytes, valid_size, positions, full_blocks, query, 3, skip_zeroes, planes[3]);
 
-						for (u32 i = 0; i < bytes.size() - sizeof(f32); ++i)
-						{
-							type_union res_value;
-							memcpy(res_value.bytes, &bytes[i], sizeof(f32));
+			return segment_from_planes(region_id, base_location, positions, std::move(planes), bytes, valid_size,
+					store_values, filter.enable_i64 || filter.enable_f64);
+		}
 
-							if (opts.skip_zeroes && res_value._float == 0)
-								continue;
+		const type_bundle& value = term->value;
+		scan_blocks_fused(bytes, full_blocks, value, filter, term->op, skip_zeroes, mask_ptrs);
 
-							if (!cmp(value._float, res_value._float, comparison))
-								continue;
+		// scalar fallback for the positions that don't fill a whole block,
+		// the last few positions can only be scanned if the overlap from the
+		// next chunk has enough bytes left for the type
+		dispatch_variant(term->op, skip_zeroes, [&](const auto c, const auto skip)
+		{
+			for (u64 i = full_blocks * scan_block_size; i < positions; ++i)
+			{
+				const u64 bytes_left = valid_size - i;
+				const u64 bit = 1ULL << (i % 64);
 
-							result r;
-							r.value._float = res_value._float;
-							r.location = i;
-							r.region_id = region_id;
-							r.type = datatype::FLOAT;
-							region_results.float_results.emplace_back(r);
-						}
-					});
+				if (filter.enable_i32 && bytes_left >= sizeof(i32) && matches<i32, c.value, skip.value>(&bytes[i], value._int))
+					planes[0][i / 64] |= bit;
 
-				std::future<void> double_res_future = std::async(std::launch::async,
-					[&]()
-					{
-						if (!filter.enable_f64)
-							return;
+				if (filter.enable_i64 && bytes_left >= sizeof(i64) && matches<i64, c.value, skip.value>(&bytes[i], value._long))
+					planes[1][i / 64] |= bit;
 
-						for (u32 i = 0; i < bytes.size() - sizeof(f64); ++i)
-						{
-							type_union res_value;
-							memcpy(res_value.bytes, &bytes[i], sizeof(f64));
+				if (filter.enable_f32 && bytes_left >= sizeof(f32) && matches<f32, c.value, skip.value>(&bytes[i], value._float))
+					planes[2][i / 64] |= bit;
 
-							if (opts.skip_zeroes && res_value._double == 0)
-								continue;
+				if (filter.enable_f64 && bytes_left >= sizeof(f64) && matches<f64, c.value, skip.value>(&bytes[i], value._double))
+					planes[3][i / 64] |= bit;
+			}
+		});
 
-							if (!cmp(value._double, res_value._double, comparison))
-								continue;
+		return segment_from_planes(region_id, base_location, positions, std::move(planes), bytes, valid_size,
+				store_values, filter.enable_i64 || filter.enable_f64);
+	}
 
-							result r;
-							r.value._double = res_value._double;
-							r.location = i;
-							r.region_id = region_id;
-							r.type = datatype::DOUBLE;
-							region_results.double_results.emplace_back(r);
-						}
-					});
+	// call f(first, last) for each run of set bits in [0, count), last is exclusive
+	template<typename F>
+	static void for_each_bit_run(const std::vector<u64>& bits, const u64 count, F&& f)
+	{
+		u64 i{0};
+		while (i < count)
+		{
+			if (!(bits[i / 64] & (1ULL << (i % 64))))
+			{
+				++i;
+				continue;
+			}
 
-				std::lock_guard<std::mutex> guard(result_mutex);
+			const u64 first = i;
+			while (i < count && (bits[i / 64] & (1ULL << (i % 64))))
+				++i;
 
-				int_res_future.wait();
-				aggregate_results.int_results.insert(aggregate_results.int_results.end(),
-						region_results.int_results.begin(), region_results.int_results.end());
+			f(first, i);
+		}
+	}
 
-				long_res_future.wait();
-				aggregate_results.long_results.insert(aggregate_results.long_results.end(),
-						region_results.long_results.begin(), region_results.long_results.end());
+	// list segments are refined in parts of at most this many entries,
+	// so that a few large segments can't keep most of the threads idle
+	static constexpr u64 refine_task_entries = 1 << 16;
 
-				float_res_future.wait();
-				aggregate_results.float_results.insert(aggregate_results.float_results.end(),
-						region_results.float_results.begin(), region_results.float_results.end());
+	// entries [first_entry, last_entry) of a segment, see result_segment::for_each_entry
+	struct refine_task
+	{
+		u64 segment_index;
+		u64 first_entry;
+		u64 last_entry;
+	};
+
+	// split the segments into refine tasks in location order, so that the
+	// refined parts can be added to the new results in the same order
+	static std::vector<refine_task> split_refine_tasks(const std::vector<result_segment>& segments, std::vector<std::atomic<u32>>& tasks_left)
+	{
+		std::vector<refine_task> tasks;
 
-				double_res_future.wait();
-				aggregate_results.double_results.insert(aggregate_results.double_results.end(),
-						region_results.double_results.begin(), region_results.double_results.end());
+		for (u64 segment_index = 0; segment_index < segments.size(); ++segment_index)
+		{
+			const result_segment& segment = segments[segment_index];
+			const u64 range = segment.entry_range();
+			const u64 step = segment.kind() == segment_kind::bitmap ? std::max<u64>(range, 1) : refine_task_entries;
 
-				std::cout << "." << std::flush;
+			u32 count{0};
+			for (u64 first = 0; first < range || count == 0; first += step, ++count)
+				tasks.push_back({ segment_index, first, std::min(first + step, range) });
 
-				if (!cancel_search && aggregate_results.total_size() > opts.memory_limit * gigabyte) [[unlikely]]
-				{
-					std::scoped_lock mem_lock;
-					std::cout << "\nmemory limit of " << opts.memory_limit << "GB has been reached\n"
-						<< "stopping the search\n";
-					cancel_search = true;
-				}
-			});
-		std::cout << '\n';
+			tasks_left[segment_index] = count;
+		}
 
-		return aggregate_results;
+		return tasks;
 	}
 
-	results memory::refine_search(const type_bundle new_value, results& old_results, const comparison comparison)
+	// move a finished segment to a spill file if it doesn't fit into the memory budget
+	static void fit_to_budget(result_segment& segment, memory_budget& budget)
 	{
-		results new_results;
-		std::unordered_map<u16, region_snapshot> region_cache = snapshot_regions(old_results);
+		if (budget.reserve(segment.total_size())) [[likely]]
+			return;
 
-		std::cout << "processing bytes" << std::endl;
+		// without a spill file the segment has to stay in the memory
+		if (const std::shared_ptr<spill_file> file = budget.results_file())
+			segment.spill(file);
+	}
 
-		std::future<void> int_res_future = std::async(std::launch::async, [&]()
+	// hands out a limited amount of chunk buffers at a time to keep
+	// the peak memory usage of a scan bounded
+	class chunk_buffer_pool
+	{
+	public:
+		chunk_buffer_pool(const u64 buffer_size, const u64 limit)
+		:buffer_size(buffer_size), limit(std::max<u64>(limit, 1))
+		{}
+
+		std::vector<u8> acquire()
 		{
-			for (result result : old_results.int_results)
+			std::unique_lock<std::mutex> lock(mutex);
+			available.wait(lock, [this] { return !buffers.empty() || allocated < limit; });
+
+			if (!buffers.empty())
 			{
-				type_as_bytes<i32> v;
-				memcpy(v.bytes, &region_cache.at(result.region_id).bytes[result.location], sizeof(i32));
-				if (cmp<i32>(new_value._int, v.type, comparison))
-				{
-					memcpy(result.value.bytes, &region_cache.at(result.region_id).bytes[result.location], 0x0F & static_cast<u8>(result.type));
-					new_results.int_results.emplace_back(result);
-				}
+				std::vector<u8> buffer = std::move(buffers.back());
+				buffers.pop_back();
+				return buffer;
 			}
-		});
 
-		std::future<void> long_res_future = std::async(std::launch::async, [&]()
+			++allocated;
+			return std::vector<u8>(buffer_size);
+		}
+
+		void release(std::vector<u8>&& buffer)
 		{
-			for (result result : old_results.long_results)
 			{
-				type_as_bytes<i64> v;
-				memcpy(v.bytes, &region_cache.at(result.region_id).bytes[result.location], sizeof(i64));
-				if (cmp<i64>(new_value._long, v.type, comparison))
-				{
-					memcpy(result.value.bytes, &region_cache.at(result.region_id).bytes[result.location], 0x0F & static_cast<u8>(result.type));
-					new_results.long_results.emplace_back(result);
-				}
+				std::lock_guard<std::mutex> guard(mutex);
+				buffers.push_back(std::move(buffer));
 			}
-		});
+			available.notify_one();
+		}
+
+	private:
+		const u64 buffer_size;
+		const u64 limit;
+		u64 allocated{0};
+
+		std::vector<std::vector<u8>> buffers;
+		std::mutex mutex;
+		std::condition_variable available;
+	};
+
+	results memory::search(const options opts, const filter filter, const type_bundle value, const comparison comparison)
+	{
+		return search(opts, filter, query::single(value, comparison));
+	}
+
+	results memory::search(const options opts, const filter filter, const query& query)
+	{
+		begin_metrics("search");
 
-		std::future<void> float_res_future = std::async(std::launch::async, [&]()
+		// split the regions into fixed size chunks that overlap by
+		// max_type_size - 1 bytes so that values on the chunk boundaries
+		// can't get missed
+		struct search_chunk
 		{
-			for (result result : old_results.float_results)
+			u16 region_id;
+			size_t address;		// absolute address of the first byte in the chunk
+			u64 location;		// offset of the first byte from the start of the region
+			u64 positions;		// amount of positions that this chunk is responsible for
+			u64 read_size;		// positions + overlap (clamped to the end of the region)
+			u64 buffer_offset;	// where the chunk starts in the task buffer
+		};
+
+		// large regions get split into multiple tasks and small regions
+		// are batched together so that each task has about a chunk worth of work
+		struct search_task
+		{
+			std::vector<search_chunk> chunks;
+			u64 buffer_size{0};
+		};
+
+		const u64 chunk_buffer_size = chunk_size + max_type_size - 1;
+
+		std::vector<search_task> tasks;
+		search_task small_region_task;
+		std::unordered_map<u16, std::atomic<u64>> region_chunks_left;
+
+		for (const auto& [region_id, region] : regions)
+		{
+			const u64 region_size = region.end - region.start;
+
+			if (region_size <= chunk_size)
 			{
-				type_as_bytes<f32> v;
-				memcpy(v.bytes, &region_cache.at(result.region_id).bytes[result.location], sizeof(f32));
-				if (cmp<f32>(new_value._float, v.type, comparison))
-				{
-					memcpy(result.value.bytes, &region_cache.at(result.region_id).bytes[result.location], 0x0F & static_cast<u8>(result.type));
-					new_results.float_results.emplace_back(result);
-				}
+				if (small_region_task.buffer_size + region_size > chunk_size)
+					tasks.push_back(std::exchange(small_region_task, search_task()));
+
+				small_region_task.chunks.push_back({ region_id, region.start, 0, region_size, region_size, small_region_task.buffer_size });
+				small_region_task.buffer_size += region_size;
+				region_chunks_left[region_id] = 1;
+				continue;
 			}
-		});
 
-		std::future<void> double_res_future = std::async(std::launch::async, [&]()
-		{
-			for (result result : old_results.double_results)
+			// the batched regions come before this one, so their task has
+			// to go first for the tasks to stay in region order
+			if (!small_region_task.chunks.empty())
+				tasks.push_back(std::exchange(small_region_task, search_task()));
+
+			u64 chunk_count{0};
+			for (u64 location = 0; location < region_size; location += chunk_size)
 			{
-				type_as_bytes<f64> v;
-				memcpy(v.bytes, &region_cache.at(result.region_id).bytes[result.location], sizeof(f64));
-				if (cmp<f64>(new_value._double, v.type, comparison))
-				{
-					memcpy(result.value.bytes, &region_cache.at(result.region_id).bytes[result.location], 0x0F & static_cast<u8>(result.type));
-					new_results.double_results.emplace_back(result);
-				}
+				const u64 positions = std::min(chunk_size, region_size - location);
+				const u64 read_size = std::min(chunk_buffer_size, region_size - location);
+
+				search_task task;
+				task.chunks.push_back({ region_id, region.start + location, location, positions, read_size, 0 });
+				task.buffer_size = read_size;
+				tasks.push_back(std::move(task));
+				++chunk_count;
 			}
-		});
 
-		int_res_future.wait();
-		long_res_future.wait();
-		float_res_future.wait();
-		double_res_future.wait();
+			region_chunks_left[region_id] = chunk_count;
+		}
 
-		return new_results;
-	}
+		if (!small_region_task.chunks.empty())
+			tasks.push_back(std::move(small_region_task));
 
-	results memory::refine_search_change(results& old_results, const bool expected_result)
-	{
-		// expected_result == true (value unchanged)
-		// expected_result == false (value changed)
+		// the budget decides how many chunk buffers can be in flight at the same time
+		chunk_buffer_pool buffers(chunk_buffer_size, opts.chunk_budget * megabyte / chunk_buffer_size);
 
-		std::unordered_map<u16, region_snapshot> region_cache = snapshot_regions(old_results);
-		results new_results;
+		const std::optional<std::array<type_union, 4>> uniform_values = query.known_values();
 
-		const auto old_res_vec_ptrs = old_results.result_vecs();
-		auto new_res_vec_ptrs = new_results.result_vecs();
+		// start tracking the writes before anything gets read
+		dirty_tracker.clear();
 
-		std::cout << "processing bytes\n";
+		std::vector<std::vector<result_segment>> task_results(tasks.size());
+		memory_budget budget(memory_limit, 0);
+		std::mutex print_mutex;
+
+		parallel_for(pool, tasks.size(), [&](const u64 task_index)
+		{
+			const search_task& task = tasks[task_index];
+
+			stage_timer wait_timer(metrics, stage::allocate);
+			std::vector<u8> bytes = buffers.acquire();
+			wait_timer.stop();
+			metrics.buffer_allocated(bytes.size());
+
+			// read all of the chunks in the task with a single batched read
+			std::vector<read_span> spans;
+			spans.reserve(task.chunks.size());
+			for (const search_chunk& chunk : task.chunks)
+				spans.push_back({ chunk.address, chunk.read_size, bytes.data() + chunk.buffer_offset });
+
+			stage_timer read_timer(metrics, stage::read);
+			mem_reader->read(spans);
+			const u64 read_nanoseconds = read_timer.stop();
+
+			// a batched read can't be timed chunk by chunk, so the time is split by size
+			for (const search_chunk& chunk : task.chunks)
+				metrics.add_region_time(chunk.region_id, read_nanoseconds * chunk.read_size / task.buffer_size);
+
+			std::vector<result_segment>& chunk_results = task_results[task_index];
+			std::string progress;
 
-		std::for_each(std::execution::par_unseq, old_res_vec_ptrs.begin(), old_res_vec_ptrs.end(),
-			[&](const std::pair<u8, std::vector<result>*> res_vec)
+			for (const search_chunk& chunk : task.chunks)
 			{
-				const auto& [vec_index, vec] = res_vec;
-				for (result r : *vec)
+				const u8* chunk_bytes = bytes.data() + chunk.buffer_offset;
+
+				stage_timer scan_timer(metrics, stage::scan);
+				const bool null_chunk = opts.skip_null_regions
+					&& std::all_of(chunk_bytes, chunk_bytes + chunk.read_size, [](const u8 byte) { return byte == 0; });
+
+				if (!null_chunk) [[likely]]
 				{
-					assert(region_cache.contains(r.region_id));
-					assert(region_cache.at(r.region_id).bytes.size() >= 8);
-					if (r.compare_bytes(region_cache.at(r.region_id).bytes) == expected_result)
-						new_res_vec_ptrs.at(vec_index).second->emplace_back(r);
+					chunk_results.emplace_back(scan_chunk(chunk_bytes, chunk.read_size, chunk.positions, chunk.location, chunk.region_id,
+								filter, query, opts.skip_zeroes, !uniform_values.has_value()));
+					scan_timer.stop();
+
+					stage_timer budget_timer(metrics, stage::allocate);
+					fit_to_budget(chunk_results.back(), budget);
 				}
-			});
 
-		return new_results;
-	}
+				if (--region_chunks_left.at(chunk.region_id) == 0)
+					progress += null_chunk ? '0' : '.';
+			}
 
-	void memory::set(result& result, const type_bundle value)
-	{
-		// result.value = new_value;
+			metrics.buffer_released(bytes.size());
+			buffers.release(std::move(bytes));
 
-		std::fstream mem(mem_path, std::ios::out | std::ios::binary);
-		if (!mem.is_open()) [[unlikely]]
-		{
-			std::cout << "can't open " << mem_path << '\n';
-			return;
-		}
+			std::lock_guard<std::mutex> guard(print_mutex);
+			std::cout << progress << std::flush;
+		});
 
-		mem.seekg(result.location + regions.at(result.region_id).start, std::ios::beg);
+		std::cout << '\n';
 
-		const char* data = value.str_ptr.at((static_cast<u8>(result.type) & 0xF0) >> 4UL);
-		const u8 size = static_cast<u8>(result.type) & 0x0F;
+		// merge the task results in order so that the results stay
+		// sorted by region and location
+		stage_timer merge_timer(metrics, stage::merge);
+		results aggregate_results;
+		for (std::vector<result_segment>& chunk_results : task_results)
+			for (result_segment& segment : chunk_results)
+				aggregate_results.add_segment(std::move(segment));
+		merge_timer.stop();
 
-		mem.write(data, size);
+		if (uniform_values.has_value())
+			aggregate_results.set_uniform_values(uniform_values.value());
 
-		// update the result value
-		memcpy(result.value.bytes, data, size);
+		aggregate_results.set_soft_dirty_epoch(dirty_tracker.epoch());
+
+		end_metrics(aggregate_results.count());
+		print_read_stats();
+		print_spill_stats(budget);
+
+		return aggregate_results;
 	}
 
-	u64 memory::region_count() const
+	results memory::refine_search(const type_bundle new_value, const results& old_results, const comparison comparison)
 	{
-		return regions.size();
+		return refine_search(query::single(new_value, comparison), old_results);
 	}
 
-	std::vector<u8> memory::read_region(std::ifstream& file, const size_t start, const size_t end)
+	results memory::refine_search(const query& query, const results& old_results)
 	{
-		assert(end > start);
-		assert(file.is_open());
+		begin_metrics("refine");
+		memory_budget budget(memory_limit, old_results.total_size());
+		const std::vector<segment_snapshot> snapshots = snapshot_segments(old_results, budget, false);
 
-		std::vector<u8> bytes;
-		bytes.resize(end - start);
+		std::cout << "processing bytes" << std::endl;
 
-		file.seekg(start, std::ios::beg);
-		file.read((char*)&bytes.data()[0], bytes.size());
+		// single comparisons get checked with the kernels that are specialized for the comparison
+		const query_term* term = query.single_term();
 
-		return bytes;
-	}
+		const std::optional<std::array<type_union, 4>> uniform_values = query.known_values();
+		const std::vector<result_segment>& old_segments = old_results.segments();
+		std::vector<std::atomic<u32>> tasks_left(old_segments.size());
+		const std::vector<refine_task> tasks = split_refine_tasks(old_segments, tasks_left);
+		std::vector<result_segment> new_segments(tasks.size());
 
-	std::unordered_map<u16, memory::region_snapshot> memory::snapshot_regions(results& results)
-	{
-		std::unordered_map<u16, region_snapshot> region_cache;
+		parallel_for(pool, tasks.size(), [&](const u64 task_index)
+		{
+			const refine_task& task = tasks[task_index];
+			const result_segment& segment = old_segments[task.segment_index];
+			const segment_snapshot& snapshot = snapshots[task.segment_index];
+			stage_timer scan_timer(metrics, stage::scan);
 
-		std::cout << "taking a memory snapshot\n" << std::flush;
+			// the spilled data can be dropped from the ram once all of the parts are done
+			const auto finish_task = [&](result_segment&& refined)
+			{
+				scan_timer.stop();
+				stage_timer budget_timer(metrics, stage::allocate);
 
-		const auto result_vecs = results.result_vecs();
-		assert(!result_vecs.empty());
+				new_segments[task_index] = std::move(refined);
+				fit_to_budget(new_segments[task_index], budget);
 
-		for (const auto& [index, vec_ptr] : result_vecs)
-		{
-			for (result result : *vec_ptr)
+				if (--tasks_left[task.segment_index] == 0)
+				{
+					segment.release();
+					metrics.buffer_released(snapshot.bytes.size());
+					snapshot.bytes.release();
+				}
+			};
+
+			// dense results are refined a block of positions at a time with the
+			// scan kernels and the new masks are cut down with the old bit planes
+			if (segment.kind() == segment_kind::bitmap)
 			{
-				if (region_cache.contains(result.region_id)) [[likely]]
-					continue;
+				const auto [bytes, available] = snapshot.at(segment.first_location());
+				std::array<std::vector<u64>, 4> planes;
+
+				const auto refine_plane = [&]<typename T>(const u8 type_index, const T)
+				{
+					const std::span<const u64> old_plane = segment.plane(type_index);
+					if (old_plane.empty())
+						return;
+
+					std::vector<u64>& plane = planes[type_index];
+					plane.resize(old_plane.size());
+
+					const u64 full_blocks = available < sizeof(T) ? 0 : std::min<u64>(plane.size(), (available - sizeof(T) + 1) / scan_block_size);
+					if (term != nullptr)
+						scan_blocks<T>(bytes, full_blocks, term->value_as<T>(), term->op, false, plane.data());
+					else
+						scan_query_blocks<T>(bytes, full_blocks, query, type_index, false, plane.data());
+
+					for (u64 word = 0; word < full_blocks; ++word)
+						plane[word] &= old_plane[word];
+
+					// the old results at the end of the region are known to have
+					// enough bytes for the type, so they can be checked one by one
+					const auto refine_tail = [&](const auto& matches_value)
+					{
+						for (u64 word = full_blocks; word < plane.size(); ++word)
+						{
+							for (u64 bits = old_plane[word]; bits != 0; bits &= bits - 1)
+							{
+								const u8 bit = __builtin_ctzll(bits);
+								if (matches_value(&bytes[word * 64 + bit]))
+									plane[word] |= 1ULL << bit;
+							}
+						}
+					};
+
+					if (term == nullptr)
+					{
+						refine_tail([&](const u8* value_bytes) { return query.matches<T>(value_bytes, type_index, false); });
+						return;
+					}
 
-				region_snapshot snapshot;
-				snapshot.region = &regions.at(result.region_id);
-				region_cache[result.region_id] = snapshot;
+					dispatch_comparison(term->op, [&](const auto c)
+					{
+						refine_tail([&](const u8* value_bytes) { return matches<T, c.value, false>(value_bytes, term->value_as<T>()); });
+					});
+				};
+
+				refine_plane(0, i32{});
+				refine_plane(1, i64{});
+				refine_plane(2, f32{});
+				refine_plane(3, f64{});
+
+				result_segment refined = result_segment::from_bitmap(segment.region_id, segment.first_location(), segment.span(), std::move(planes),
+						uniform_values.has_value() ? std::vector<u8>() : bitmap_values(bytes, available, segment.span()));
+				refined.compact();
+
+				finish_task(std::move(refined));
+				return;
 			}
-		}
 
-		std::for_each(std::execution::seq, region_cache.begin(), region_cache.end(),
-			[&](auto&& region)
+			segment_builder builder(segment.region_id, !uniform_values.has_value(), segment.types() & wide_types);
+
+			// the entries are in location order, so the runs of the snapshot are walked through only once
+			const auto refine_entries = [&](const auto& entry_mask)
 			{
-				auto& [region_id, snapshot] = region;
+				u64 run{0};
 
-				std::ifstream mem(mem_path, std::ios::in | std::ios::binary);
-				if (!mem.is_open()) [[unlikely]]
+				segment.for_each_entry(task.first_entry, task.last_entry, [&](const u64, const u32 location, const type_mask mask)
 				{
-					std::cout << "can't open " << mem_path << '\n';
-					exit(1);
-				}
+					const u8* bytes = snapshot.find(location, run).first;
+					const type_mask new_mask = entry_mask(bytes, mask);
 
-				snapshot.bytes = read_region(mem, snapshot.region->start, snapshot.region->end);
-				std::cout << '.' << std::flush;
-			});
+					if (new_mask != 0)
+						builder.add(location, new_mask, bytes);
+				});
+			};
 
-		std::cout << '\n';
+			if (term == nullptr)
+			{
+				refine_entries([&](const u8* bytes, const type_mask mask)
+				{
+					type_mask new_mask{0};
 
-		return region_cache;
-	}
+					if ((mask & (1 << 0)) && query.matches<i32>(bytes, 0, false))
+						new_mask |= 1 << 0;
 
-	void memory::trim_region_range(const result result)
-	{
-		// update the end point of the region so that during the next
-		// snapshot less bytes can be read from the memory file
-		regions.at(result.region_id).end = regions.at(result.region_id).start + result.location + sizeof(f64);
+					if ((mask & (1 << 1)) && query.matches<i64>(bytes, 1, false))
+						new_mask |= 1 << 1;
+
+					if ((mask & (1 << 2)) && query.matches<f32>(bytes, 2, false))
+						new_mask |= 1 << 2;
+
+					if ((mask & (1 << 3)) && query.matches<f64>(bytes, 3, false))
+						new_mask |= 1 << 3;
+
+					return new_mask;
+				});
+			}
+			else
+			{
+				const type_bundle& new_value = term->value;
+
+				dispatch_comparison(term->op, [&](const auto c)
+				{
+					refine_entries([&](const u8* bytes, const type_mask mask)
+					{
+						type_mask new_mask{0};
+
+						if ((mask & (1 << 0)) && matches<i32, c.value, false>(bytes, new_value._int))
+							new_mask |= 1 << 0;
+
+						if ((mask & (1 << 1)) && matches<i64, c.value, false>(bytes, new_value._long))
+							new_mask |= 1 << 1;
+
+						if ((mask & (1 << 2)) && matches<f32, c.value, false>(bytes, new_value._float))
+							new_mask |= 1 << 2;
+
+						if ((mask & (1 << 3)) && matches<f64, c.value, false>(bytes, new_value._double))
+							new_mask |= 1 << 3;
+
+						return new_mask;
+					});
+				});
+			}
+
+			finish_task(builder.finish());
+		});
+
+		stage_timer merge_timer(metrics, stage::merge);
+		results new_results;
+		for (result_segment& segment : new_segments)
+			new_results.add_segment(std::move(segment));
+		merge_timer.stop();
+
+		if (uniform_values.has_value())
+			new_results.set_uniform_values(uniform_values.value());
+
+		new_results.set_soft_dirty_epoch(dirty_tracker.epoch());
+
+		end_metrics(new_results.count());
+		print_spill_stats(budget);
+
+		return new_results;
+	}
+
+	results memory::refine_search_change(const results& old_results, const value_change change)
+	{
+		begin_metrics("change refine");
+		memory_budget budget(memory_limit, old_results.total_size());
+		const std::vector<segment_snapshot> snapshots = snapshot_segments(old_results, budget, true);
+
+		std::cout << "processing bytes\n";
+
+		// values that didn't change are still known if they were known before
+		const bool keep_uniform_values = change == value_change::unchanged && old_results.uniform().has_value();
+
+		const std::vector<result_segment>& old_segments = old_results.segments();
+		std::vector<std::atomic<u32>> tasks_left(old_segments.size());
+		const std::vector<refine_task> tasks = split_refine_tasks(old_segments, tasks_left);
+		std::vector<result_segment> new_segments(tasks.size());
+
+		parallel_for(pool, tasks.size(), [&](const u64 task_index)
+		{
+			const refine_task& task = tasks[task_index];
+			const result_segment& segment = old_segments[task.segment_index];
+			const segment_snapshot& snapshot = snapshots[task.segment_index];
+			stage_timer scan_timer(metrics, stage::scan);
+
+			// the spilled data can be dropped from the ram once all of the parts are done
+			const auto finish_task = [&](result_segment&& refined)
+			{
+				scan_timer.stop();
+				stage_timer budget_timer(metrics, stage::allocate);
+
+				new_segments[task_index] = std::move(refined);
+				fit_to_budget(new_segments[task_index], budget);
+
+				if (--tasks_left[task.segment_index] == 0)
+				{
+					segment.release();
+					metrics.buffer_released(snapshot.bytes.size());
+					snapshot.bytes.release();
+				}
+			};
+
+			// bitmaps with stored values can be refined by diffing the whole
+			// span against the snapshot instead of comparing each result
+			if (segment.kind() == segment_kind::bitmap && segment.has_values())
+			{
+				// the pages that weren't read still have the previous values
+				const std::span<const u8> previous = segment.values();
+				std::vector<u8> current(previous.begin(), previous.end());
+				snapshot.copy_to(segment.first_location(), current.data(), current.size());
+
+				std::vector<u64> diff(current.size() / scan_block_size + 2);
+				diff_bytes(previous.data(), current.data(), current.size(), diff.data());
+
+				std::array<std::vector<u64>, 4> planes;
+				for (u8 i = 0; i < datatypes.size(); ++i)
+				{
+					if (segment.plane(i).empty())
+						continue;
+
+					planes[i].assign(segment.plane(i).begin(), segment.plane(i).end());
+					refine_plane_change(planes[i], diff.data(), previous.data(), current.data(), i, change);
+				}
+
+				result_segment refined = result_segment::from_bitmap(segment.region_id, segment.first_location(), segment.span(),
+						std::move(planes), std::move(current));
+				refined.compact();
+
+				finish_task(std::move(refined));
+				return;
+			}
+
+			segment_builder builder(segment.region_id, !keep_uniform_values, segment.types() & wide_types);
+
+			u64 run{0};
+
+			segment.for_each_entry(task.first_entry, task.last_entry, [&](const u64 entry, const u32 location, const type_mask mask)
+			{
+				const auto [bytes, available] = snapshot.find(location, run);
+
+				// the value is on pages that haven't been written to
+				if (bytes == nullptr || available < type_mask_size(mask))
+				{
+					if (change != value_change::unchanged)
+						return;
+
+					const u64 old_bits = segment.has_values() ? segment.value_bits(entry) : 0;
+					builder.add(location, mask, reinterpret_cast<const u8*>(&old_bits));
+					return;
+				}
+
+				type_mask new_mask{0};
+
+				for (u8 i = 0; i < datatypes.size(); ++i)
+				{
+					if (!(mask & (1 << i)))
+						continue;
+
+					const type_union old_value = old_results.value(segment, entry, i);
+
+					if (value_changed_as(old_value.bytes, bytes, i, change))
+						new_mask |= 1 << i;
+				}
+
+				if (new_mask != 0)
+					builder.add(location, new_mask, bytes);
+			});
+
+			finish_task(builder.finish());
+		});
+
+		stage_timer merge_timer(metrics, stage::merge);
+		results new_results;
+		for (result_segment& segment : new_segments)
+			new_results.add_segment(std::move(segment));
+		merge_timer.stop();
+
+		if (keep_uniform_values)
+			new_results.set_uniform_values(old_results.uniform().value());
+
+		new_results.set_soft_dirty_epoch(dirty_tracker.epoch());
+
+		end_metrics(new_results.count());
+		print_spill_stats(budget);
+
+		return new_results;
+	}
+
+	snapshot memory::take_snapshot()
+	{
+		begin_metrics("snapshot");
+
+		std::cout << "taking a memory snapshot\n" << std::flush;
+
+		std::vector<region_range> ranges;
+		for (const auto& [region_id, region] : regions)
+			ranges.push_back({ region_id, 0, region.end - region.start });
+
+		// start tracking the writes before anything gets read
+		dirty_tracker.clear();
+
+		snapshot new_snapshot = snapshot_ranges(ranges, 0);
+		new_snapshot.set_soft_dirty_epoch(dirty_tracker.epoch());
+
+		end_metrics(0);
+		print_read_stats();
+
+		return new_snapshot;
+	}
+
+	snapshot memory::snapshot_ranges(const std::vector<region_range>& ranges, const u64 used_memory)
+	{
+		std::vector<region_range> chunks;
+		for (const region_range& range : ranges)
+			for (u64 offset = 0; offset < range.size; offset += chunk_size)
+				chunks.push_back({ range.region_id, range.location + offset, std::min(chunk_size, range.size - offset) });
+
+		std::vector<snapshot::chunk> compressed_chunks(chunks.size());
+		memory_budget budget(memory_limit, used_memory);
+
+		parallel_for(pool, chunks.size(), [&](const u64 chunk_index)
+		{
+			const region_range& chunk = chunks[chunk_index];
+
+			stage_timer allocate_timer(metrics, stage::allocate);
+			std::vector<u8> bytes(chunk.size);
+			allocate_timer.stop();
+			metrics.buffer_allocated(bytes.size());
+
+			stage_timer read_timer(metrics, stage::read);
+			mem_reader->read(regions.at(chunk.region_id).start + chunk.location, bytes.data(), bytes.size());
+			metrics.add_region_time(chunk.region_id, read_timer.stop());
+
+			// compressing is the only work done on the bytes, so it counts as the scan
+			stage_timer scan_timer(metrics, stage::scan);
+			snapshot::chunk& compressed = compressed_chunks[chunk_index];
+			compressed = snapshot::compress(chunk.region_id, chunk.location, bytes.data(), bytes.size());
+			scan_timer.stop();
+			metrics.buffer_released(bytes.size());
+
+			stage_timer budget_timer(metrics, stage::allocate);
+			if (budget.reserve(compressed.pages.memory_size())) [[likely]]
+				return;
+
+			if (const std::shared_ptr<spill_file> file = budget.results_file())
+				compressed.spill(file);
+		});
+
+		stage_timer merge_timer(metrics, stage::merge);
+		snapshot new_snapshot;
+		for (snapshot::chunk& chunk : compressed_chunks)
+			new_snapshot.add_chunk(std::move(chunk));
+		merge_timer.stop();
+
+		print_spill_stats(budget);
+
+		return new_snapshot;
+	}
+
+	results memory::refine_snapshot(const options opts, const filter filter, const snapshot& old_snapshot, const value_change change)
+	{
+		begin_metrics("snapshot refine");
+
+		struct snapshot_chunk
+		{
+			u16 region_id;
+			u64 location;
+			u64 positions;
+			u64 read_size;	// positions + overlap (clamped to the end of the region)
+		};
+
+		std::vector<snapshot_chunk> chunks;
+		for (const auto& [region_id, region] : regions)
+		{
+			const u64 region_size = region.end - region.start;
+			for (u64 location = 0; location < region_size; location += chunk_size)
+				chunks.push_back({ region_id, location, std::min(chunk_size, region_size - location), std::min(chunk_size + max_type_size - 1, region_size - location) });
+		}
+
+		const std::array<bool, 4> enabled = { filter.enable_i32, filter.enable_i64, filter.enable_f32, filter.enable_f64 };
+		std::vector<result_segment> chunk_results(chunks.size());
+		memory_budget budget(memory_limit, old_snapshot.total_size());
+
+		// if the snapshot was taken while the writes were tracked, only the
+		// pages that have been written to since then need to be read
+		const bool tracked = old_snapshot.soft_dirty_epoch() != 0 && old_snapshot.soft_dirty_epoch() == dirty_tracker.epoch();
+		if (!tracked)
+			dirty_tracker.clear();
+
+		parallel_for(pool, chunks.size(), [&](const u64 chunk_index)
+		{
+			const snapshot_chunk& chunk = chunks[chunk_index];
+			const size_t region_start = regions.at(chunk.region_id).start;
+
+			stage_timer allocate_timer(metrics, stage::allocate);
+			std::vector<u8> previous(chunk.read_size);
+			allocate_timer.stop();
+
+			// the current bytes take as much space as the previous ones
+			const u64 buffer_size = previous.size() * 2;
+			metrics.buffer_allocated(buffer_size);
+
+			stage_timer decompress_timer(metrics, stage::scan);
+			old_snapshot.read(chunk.region_id, chunk.location, previous.data(), previous.size());
+			decompress_timer.stop();
+
+			const u64 pages = (chunk.read_size + page_size - 1) / page_size;
+			std::vector<u64> changed;
+
+			stage_timer read_timer(metrics, stage::read);
+			std::vector<u8> current;
+			if (tracked && changed_pages(chunk.region_id, chunk.location, pages, changed))
+			{
+				current = previous;
+
+				std::vector<read_span> spans;
+				for_each_bit_run(changed, pages, [&](const u64 first, const u64 last)
+				{
+					const u64 offset = first * page_size;
+					spans.push_back({ region_start + chunk.location + offset, std::min(last * page_size, chunk.read_size) - offset, current.data() + offset });
+				});
+
+				if (!spans.empty())
+					mem_reader->read(spans);
+			}
+			else
+			{
+				current.resize(chunk.read_size);
+				mem_reader->read(region_start + chunk.location, current.data(), current.size());
+			}
+			metrics.add_region_time(chunk.region_id, read_timer.stop());
+
+			stage_timer scan_timer(metrics, stage::scan);
+			const auto is_zero = [](const u8 byte) { return byte == 0; };
+			if (opts.skip_null_regions && std::all_of(current.begin(), current.end(), is_zero) && std::all_of(previous.begin(), previous.end(), is_zero))
+			{
+				metrics.buffer_released(buffer_size);
+				return;
+			}
+
+			std::vector<u64> diff(chunk.read_size / scan_block_size + 2);
+			diff_bytes(previous.data(), current.data(), chunk.read_size, diff.data());
+
+			// a value isn't zero if any of its bytes isn't zero
+			std::vector<u64> nonzero;
+			if (opts.skip_zeroes)
+			{
+				const std::vector<u8> zeroes(chunk.read_size);
+				nonzero.resize(diff.size());
+				diff_bytes(zeroes.data(), current.data(), chunk.read_size, nonzero.data());
+			}
+
+			// every position that has enough bytes left for the type is a candidate
+			const u64 words = (chunk.positions + 63) / 64;
+			std::array<std::vector<u64>, 4> planes;
+
+			for (u8 i = 0; i < planes.size(); ++i)
+			{
+				const u8 size = type_size(datatypes[i]);
+				if (!enabled[i] || chunk.read_size < size)
+					continue;
+
+				const u64 candidates = std::min(chunk.positions, chunk.read_size - size + 1);
+				planes[i].resize(words);
+				std::fill(planes[i].begin(), planes[i].begin() + candidates / 64, ~0ULL);
+				if (candidates % 64 != 0)
+					planes[i][candidates / 64] = (1ULL << (candidates % 64)) - 1;
+
+				if (opts.skip_zeroes)
+					for (u64 word = 0; word < words; ++word)
+						planes[i][word] &= any_value_byte(nonzero.data(), word, size);
+
+				refine_plane_change(planes[i], diff.data(), previous.data(), current.data(), i, change);
+			}
+
+			chunk_results[chunk_index] = segment_from_planes(chunk.region_id, chunk.location, chunk.positions, std::move(planes),
+					current.data(), current.size(), true, filter.enable_i64 || filter.enable_f64);
+			scan_timer.stop();
+			metrics.buffer_released(buffer_size);
+
+			stage_timer budget_timer(metrics, stage::allocate);
+			fit_to_budget(chunk_results[chunk_index], budget);
+		});
+
+		stage_timer merge_timer(metrics, stage::merge);
+		results new_results;
+		for (result_segment& segment : chunk_results)
+			new_results.add_segment(std::move(segment));
+		merge_timer.stop();
+
+		new_results.set_soft_dirty_epoch(dirty_tracker.epoch());
+
+		end_metrics(new_results.count());
+		print_read_stats();
+		print_spill_stats(budget);
+
+		return new_results;
+	}
+
+	// byte patterns are always case sensitive
+	static u8 anchor_fold(const byte_pattern&, const u64)
+	{
+		return 0;
+	}
+
+	static u8 anchor_fold(const text_pattern& pattern, const u64 offset)
+	{
+		return pattern.fold(offset);
+	}
+
+	// the matches are stored as the integer that starts from the match, so that
+	// they can be refined and set like any other result afterwards
+	static u8 match_type_index(const u64 match_size)
+	{
+		return match_size >= sizeof(i64) ? 1 : 0;
+	}
+
+	template<typename Pattern>
+	results memory::find_pattern(const options opts, const Pattern& pattern, const u8 type_index)
+	{
+		begin_metrics(std::is_same_v<Pattern, text_pattern> ? "text search" : "pattern search");
+
+		const u64 match_size = std::max<u64>(pattern.size(), type_size(datatypes[type_index]));
+
+		struct pattern_chunk
+		{
+			u16 region_id;
+			u64 location;
+			u64 positions;
+			u64 read_size;	// positions + overlap (clamped to the end of the region)
+		};
+
+		std::vector<pattern_chunk> chunks;
+		for (const auto& [region_id, region] : regions)
+		{
+			const u64 region_size = region.end - region.start;
+			for (u64 location = 0; location < region_size; location += chunk_size)
+				chunks.push_back({ region_id, location, std::min(chunk_size, region_size - location), std::min(chunk_size + match_size - 1, region_size - location) });
+		}
+
+		const u64 chunk_buffer_size = chunk_size + match_size - 1;
+		chunk_buffer_pool buffers(chunk_buffer_size, opts.chunk_budget * megabyte / chunk_buffer_size);
+
+		std::vector<result_segment> chunk_results(chunks.size());
+		memory_budget budget(memory_limit, 0);
+
+		// start tracking the writes before anything gets read
+		dirty_tracker.clear();
+
+		parallel_for(pool, chunks.size(), [&](const u64 chunk_index)
+		{
+			const pattern_chunk& chunk = chunks[chunk_index];
+
+			stage_timer wait_timer(metrics, stage::allocate);
+			std::vector<u8> bytes = buffers.acquire();
+			wait_timer.stop();
+			metrics.buffer_allocated(bytes.size());
+
+			stage_timer read_timer(metrics, stage::read);
+			mem_reader->read(regions.at(chunk.region_id).start + chunk.location, bytes.data(), chunk.read_size);
+			metrics.add_region_time(chunk.region_id, read_timer.stop());
+
+			stage_timer scan_timer(metrics, stage::scan);
+
+			const u64 candidates = chunk.read_size < match_size ? 0 : std::min(chunk.positions, chunk.read_size - match_size + 1);
+			const u64 full_blocks = candidates / scan_block_size;
+
+			std::array<std::vector<u64>, 4> planes;
+			std::vector<u64>& plane = planes[type_index];
+			plane.resize((chunk.positions + 63) / 64);
+
+			// the anchor bytes only narrow down the candidates, the
+			// whole pattern is compared for each of them afterwards
+			anchor_blocks(bytes.data() + pattern.first_anchor(), bytes.data() + pattern.second_anchor(),
+					pattern.at(pattern.first_anchor()), pattern.at(pattern.second_anchor()),
+					anchor_fold(pattern, pattern.first_anchor()), anchor_fold(pattern, pattern.second_anchor()),
+					full_blocks, plane.data());
+
+			for (u64 word = 0; word < full_blocks; ++word)
+			{
+				for (u64 bits = plane[word]; bits != 0; bits &= bits - 1)
+				{
+					const u8 bit = __builtin_ctzll(bits);
+					if (!pattern.matches(&bytes[word * 64 + bit]))
+						plane[word] &= ~(1ULL << bit);
+				}
+			}
+
+			for (u64 i = full_blocks * scan_block_size; i < candidates; ++i)
+				if (pattern.matches(&bytes[i]))
+					plane[i / 64] |= 1ULL << (i % 64);
+
+			chunk_results[chunk_index] = segment_from_planes(chunk.region_id, chunk.location, chunk.positions, std::move(planes),
+					bytes.data(), chunk.read_size, true, type_index == 1);
+			scan_timer.stop();
+
+			stage_timer budget_timer(metrics, stage::allocate);
+			fit_to_budget(chunk_results[chunk_index], budget);
+
+			metrics.buffer_released(bytes.size());
+			buffers.release(std::move(bytes));
+		});
+
+		stage_timer merge_timer(metrics, stage::merge);
+		results new_results;
+		for (result_segment& segment : chunk_results)
+			new_results.add_segment(std::move(segment));
+		merge_timer.stop();
+
+		new_results.set_soft_dirty_epoch(dirty_tracker.epoch());
+
+		end_metrics(new_results.count());
+		print_read_stats();
+		print_spill_stats(budget);
+
+		return new_results;
+	}
+
+	results memory::search_pattern(const options opts, const byte_pattern& pattern)
+	{
+		return find_pattern(opts, pattern, match_type_index(pattern.size()));
+	}
+
+	results memory::search_text(const options opts, const text_pattern& pattern)
+	{
+		results new_results = find_pattern(opts, pattern, match_type_index(pattern.size()));
+		new_results.set_text({ pattern.encoding(), pattern.size() });
+		return new_results;
+	}
+
+	results memory::refine_text(const text_pattern& pattern, const results& old_results)
+	{
+		begin_metrics("text refine");
+
+		const u8 type_index = match_type_index(pattern.size());
+		const u64 match_size = std::max<u64>(pattern.size(), type_size(datatypes[type_index]));
+
+		const std::vector<result_segment>& segments = old_results.segments();
+		std::vector<result_segment> new_segments(segments.size());
+
+		// start tracking the writes before anything gets read
+		dirty_tracker.clear();
+
+		parallel_for(pool, segments.size(), [&](const u64 segment_index)
+		{
+			const result_segment& segment = segments[segment_index];
+			const u64 region_start = regions.at(segment.region_id).start;
+
+			// text results are usually few and far apart, so only the
+			// bytes of each match are read in a single batch
+			std::vector<u32> locations;
+			segment.for_each_entry([&](const u64, const u32 location, const type_mask)
+			{
+				locations.push_back(location);
+			});
+
+			std::vector<u8> bytes(locations.size() * match_size);
+			metrics.buffer_allocated(bytes.size());
+
+			std::vector<read_span> spans;
+			spans.reserve(locations.size());
+			for (u64 i = 0; i < locations.size(); ++i)
+				spans.push_back({ region_start + locations[i], match_size, &bytes[i * match_size] });
+
+			stage_timer read_timer(metrics, stage::read);
+			mem_reader->read(spans);
+			read_timer.stop();
+
+			stage_timer scan_timer(metrics, stage::scan);
+			segment_builder builder(segment.region_id, true, type_index == 1);
+			for (u64 i = 0; i < locations.size(); ++i)
+				if (pattern.matches(&bytes[i * match_size]))
+					builder.add(locations[i], 1 << type_index, &bytes[i * match_size]);
+
+			new_segments[segment_index] = builder.finish();
+			metrics.buffer_released(bytes.size());
+		});
+
+		stage_timer merge_timer(metrics, stage::merge);
+		results new_results;
+		for (result_segment& segment : new_segments)
+			new_results.add_segment(std::move(segment));
+		merge_timer.stop();
+
+		new_results.set_soft_dirty_epoch(dirty_tracker.epoch());
+		new_results.set_text({ pattern.encoding(), pattern.size() });
+
+		end_metrics(new_results.count());
+		print_read_stats();
+
+		return new_results;
+	}
+
+	// enough chains to narrow down with a few restarts of the target
+	static constexpr u64 max_pointer_chains = 1'000'000;
+
+	// the part of a path after the last slash
+	static std::string file_name(const std::string& path)
+	{
+		return path.substr(path.rfind('/') + 1);
+	}
+
+	pointer_chains memory::pointer_scan(const u64 target, const u8 max_depth, const u32 max_offset)
+	{
+		begin_metrics("pointer scan");
+
+		const std::vector<mapping> mappings = read_mappings();
+
+		// the static variables of a module are in its writable mappings, and the ones
+		// that start as zeroes are in the anonymous mapping right after them
+		std::vector<pointer_module> modules;
+		std::unordered_map<std::string, u64> module_bases;
+		for (u64 i = 0; i < mappings.size(); ++i)
+		{
+			const mapping& mapping = mappings[i];
+			if (mapping.path.empty() || mapping.path.starts_with('['))
+				continue;
+
+			const u64 base = module_bases.try_emplace(mapping.path, mapping.start).first->second;
+			if (!mapping.writable)
+				continue;
+
+			u64 end = mapping.end;
+			if (i + 1 < mappings.size() && mappings[i + 1].path.empty() && mappings[i + 1].writable && mappings[i + 1].start == end)
+				end = mappings[i + 1].end;
+
+			modules.push_back({ file_name(mapping.path), base, mapping.start, end });
+		}
+
+		// only the values that point to readable memory can be pointers
+		std::vector<std::pair<u64, u64>> readable;
+		for (const mapping& mapping : mappings)
+			if (mapping.readable)
+				readable.emplace_back(mapping.start, mapping.end);
+
+		const u64 lowest = readable.empty() ? 0 : readable.front().first;
+		const u64 highest = readable.empty() ? 0 : readable.back().second;
+
+		const auto is_mapped = [&](const u64 value)
+		{
+			if (value < lowest || value >= highest) [[likely]]
+				return false;
+
+			auto it = std::upper_bound(readable.begin(), readable.end(), std::pair<u64, u64>(value, ~0ULL));
+			return it != readable.begin() && value < (--it)->second;
+		};
+
+		struct index_chunk
+		{
+			u16 region_id;
+			u64 location;
+			u64 size;
+		};
+
+		std::vector<index_chunk> chunks;
+		for (const auto& [region_id, region] : regions)
+			for (u64 location = 0; location < region.end - region.start; location += chunk_size)
+				chunks.push_back({ region_id, location, std::min(chunk_size, region.end - region.start - location) });
+
+		std::vector<std::vector<pointer_entry>> chunk_pointers(chunks.size());
+
+		parallel_for(pool, chunks.size(), [&](const u64 chunk_index)
+		{
+			const index_chunk& chunk = chunks[chunk_index];
+			const u64 address = regions.at(chunk.region_id).start + chunk.location;
+
+			stage_timer allocate_timer(metrics, stage::allocate);
+			std::vector<u8> bytes(chunk.size);
+			allocate_timer.stop();
+			metrics.buffer_allocated(bytes.size());
+
+			stage_timer read_timer(metrics, stage::read);
+			mem_reader->read(address, bytes.data(), bytes.size());
+			metrics.add_region_time(chunk.region_id, read_timer.stop());
+
+			// pointers are aligned to their size
+			stage_timer scan_timer(metrics, stage::scan);
+			std::vector<pointer_entry>& pointers = chunk_pointers[chunk_index];
+			for (u64 offset = 0; offset + sizeof(u64) <= bytes.size(); offset += sizeof(u64))
+			{
+				u64 value;
+				memcpy(&value, &bytes[offset], sizeof(value));
+
+				if (is_mapped(value))
+					pointers.push_back({ value, address + offset });
+			}
+
+			metrics.buffer_released(bytes.size());
+		});
+
+		stage_timer merge_timer(metrics, stage::merge);
+		u64 pointer_count{0};
+		for (const std::vector<pointer_entry>& pointers : chunk_pointers)
+			pointer_count += pointers.size();
+
+		std::vector<pointer_entry> index;
+		index.reserve(pointer_count);
+		for (std::vector<pointer_entry>& pointers : chunk_pointers)
+		{
+			index.insert(index.end(), pointers.begin(), pointers.end());
+			pointers = std::vector<pointer_entry>();
+		}
+
+		parallel_sort(pool, index, [](const pointer_entry& a, const pointer_entry& b) { return a.value < b.value; });
+		merge_timer.stop();
+
+		std::cout << "found " << index.size() << " pointers in " << regions.size() << " regions and " << modules.size() << " static areas\n";
+
+		stage_timer search_timer(metrics, stage::scan);
+		pointer_chains chains = find_pointer_chains(pool, index, modules, { target, max_depth, max_offset, memory_limit, max_pointer_chains });
+		search_timer.stop();
+
+		end_metrics(chains.chains.size());
+		print_read_stats();
+
+		return chains;
+	}
+
+	std::vector<u64> memory::follow(const pointer_chains& chains)
+	{
+		// the modules are found by their names, since their addresses change between runs
+		std::unordered_map<std::string, u64> bases;
+		for (const mapping& mapping : read_mappings())
+			if (!mapping.path.empty())
+				bases.try_emplace(file_name(mapping.path), mapping.start);
+
+		std::vector<u64> addresses(chains.chains.size());
+		for (u64 i = 0; i < chains.chains.size(); ++i)
+		{
+			const auto it = bases.find(chains.modules.at(chains.chains[i].module));
+			addresses[i] = it == bases.end() ? 0 : it->second + chains.chains[i].base_offset;
+		}
+
+		// the pointers of all of the chains at the same depth are read in a single batch
+		std::vector<u64> pointers(chains.chains.size());
+		for (u8 depth = 0; depth < pointer_chain::max_depth; ++depth)
+		{
+			std::vector<read_span> spans;
+			std::vector<u64> followed;
+
+			for (u64 i = 0; i < chains.chains.size(); ++i)
+			{
+				if (chains.chains[i].depth <= depth || addresses[i] == 0)
+					continue;
+
+				spans.push_back({ addresses[i], sizeof(u64), reinterpret_cast<u8*>(&pointers[i]) });
+				followed.push_back(i);
+			}
+
+			if (spans.empty())
+				break;
+
+			// the pointers that can't be read become zeroes
+			mem_reader->read(spans);
+
+			for (const u64 i : followed)
+				addresses[i] = pointers[i] == 0 ? 0 : pointers[i] + chains.chains[i].offsets[depth];
+		}
+
+		return addresses;
+	}
+
+	void memory::set(result& result, const type_bundle value)
+	{
+		const u8* data = reinterpret_cast<const u8*>(value.str_ptr.at(type_index(result.type)));
+		const u8 size = type_size(result.type);
+
+		const write_span span{ address(result), size, data };
+		if (mem_writer.write(std::span<const write_span>(&span, 1)) != size) [[unlikely]]
+		{
+			std::cout << "can't write to " << std::hex << span.address << std::dec << '\n';
+			return;
+		}
+
+		// update the result value
+		memcpy(result.value.bytes, data, size);
+	}
+
+	void memory::write(const result& result, const std::vector<u8>& bytes)
+	{
+		const write_span span{ address(result), bytes.size(), bytes.data() };
+		if (mem_writer.write(std::span<const write_span>(&span, 1)) != bytes.size()) [[unlikely]]
+			std::cout << "can't write to " << std::hex << span.address << std::dec << '\n';
+	}
+
+	u64 memory::set_all(const results& results, const std::array<std::vector<u8>, 4>& values, const bool verify)
+	{
+		struct write_target
+		{
+			u64 address;
+			u64 size;
+			u64 offset;	// where the bytes of the target are in the image
+			u8 type_index;
+		};
+
+		std::vector<write_target> targets;
+		targets.reserve(results.count());
+		results.for_each([&](const result& result)
+		{
+			const u8 index = type_index(result.type);
+			if (!values[index].empty())
+				targets.push_back({ address(result), values[index].size(), 0, index });
+		});
+
+		// the results are mostly in address order already, but the regions don't have to be.
+		// the sort is stable so that the results at the same address keep their type order
+		std::stable_sort(targets.begin(), targets.end(), [](const write_target& a, const write_target& b)
+		{
+			return a.address < b.address;
+		});
+
+		// copy the values into runs of contiguous memory, the same way
+		// they would end up in the target if written one by one
+		struct write_run
+		{
+			u64 address;
+			u64 size;
+			u64 offset;
+		};
+
+		std::vector<u8> image;
+		std::vector<write_run> runs;
+
+		for (write_target& target : targets)
+		{
+			if (runs.empty() || target.address > runs.back().address + runs.back().size)
+				runs.push_back({ target.address, 0, image.size() });
+
+			write_run& run = runs.back();
+			const u64 end = std::max(run.address + run.size, target.address + target.size);
+			image.resize(run.offset + end - run.address);
+			run.size = end - run.address;
+
+			target.offset = run.offset + target.address - run.address;
+			memcpy(&image[target.offset], values[target.type_index].data(), target.size);
+		}
+
+		std::vector<write_span> spans;
+		spans.reserve(runs.size());
+		for (const write_run& run : runs)
+			spans.push_back({ run.address, run.size, image.data() + run.offset });
+
+		const u64 written = mem_writer.write(spans);
+		std::cout << "wrote " << written << " bytes to " << targets.size() << " addresses in " << runs.size() << " runs\n";
+
+		if (!verify)
+			return 0;
+
+		std::vector<u8> current(image.size());
+		std::vector<read_span> read_spans;
+		read_spans.reserve(runs.size());
+		for (const write_run& run : runs)
+			read_spans.push_back({ run.address, run.size, current.data() + run.offset });
+
+		mem_reader->read(read_spans);
+
+		return std::count_if(targets.begin(), targets.end(), [&](const write_target& target)
+		{
+			return memcmp(&image[target.offset], &current[target.offset], target.size) != 0;
+		});
+	}
+
+	std::vector<u8> memory::read(const result& result, const u64 size)
+	{
+		std::vector<u8> bytes(size);
+		mem_reader->read(result.location + regions.at(result.region_id).start, bytes.data(), size);
+		return bytes;
+	}
+
+	std::vector<u8> memory::read_results(std::span<const result> results, const u64 size)
+	{
+		std::vector<u8> bytes(results.size() * size);
+
+		std::vector<read_span> spans;
+		spans.reserve(results.size());
+		for (u64 i = 0; i < results.size(); ++i)
+			spans.push_back({ address(results[i]), size, bytes.data() + i * size });
+
+		mem_reader->read(spans);
+		return bytes;
+	}
+
+	u64 memory::region_count() const
+	{
+		return regions.size();
+	}
+
+	u64 memory::address(const result& result) const
+	{
+		return regions.at(result.region_id).start + result.location;
+	}
+
+	const scan_metrics& memory::last_metrics() const
+	{
+		return metrics;
+	}
+
+	bool memory::save(const std::string& path, const results& results, const snapshot& snapshot) const
+	{
+		if (!session::save(path, pid, regions, results, snapshot))
+			return false;
+
+		std::cout << "saved " << results.count() << " results from " << regions.size() << " regions";
+		if (!snapshot.empty())
+			std::cout << " and a snapshot of " << snapshot.byte_count() / 1'000'000 << "MB";
+		std::cout << " to " << path << '\n';
+
+		return true;
+	}
+
+	bool memory::load(const std::string& path, results& results, snapshot& snapshot)
+	{
+		std::vector<std::pair<u64, u64>> mappings;
+		for (const mapping& mapping : read_mappings())
+			if (mapping.writable)
+				mappings.emplace_back(mapping.start, mapping.end);
+
+		// the whole region has to be covered by writable mappings that follow each other
+		const auto still_mapped = [&mappings](const memory_region& region)
+		{
+			auto it = std::upper_bound(mappings.begin(), mappings.end(), std::pair<u64, u64>(region.start, ~0ULL));
+			if (it == mappings.begin())
+				return false;
+
+			u64 covered = region.start;
+			for (--it; it != mappings.end() && it->first <= covered && covered < region.end; ++it)
+				covered = std::max(covered, it->second);
+
+			return covered >= region.end;
+		};
+
+		std::optional<session> loaded = session::load(path, still_mapped);
+		if (!loaded.has_value())
+			return false;
+
+		if (loaded->regions.empty())
+		{
+			std::cout << "none of the saved regions are mapped in the process anymore\n";
+			return false;
+		}
+
+		if (loaded->pid != pid)
+			std::cout << "the session was saved from process " << loaded->pid << ", the regions were checked against process " << pid << '\n';
+
+		// the results refer to the saved region ids, so new regions have to get ids after them
+		regions = std::move(loaded->regions);
+		next_region_id = std::max<u32>(next_region_id, regions.rbegin()->first + 1);
+
+		results = std::move(loaded->saved_results);
+		snapshot = std::move(loaded->saved_snapshot);
+
+		std::cout << "loaded " << results.count() << " results from " << regions.size() << " regions";
+		if (!snapshot.empty())
+			std::cout << " and a snapshot of " << snapshot.byte_count() / 1'000'000 << "MB";
+		std::cout << '\n';
+
+		if (loaded->dropped_results != 0)
+			std::cout << "left out " << loaded->dropped_results << " results from the regions that aren't mapped anymore\n";
+
+		return true;
+	}
+
+	bool memory::refresh(results& results, snapshot& snapshot)
+	{
+		const std::optional<std::vector<mapping>> mappings = read_maps(proc_path + "/maps");
+		if (!mappings.has_value()) [[unlikely]]
+		{
+			std::cout << "can't open " << proc_path << "/maps\n";
+			return false;
+		}
+
+		begin_metrics("refresh");
+
+		std::vector<memory_region> suitable_mappings;
+		for (const mapping& mapping : mappings.value())
+			if (suitable(mapping))
+				suitable_mappings.push_back({ mapping.start, mapping.end, mapping.shared });
+
+		// the suitable address ranges with the mappings that follow each other joined, since
+		// a region can span multiple mappings after a part of it has been protected differently
+		std::vector<std::pair<u64, u64>> mapped;
+		for (const memory_region& mapping : suitable_mappings)
+		{
+			if (!mapped.empty() && mapped.back().second == mapping.start)
+				mapped.back().second = mapping.end;
+			else
+				mapped.emplace_back(mapping.start, mapping.end);
+		}
+
+		// the parts of the regions that are still mapped, the part that starts from the
+		// start of a region keeps its id and the parts after a hole get new ids. the new
+		// ids can go past the last one, which gets sorted out once everything is placed
+		struct placed_region
+		{
+			u32 id;
+			memory_region region;
+		};
+
+		struct placed_range
+		{
+			u32 id;
+			u64 location;
+			u64 size;
+		};
+
+		std::vector<placed_region> placed;
+		std::vector<std::pair<region_move, u32>> pieces;
+		u32 next_id = next_region_id;
+		u64 removed{0}, cut{0};
+
+		for (const auto& [region_id, region] : regions)
+		{
+			auto it = std::upper_bound(mapped.begin(), mapped.end(), std::pair<u64, u64>(region.start, ~0ULL));
+			if (it != mapped.begin() && std::prev(it)->second > region.start)
+				--it;
+
+			u64 kept{0};
+			for (; it != mapped.end() && it->first < region.end; ++it)
+			{
+				const u64 start = std::max<u64>(it->first, region.start);
+				const u64 end = std::min<u64>(it->second, region.end);
+				const u32 id = start == region.start ? region_id : next_id++;
+
+				placed.push_back({ id, { start, end, region.shared } });
+				pieces.push_back({ { region_id, start - region.start, end - region.start, 0, 0 }, id });
+				kept += end - start;
+			}
+
+			if (kept == 0)
+				++removed;
+			else if (kept < region.end - region.start)
+				++cut;
+		}
+
+		const auto by_address = [](const placed_region& a, const placed_region& b) { return a.region.start < b.region.start; };
+		std::sort(placed.begin(), placed.end(), by_address);
+
+		// the parts of the suitable mappings that aren't covered by any of the regions either
+		// extend the region before them if it's in the same mapping, or become new regions
+		std::vector<placed_range> new_ranges;
+		u64 added{0}, grown{0}, new_bytes{0};
+		u64 next{0};	// the first placed region that ends after the cursor
+		const u64 placed_count = placed.size();
+
+		for (const memory_region& mapping : suitable_mappings)
+		{
+			for (u64 cursor = mapping.start; cursor < mapping.end;)
+			{
+				while (next < placed_count && placed[next].region.end <= cursor)
+					++next;
+
+				const u64 gap_end = next < placed_count ? std::min<u64>(mapping.end, placed[next].region.start) : mapping.end;
+				if (gap_end <= cursor)
+				{
+					cursor = placed[next].region.end;
+					continue;
+				}
+
+				if (next > 0 && placed[next - 1].region.end == cursor && cursor > mapping.start)
+				{
+					placed_region& previous = placed[next - 1];
+					new_ranges.push_back({ previous.id, cursor - previous.region.start, gap_end - cursor });
+					previous.region.end = gap_end;
+					++grown;
+				}
+				else
+				{
+					new_ranges.push_back({ next_id, 0, gap_end - cursor });
+					placed.push_back({ next_id++, { cursor, gap_end, mapping.shared } });
+					++added;
+				}
+
+				new_bytes += gap_end - cursor;
+				cursor = gap_end;
+			}
+		}
+
+		// the ids of the regions that still exist can't be reused, so once they run
+		// out, the regions get renumbered in address order. the regions past the last
+		// id are left out along with their results
+		std::unordered_map<u32, u16> renumbered;
+		const bool renumber = next_id > max_regions;
+		u64 left_out{0};
+
+		if (renumber)
+		{
+			std::sort(placed.begin(), placed.end(), by_address);
+			if (placed.size() > max_regions)
+			{
+				left_out = placed.size() - max_regions;
+				placed.resize(max_regions);
+			}
+
+			for (u32 i = 0; i < placed.size(); ++i)
+				renumbered[placed[i].id] = i;
+
+			next_id = placed.size();
+		}
+
+		const auto final_id = [&](const u32 id) -> std::optional<u16>
+		{
+			if (!renumber)
+				return id;
+
+			const auto it = renumbered.find(id);
+			return it == renumbered.end() ? std::nullopt : std::optional<u16>(it->second);
+		};
+
+		regions.clear();
+		for (const placed_region& region : placed)
+			regions[final_id(region.id).value()] = region.region;
+
+		next_region_id = next_id;
+
+		std::vector<region_move> moves;
+		for (auto [move, id] : pieces)
+		{
+			if (const std::optional<u16> new_id = final_id(id))
+			{
+				move.new_region_id = new_id.value();
+				moves.push_back(move);
+			}
+		}
+
+		const u64 dropped_results = results.move_regions(moves);
+
+		// the new ranges would be compared against zeroes if they weren't in
+		// the snapshot, so they get read in now instead of the whole memory again
+		if (!snapshot.empty())
+		{
+			snapshot.move_regions(moves);
+
+			std::vector<region_range> read_ranges;
+			for (const placed_range& range : new_ranges)
+				if (const std::optional<u16> id = final_id(range.id))
+					read_ranges.push_back({ id.value(), range.location, range.size });
+
+			std::stable_sort(read_ranges.begin(), read_ranges.end(), [](const region_range& a, const region_range& b) { return a.region_id < b.region_id; });
+			snapshot.merge(snapshot_ranges(read_ranges, snapshot.total_size()));
+		}
+
+		if (renumber)
+			std::cout << "ran out of region ids, the regions were numbered again\n";
+
+		if (left_out != 0)
+			std::cout << "the process has more than " << max_regions << " suitable regions, " << left_out << " of them were left out\n";
+
+		end_metrics(results.count());
+
+		std::cout << "regions: " << added << " new, " << grown << " grown, " << cut << " partly unmapped, " << removed << " unmapped, "
+			<< regions.size() << " in total\n";
+
+		if (new_bytes != 0)
+		{
+			std::cout << new_bytes / 1'000'000 << "MB of new memory";
+			if (!snapshot.empty())
+				std::cout << " was added to the snapshot";
+			else if (results.count() != 0)
+				std::cout << " isn't covered by the results until a new search";
+			std::cout << '\n';
+		}
+
+		if (dropped_results != 0)
+			std::cout << "dropped " << dropped_results << " results from the memory that isn't mapped anymore\n";
+
+		return true;
+	}
+
+	void memory::begin_metrics(const std::string& operation)
+	{
+		mem_reader->reset_stats();
+		metrics.begin(operation, regions.empty() ? 0 : regions.rbegin()->first + 1);
+	}
+
+	void memory::end_metrics(const u64 matches)
+	{
+		metrics.end(mem_reader->stats(), matches);
+	}
+
+	void memory::print_read_stats() const
+	{
+		const reader_stats stats = mem_reader->stats();
+		const f64 seconds = stats.nanoseconds / 1'000'000'000.0;
+
+		std::cout << "read " << stats.bytes / 1'000'000 << "MB in " << stats.syscalls << " syscalls with " << mem_reader->name();
+		if (seconds > 0)
+			std::cout << " (" << (stats.bytes / static_cast<f64>(gigabyte)) / seconds << "GB/s)";
+		std::cout << '\n';
+	}
+
+	std::vector<mapping> memory::read_mappings() const
+	{
+		return read_maps(proc_path + "/maps").value_or(std::vector<mapping>());
+	}
+
+	void memory::print_spill_stats(const memory_budget& budget) const
+	{
+		const u64 spilled = budget.spilled();
+		if (spilled == 0) [[likely]]
+			return;
+
+		std::cout << "the memory limit of " << memory_limit / gigabyte << "GB was reached, "
+			<< spilled / 1'000'000 << "MB was moved to a temporary file\n";
+	}
+
+	std::vector<u8> memory::read_region(const size_t start, const size_t end)
+	{
+		assert(end > start);
+
+		std::vector<u8> bytes;
+		bytes.resize(end - start);
+
+		mem_reader->read(start, bytes.data(), bytes.size());
+
+		return bytes;
+	}
+
+	std::pair<const u8*, u64> memory::segment_snapshot::at(const u64 location) const
+	{
+		auto run = std::upper_bound(runs.begin(), runs.end(), location, [](const u64 location, const page_run& run) { return location < run.location; });
+		assert(run != runs.begin());
+		--run;
+
+		assert(location < run->location + run->size);
+		return { &bytes[run->offset + location - run->location], run->location + run->size - location };
+	}
+
+	std::pair<const u8*, u64> memory::segment_snapshot::find(const u64 location, u64& run_index) const
+	{
+		while (run_index < runs.size() && location >= runs[run_index].location + runs[run_index].size)
+			++run_index;
+
+		if (run_index == runs.size() || location < runs[run_index].location)
+			return { nullptr, 0 };
+
+		const page_run& run = runs[run_index];
+		return { &bytes[run.offset + location - run.location], run.location + run.size - location };
+	}
+
+	void memory::segment_snapshot::copy_to(const u64 location, u8* destination, const u64 size) const
+	{
+		for (const page_run& run : runs)
+		{
+			const u64 start = std::max(location, run.location);
+			const u64 end = std::min(location + size, run.location + run.size);
+
+			if (start < end)
+				memcpy(destination + start - location, &bytes[run.offset + start - run.location], end - start);
+		}
+	}
+
+	bool memory::changed_pages(const u16 region_id, const u64 location, const u64 pages, std::vector<u64>& changed) const
+	{
+		const memory_region& region = regions.at(region_id);
+
+		// writes from other processes to a shared mapping don't
+		// mark the pages of the target as dirty
+		if (region.shared)
+			return false;
+
+		std::vector<u64> dirty((pages + 63) / 64);
+		if (!dirty_tracker.dirty_pages(region.start + location, pages, dirty.data()))
+			return false;
+
+		changed.assign(dirty.size(), 0);
+		for (u64 word = 0; word < dirty.size(); ++word)
+		{
+			const u64 previous_page = word > 0 ? dirty[word - 1] >> 63 : 0;
+			const u64 next_page = word + 1 < dirty.size() ? dirty[word + 1] << 63 : 0;
+			changed[word] = dirty[word] | (dirty[word] << 1) | previous_page | (dirty[word] >> 1) | next_page;
+		}
+
+		if (pages % 64 != 0)
+			changed.back() &= (1ULL << (pages % 64)) - 1;
+
+		return true;
+	}
+
+	std::vector<memory::segment_snapshot> memory::snapshot_segments(const results& results, memory_budget& budget, const bool skip_clean_pages)
+	{
+		std::cout << "taking a memory snapshot\n" << std::flush;
+
+		const std::vector<result_segment>& segments = results.segments();
+		std::vector<segment_snapshot> snapshots(segments.size());
+
+		// find the pages that the values of the results touch, late refinements
+		// only have a few results left and most of the pages can be skipped
+		parallel_for(pool, segments.size(), [&](const u64 segment_index)
+		{
+			const result_segment& segment = segments[segment_index];
+			const u64 region_size = regions.at(segment.region_id).end - regions.at(segment.region_id).start;
+			segment_snapshot& snapshot = snapshots[segment_index];
+
+			const auto add_range = [&](const u64 start, const u64 end)
+			{
+				const u64 first_page = start / page_size * page_size;
+				const u64 page_end = std::min((end + page_size - 1) / page_size * page_size, region_size);
+
+				if (!snapshot.runs.empty() && first_page <= snapshot.runs.back().location + snapshot.runs.back().size)
+				{
+					segment_snapshot::page_run& run = snapshot.runs.back();
+					run.size = std::max(run.size, page_end - run.location);
+					return;
+				}
+
+				snapshot.runs.push_back({ first_page, page_end - first_page, 0 });
+			};
+
+			if (segment.kind() == segment_kind::bitmap)
+				add_range(segment.first_location(), segment.first_location() + segment.span() + max_type_size - 1);
+			else
+				segment.for_each_entry([&](const u64, const u32 location, const type_mask)
+				{
+					add_range(location, location + max_type_size);
+				});
+		});
+
+		// the values that are read from here on can be compared against
+		// the soft-dirty bits during the next refinement
+		const bool tracked = results.soft_dirty_epoch() != 0 && results.soft_dirty_epoch() == dirty_tracker.epoch();
+		if (!tracked)
+			dirty_tracker.clear();
+
+		if (tracked && skip_clean_pages)
+		{
+			// split the runs into the pages that have to be read again
+			std::vector<std::vector<segment_snapshot::page_run>> changed_runs(segments.size());
+			std::atomic<u64> total_pages{0};
+			std::atomic<u64> pages_left{0};
+
+			parallel_for(pool, segments.size(), [&](const u64 segment_index)
+			{
+				const u16 region_id = segments[segment_index].region_id;
+
+				for (const segment_snapshot::page_run& run : snapshots[segment_index].runs)
+				{
+					const u64 pages = (run.size + page_size - 1) / page_size;
+					total_pages += pages;
+
+					std::vector<u64> changed;
+					if (!changed_pages(region_id, run.location, pages, changed))
+					{
+						changed_runs[segment_index].push_back(run);
+						pages_left += pages;
+						continue;
+					}
+
+					for_each_bit_run(changed, pages, [&](const u64 first, const u64 last)
+					{
+						const u64 size = std::min(last * page_size, run.size) - first * page_size;
+						changed_runs[segment_index].push_back({ run.location + first * page_size, size, 0 });
+						pages_left += last - first;
+					});
+				}
+			});
+
+			std::cout << "reading " << pages_left << " of " << total_pages << " pages, the rest haven't been written to since the last scan\n";
+
+			// once most of the pages have been written to, tracking them isn't
+			// worth it anymore, so everything is read again from a new epoch
+			if (pages_left * 2 > total_pages)
+				dirty_tracker.clear();
+			else
+				for (u64 segment_index = 0; segment_index < segments.size(); ++segment_index)
+					snapshots[segment_index].runs = std::move(changed_runs[segment_index]);
+		}
+
+		parallel_for(pool, segments.size(), [&](const u64 segment_index)
+		{
+			segment_snapshot& snapshot = snapshots[segment_index];
+
+			u64 size{0};
+			for (segment_snapshot::page_run& run : snapshot.runs)
+			{
+				run.offset = size;
+				size += run.size;
+			}
+
+			stage_timer allocate_timer(metrics, stage::allocate);
+			metrics.buffer_allocated(size);
+
+			if (budget.reserve(size)) [[likely]]
+			{
+				snapshot.bytes.resize(size);
+				return;
+			}
+
+			// the pages get read straight to the spill file
+			const std::shared_ptr<spill_file> file = budget.scratch_file();
+			if (!file || !snapshot.bytes.spill_allocate(*file, size)) [[unlikely]]
+				snapshot.bytes.resize(size);
+		});
+
+		// split the runs into chunk sized spans and read them in
+		// parallel batches of about a chunk worth of bytes each
+		std::vector<read_span> spans;
+		for (u64 segment_index = 0; segment_index < segments.size(); ++segment_index)
+		{
+			const size_t region_start = regions.at(segments[segment_index].region_id).start;
+			segment_snapshot& snapshot = snapshots[segment_index];
+
+			for (const segment_snapshot::page_run& run : snapshot.runs)
+				for (u64 offset = 0; offset < run.size; offset += chunk_size)
+					spans.push_back({ region_start + run.location + offset, std::min(chunk_size, run.size - offset), snapshot.bytes.data() + run.offset + offset });
+		}
+
+		std::vector<std::span<const read_span>> batches;
+		u64 batch_bytes{0};
+		u64 batch_start{0};
+		for (u64 i = 0; i < spans.size(); ++i)
+		{
+			batch_bytes += spans[i].size;
+			if (batch_bytes >= chunk_size || i + 1 == spans.size())
+			{
+				batches.emplace_back(spans.data() + batch_start, i + 1 - batch_start);
+				batch_start = i + 1;
+				batch_bytes = 0;
+			}
+		}
+
+		parallel_for(pool, batches.size(), [&](const u64 batch_index)
+		{
+			stage_timer read_timer(metrics, stage::read);
+			mem_reader->read(batches[batch_index]);
+		});
+
+		return snapshots;
 	}
 }
@@ -0,0 +1,283 @@
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <sstream>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace harava
+{
+	static u64 nanoseconds_between(const std::chrono::steady_clock::time_point start, const std::chrono::steady_clock::time_point end)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+	}
+
+	static int open_counter(const u64 config, const pid_t thread_id, const bool exclude_kernel)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = config;
+		attr.disabled = 1;
+		attr.exclude_kernel = exclude_kernel;
+		attr.exclude_hv = 1;
+
+		return syscall(SYS_perf_event_open, &attr, thread_id, -1, -1, 0);
+	}
+
+	hardware_counters::~hardware_counters()
+	{
+		close_all();
+	}
+
+	void hardware_counters::close_all()
+	{
+		for (const int fd : cycle_fds)
+			close(fd);
+
+		for (const int fd : miss_fds)
+			close(fd);
+
+		cycle_fds.clear();
+		miss_fds.clear();
+	}
+
+	bool hardware_counters::start()
+	{
+		close_all();
+
+		// the counters of a thread only count that thread, so each of the worker threads
+		// gets their own. the kernel time is left out if it isn't allowed to be counted
+		std::error_code error;
+		for (const std::filesystem::directory_entry& task : std::filesystem::directory_iterator("/proc/self/task", error))
+		{
+			const pid_t thread_id = std::stoi(task.path().filename().string());
+
+			for (const auto& [config, fds] : { std::pair{ PERF_COUNT_HW_CPU_CYCLES, &cycle_fds }, std::pair{ PERF_COUNT_HW_CACHE_MISSES, &miss_fds } })
+			{
+				int fd = open_counter(config, thread_id, false);
+				if (fd == -1)
+					fd = open_counter(config, thread_id, true);
+
+				if (fd == -1)
+				{
+					close_all();
+					return false;
+				}
+
+				fds->push_back(fd);
+			}
+		}
+
+		for (const std::vector<int>* fds : { &cycle_fds, &miss_fds })
+			for (const int fd : *fds)
+				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+
+		return !cycle_fds.empty();
+	}
+
+	std::pair<u64, u64> hardware_counters::stop()
+	{
+		const auto sum = [](const std::vector<int>& fds)
+		{
+			u64 total{0};
+			for (const int fd : fds)
+			{
+				ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+				u64 count{0};
+				if (read(fd, &count, sizeof(count)) == sizeof(count))
+					total += count;
+			}
+
+			return total;
+		};
+
+		const std::pair<u64, u64> counts{ sum(cycle_fds), sum(miss_fds) };
+		close_all();
+		return counts;
+	}
+
+	scan_metrics::scan_metrics(const std::string& json_path, const bool count_hardware_events)
+	:count_hardware_events(count_hardware_events)
+	{
+		if (json_path.empty())
+			return;
+
+		json_file.open(json_path, std::ios::app);
+		if (!json_file.is_open()) [[unlikely]]
+			std::cout << "can't open " << json_path << '\n';
+	}
+
+	void scan_metrics::begin(const std::string& operation, const u32 region_count)
+	{
+		this->operation = operation;
+
+		for (std::atomic<u64>& nanoseconds : stage_nanoseconds)
+			nanoseconds = 0;
+
+		regions = region_count;
+		region_nanoseconds = std::make_unique<std::atomic<u64>[]>(region_count);
+		region_histogram.fill(0);
+
+		buffer_bytes = 0;
+		peak_buffer_bytes = 0;
+		match_count = 0;
+		cycles = 0;
+		cache_misses = 0;
+
+		hardware_events_counted = count_hardware_events && counters.start();
+		start = std::chrono::steady_clock::now();
+	}
+
+	void scan_metrics::end(const reader_stats& reads, const u64 matches)
+	{
+		wall_nanoseconds = nanoseconds_between(start, std::chrono::steady_clock::now());
+
+		if (hardware_events_counted)
+			std::tie(cycles, cache_misses) = counters.stop();
+
+		read_stats = reads;
+		match_count = matches;
+
+		for (u32 i = 0; i < regions; ++i)
+		{
+			const u64 microseconds = region_nanoseconds[i] / 1000;
+			if (microseconds == 0)
+				continue;
+
+			++region_histogram[std::min<u64>(std::bit_width(microseconds) - 1, histogram_buckets - 1)];
+		}
+
+		if (json_file.is_open())
+			json_file << json() << std::endl;
+	}
+
+	void scan_metrics::add_time(const stage stage, const u64 nanoseconds)
+	{
+		stage_nanoseconds[static_cast<u8>(stage)].fetch_add(nanoseconds, std::memory_order_relaxed);
+	}
+
+	void scan_metrics::add_region_time(const u16 region_id, const u64 nanoseconds)
+	{
+		if (region_id < regions) [[likely]]
+			region_nanoseconds[region_id].fetch_add(nanoseconds, std::memory_order_relaxed);
+	}
+
+	void scan_metrics::buffer_allocated(const u64 bytes)
+	{
+		const u64 current = buffer_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+
+		u64 peak = peak_buffer_bytes.load(std::memory_order_relaxed);
+		while (current > peak && !peak_buffer_bytes.compare_exchange_weak(peak, current, std::memory_order_relaxed));
+	}
+
+	void scan_metrics::buffer_released(const u64 bytes)
+	{
+		buffer_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+	}
+
+	void scan_metrics::print() const
+	{
+		if (operation.empty())
+		{
+			std::cout << "nothing has been measured yet\n";
+			return;
+		}
+
+		const auto milliseconds = [](const u64 nanoseconds) { return nanoseconds / 1'000'000.0; };
+
+		std::cout << std::fixed << std::setprecision(2)
+			<< operation << ": " << milliseconds(wall_nanoseconds) << "ms, " << match_count << " results\n"
+			<< "read " << read_stats.bytes / 1'000'000 << "MB in " << read_stats.syscalls << " syscalls, peak buffers "
+			<< peak_buffer_bytes / 1'000'000 << "MB\n";
+
+		u64 total{0};
+		for (const std::atomic<u64>& nanoseconds : stage_nanoseconds)
+			total += nanoseconds;
+
+		std::cout << "thread time per stage:\n";
+		for (u8 i = 0; i < stage_names.size(); ++i)
+		{
+			std::cout << "  " << std::left << std::setw(10) << stage_names[i] << std::right << std::setw(10) << milliseconds(stage_nanoseconds[i]) << "ms";
+			if (total != 0)
+				std::cout << std::setw(8) << 100.0 * stage_nanoseconds[i] / total << '%';
+			std::cout << '\n';
+		}
+
+		if (total != 0)
+		{
+			const u8 largest = std::max_element(stage_nanoseconds.begin(), stage_nanoseconds.end(),
+				[](const std::atomic<u64>& a, const std::atomic<u64>& b) { return a.load() < b.load(); }) - stage_nanoseconds.begin();
+			std::cout << "most of the time went to the " << stage_names[largest] << " stage\n";
+		}
+
+		if (std::any_of(region_histogram.begin(), region_histogram.end(), [](const u64 count) { return count != 0; }))
+		{
+			std::cout << "region read times:\n";
+			for (u8 i = 0; i < histogram_buckets; ++i)
+				if (region_histogram[i] != 0)
+					std::cout << "  " << std::setw(10) << (1ULL << i) << "us - " << std::left << std::setw(10) << std::to_string((2ULL << i) - 1) + "us"
+						<< std::right << region_histogram[i] << '\n';
+		}
+
+		if (hardware_events_counted)
+			std::cout << "cycles: " << cycles << ", cache misses: " << cache_misses << '\n';
+		else if (count_hardware_events)
+			std::cout << "hardware counters aren't available\n";
+
+		std::cout << std::defaultfloat;
+	}
+
+	std::string scan_metrics::json() const
+	{
+		std::ostringstream stream;
+		stream << "{\"operation\":\"" << operation << "\""
+			<< ",\"wall_ns\":" << wall_nanoseconds
+			<< ",\"results\":" << match_count
+			<< ",\"bytes_read\":" << read_stats.bytes
+			<< ",\"syscalls\":" << read_stats.syscalls
+			<< ",\"peak_buffer_bytes\":" << peak_buffer_bytes
+			<< ",\"stage_thread_ns\":{";
+
+		for (u8 i = 0; i < stage_names.size(); ++i)
+			stream << (i == 0 ? "" : ",") << '"' << stage_names[i] << "\":" << stage_nanoseconds[i];
+
+		stream << "},\"region_read_us_log2_histogram\":[";
+		for (u8 i = 0; i < histogram_buckets; ++i)
+			stream << (i == 0 ? "" : ",") << region_histogram[i];
+		stream << ']';
+
+		if (hardware_events_counted)
+			stream << ",\"cycles\":" << cycles << ",\"cache_misses\":" << cache_misses;
+
+		stream << '}';
+		return stream.str();
+	}
+
+	stage_timer::stage_timer(scan_metrics& metrics, const stage stage)
+	:metrics(metrics), timed_stage(stage), start(std::chrono::steady_clock::now())
+	{}
+
+	stage_timer::~stage_timer()
+	{
+		if (!stopped)
+			stop();
+	}
+
+	u64 stage_timer::stop()
+	{
+		const u64 nanoseconds = nanoseconds_between(start, std::chrono::steady_clock::now());
+		metrics.add_time(timed_stage, nanoseconds);
+		stopped = true;
+		return nanoseconds;
+	}
+}
@@ -0,0 +1,159 @@
+#include "Pattern.hpp"
+
+#include <cctype>
+#include <iostream>
+#include <limits>
+
+namespace harava
+{
+	// rough guess of how common a byte is in the memory of a typical process,
+	// zeroes and padding are everywhere and some opcodes are common in code
+	static u64 byte_frequency(const u8 byte)
+	{
+		switch (byte)
+		{
+			case 0x00:
+				return 1000;
+
+			case 0xFF:
+				return 200;
+
+			case 0x01:
+			case 0xCC:
+				return 50;
+
+			case 0x0F:
+			case 0x24:
+			case 0x48:
+			case 0x89:
+			case 0x8B:
+			case 0x8D:
+			case 0x90:
+			case 0xE8:
+				return 20;
+
+			default:
+				// text is common in the heap
+				return std::isprint(byte) ? 8 : 4;
+		}
+	}
+
+	static std::optional<u8> parse_nibble(const char c, u8& mask)
+	{
+		mask <<= 4;
+
+		if (c == '?')
+			return 0;
+
+		mask |= 0xF;
+
+		if (c >= '0' && c <= '9')
+			return c - '0';
+
+		if (c >= 'a' && c <= 'f')
+			return c - 'a' + 10;
+
+		if (c >= 'A' && c <= 'F')
+			return c - 'A' + 10;
+
+		return {};
+	}
+
+	std::optional<byte_pattern> byte_pattern::parse(const std::string& text)
+	{
+		// the spaces between the bytes are optional
+		std::string digits;
+		for (const char c : text)
+			if (!std::isspace(static_cast<unsigned char>(c)))
+				digits += c;
+
+		if (digits.empty() || digits.size() % 2 != 0)
+		{
+			std::cout << "the pattern should consist of whole bytes, like 48 8B ?? 00\n";
+			return {};
+		}
+
+		byte_pattern pattern;
+
+		for (u64 i = 0; i < digits.size(); i += 2)
+		{
+			u8 mask{0};
+			const std::optional<u8> high = parse_nibble(digits[i], mask);
+			const std::optional<u8> low = parse_nibble(digits[i + 1], mask);
+
+			if (!high.has_value() || !low.has_value())
+			{
+				std::cout << "invalid byte in the pattern: " << digits.substr(i, 2) << '\n';
+				return {};
+			}
+
+			pattern.values.push_back(high.value() << 4 | low.value());
+			pattern.masks.push_back(mask);
+		}
+
+		// pick the rarest pair of bytes that don't have wildcards, a
+		// pattern with only one such byte uses it for both of the anchors
+		u64 best_score = std::numeric_limits<u64>::max();
+
+		for (u64 first = 0; first < pattern.size(); ++first)
+		{
+			if (pattern.masks[first] != 0xFF)
+				continue;
+
+			for (u64 second = first; second < pattern.size(); ++second)
+			{
+				if (pattern.masks[second] != 0xFF)
+					continue;
+
+				// a pair beats the same byte on its own
+				const u64 score = second == first
+					? byte_frequency(pattern.values[first]) * 1000
+					: byte_frequency(pattern.values[first]) * byte_frequency(pattern.values[second]);
+
+				if (score < best_score)
+				{
+					best_score = score;
+					pattern.anchors[0] = first;
+					pattern.anchors[1] = second;
+				}
+			}
+		}
+
+		if (best_score == std::numeric_limits<u64>::max())
+		{
+			std::cout << "the pattern needs at least one byte without wildcards\n";
+			return {};
+		}
+
+		return pattern;
+	}
+
+	u64 byte_pattern::size() const
+	{
+		return values.size();
+	}
+
+	u64 byte_pattern::first_anchor() const
+	{
+		return anchors[0];
+	}
+
+	u64 byte_pattern::second_anchor() const
+	{
+		return anchors[1];
+	}
+
+	u8 byte_pattern::at(const u64 offset) const
+	{
+		return values[offset];
+	}
+
+	bool byte_pattern::matches(const u8* bytes) const
+	{
+		for (u64 i = 0; i < values.size(); ++i)
+			if ((bytes[i] & masks[i]) != values[i])
+				return false;
+
+		return true;
+	}
+}
@@ -0,0 +1,293 @@
+#include "PointerScan.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+namespace harava
+{
+	// the addresses of a level are looked up in blocks of this many per task
+	static constexpr u64 nodes_per_task = 4096;
+
+	// a pointer that points to at most max_offset bytes before an address of the previous level
+	struct pointer_candidate
+	{
+		u64 address;
+		u32 parent;		// index of the address on the previous level
+		u32 offset;
+	};
+
+	struct pointer_edge
+	{
+		u32 parent;
+		u32 offset;
+	};
+
+	// the unique addresses that lead to the target through the same amount of
+	// pointers, the edges of node i are edges[edge_start[i]] .. edges[edge_start[i + 1] - 1]
+	struct pointer_level
+	{
+		std::vector<u64> addresses;
+		std::vector<u64> edge_start;
+		std::vector<pointer_edge> edges;
+
+		// static pointers end the chains, so they aren't followed any further
+		std::vector<u32> module_of;
+	};
+
+	static constexpr u32 no_module = 0xFFFFFFFF;
+
+	static u32 find_module(const std::vector<pointer_module>& modules, const u64 address)
+	{
+		auto it = std::upper_bound(modules.begin(), modules.end(), address, [](const u64 address, const pointer_module& module)
+		{
+			return address < module.start;
+		});
+
+		if (it == modules.begin() || address >= (--it)->end)
+			return no_module;
+
+		return it - modules.begin();
+	}
+
+	pointer_chains find_pointer_chains(thread_pool& pool, std::span<const pointer_entry> index,
+			const std::vector<pointer_module>& modules, const pointer_search& search)
+	{
+		pointer_chains found;
+		for (const pointer_module& module : modules)
+			found.modules.push_back(module.name);
+
+		// a static target doesn't need any pointers
+		if (const u32 module = find_module(modules, search.target); module != no_module)
+		{
+			found.chains.push_back({ module, search.target - modules[module].base });
+			return found;
+		}
+
+		std::vector<pointer_level> levels(1);
+		levels[0].addresses = { search.target };
+		levels[0].edge_start = { 0, 0 };
+		levels[0].module_of = { no_module };
+
+		// the addresses that have been followed already, reaching one of them again
+		// would only lead to the same addresses through a longer way
+		std::vector<u64> visited = { search.target };
+		const u64 max_candidates = std::max<u64>(search.memory_budget / sizeof(pointer_candidate), 1);
+
+		// the level and the node of each static pointer in the order that they were found
+		std::vector<std::pair<u8, u32>> roots;
+
+		for (u8 depth = 1; depth <= search.max_depth; ++depth)
+		{
+			const pointer_level& previous = levels.back();
+			const u64 task_count = (previous.addresses.size() + nodes_per_task - 1) / nodes_per_task;
+
+			std::vector<std::vector<pointer_candidate>> task_candidates(task_count);
+			std::atomic<u64> candidate_count{0};
+			std::atomic<bool> cut_short{false};
+
+			parallel_for(pool, task_count, [&](const u64 task_index)
+			{
+				std::vector<pointer_candidate>& candidates = task_candidates[task_index];
+				const u64 last = std::min<u64>(previous.addresses.size(), (task_index + 1) * nodes_per_task);
+
+				for (u64 node = task_index * nodes_per_task; node < last; ++node)
+				{
+					if (previous.module_of[node] != no_module)
+						continue;
+
+					const u64 address = previous.addresses[node];
+					const u64 lowest = address - std::min<u64>(address, search.max_offset);
+					const u64 size_before = candidates.size();
+
+					auto it = std::lower_bound(index.begin(), index.end(), lowest, [](const pointer_entry& entry, const u64 value)
+					{
+						return entry.value < value;
+					});
+
+					for (; it != index.end() && it->value <= address; ++it)
+						candidates.push_back({ it->address, static_cast<u32>(node), static_cast<u32>(address - it->value) });
+
+					if (candidate_count.fetch_add(candidates.size() - size_before) > max_candidates) [[unlikely]]
+					{
+						cut_short = true;
+						return;
+					}
+				}
+			});
+
+			if (cut_short)
+				std::cout << "the memory budget was reached on level " << static_cast<u32>(depth) << ", some of the chains were left out\n";
+
+			std::vector<pointer_candidate> candidates;
+			candidates.reserve(candidate_count);
+			for (std::vector<pointer_candidate>& part : task_candidates)
+			{
+				candidates.insert(candidates.end(), part.begin(), part.end());
+				part = std::vector<pointer_candidate>();
+			}
+
+			parallel_sort(pool, candidates, [](const pointer_candidate& a, const pointer_candidate& b)
+			{
+				return a.address < b.address || (a.address == b.address && a.parent < b.parent);
+			});
+
+			// the same pointer can lead to multiple addresses of the previous level
+			pointer_level level;
+			for (const pointer_candidate& candidate : candidates)
+			{
+				if (level.addresses.empty() || level.addresses.back() != candidate.address)
+				{
+					if (std::binary_search(visited.begin(), visited.end(), candidate.address))
+						continue;
+
+					level.addresses.push_back(candidate.address);
+					level.edge_start.push_back(level.edges.size());
+					level.module_of.push_back(find_module(modules, candidate.address));
+
+					if (level.module_of.back() != no_module)
+						roots.emplace_back(depth, level.addresses.size() - 1);
+				}
+
+				level.edges.push_back({ candidate.parent, candidate.offset });
+			}
+			level.edge_start.push_back(level.edges.size());
+
+			const u64 static_count = std::count_if(level.module_of.begin(), level.module_of.end(), [](const u32 module) { return module != no_module; });
+			std::cout << "level " << static_cast<u32>(depth) << ": " << level.addresses.size() << " addresses, " << static_count << " of them static\n";
+
+			if (level.addresses.size() == static_count)
+			{
+				levels.push_back(std::move(level));
+				break;
+			}
+
+			// the static pointers aren't followed, so they can end chains on the later levels too
+			std::vector<u64> followed;
+			followed.reserve(level.addresses.size() - static_count);
+			for (u64 node = 0; node < level.addresses.size(); ++node)
+				if (level.module_of[node] == no_module)
+					followed.push_back(level.addresses[node]);
+
+			std::vector<u64> merged(visited.size() + followed.size());
+			std::merge(visited.begin(), visited.end(), followed.begin(), followed.end(), merged.begin());
+			visited.swap(merged);
+
+			levels.push_back(std::move(level));
+		}
+
+		// every path from a static pointer through the edges down to the target is a chain
+		for (const auto& [depth, node] : roots)
+		{
+			pointer_chain chain{ levels[depth].module_of[node], levels[depth].addresses[node] - modules[levels[depth].module_of[node]].base, depth };
+
+			const auto walk = [&](const auto& walk, const u8 level, const u32 node) -> void
+			{
+				if (level == 0)
+				{
+					found.chains.push_back(chain);
+					return;
+				}
+
+				const pointer_level& current = levels[level];
+				for (u64 edge = current.edge_start[node]; edge < current.edge_start[node + 1] && found.chains.size() < search.max_chains; ++edge)
+				{
+					chain.offsets[depth - level] = current.edges[edge].offset;
+					walk(walk, level - 1, current.edges[edge].parent);
+				}
+			};
+
+			walk(walk, depth, node);
+
+			if (found.chains.size() >= search.max_chains)
+			{
+				std::cout << "stopped at " << search.max_chains << " chains\n";
+				break;
+			}
+		}
+
+		return found;
+	}
+
+	std::string pointer_chains::format(const pointer_chain& chain) const
+	{
+		std::ostringstream stream;
+		stream << std::hex << modules.at(chain.module) << '+' << chain.base_offset;
+
+		for (u8 i = 0; i < chain.depth; ++i)
+			stream << " -> " << chain.offsets[i];
+
+		return stream.str();
+	}
+
+	bool pointer_chains::write(const std::string& path) const
+	{
+		std::ofstream file(path, std::ios::trunc);
+		if (!file.is_open()) [[unlikely]]
+		{
+			std::cout << "can't open " << path << '\n';
+			return false;
+		}
+
+		for (const pointer_chain& chain : chains)
+			file << format(chain) << '\n';
+
+		return file.good();
+	}
+
+	std::optional<pointer_chains> pointer_chains::read(const std::string& path)
+	{
+		std::ifstream file(path);
+		if (!file.is_open()) [[unlikely]]
+		{
+			std::cout << "can't open " << path << '\n';
+			return std::nullopt;
+		}
+
+		pointer_chains loaded;
+		std::map<std::string, u32> module_indices;
+
+		std::string line;
+		for (u64 line_number = 1; std::getline(file, line); ++line_number)
+		{
+			if (line.empty())
+				continue;
+
+			try
+			{
+				// the module name can contain anything, so the base offset starts after the last +
+				const size_t arrow = line.find(" -> ");
+				const std::string base = line.substr(0, arrow);
+				const size_t plus = base.rfind('+');
+				if (plus == std::string::npos || plus == 0)
+					throw std::invalid_argument("no module");
+
+				const auto [it, inserted] = module_indices.try_emplace(base.substr(0, plus), loaded.modules.size());
+				if (inserted)
+					loaded.modules.push_back(it->first);
+
+				pointer_chain chain{ it->second, std::stoull(base.substr(plus + 1), nullptr, 16) };
+
+				for (size_t offset = arrow; offset != std::string::npos; offset = line.find(" -> ", offset + 4))
+				{
+					if (chain.depth == pointer_chain::max_depth)
+						throw std::invalid_argument("too deep");
+
+					chain.offsets[chain.depth++] = std::stoul(line.substr(offset + 4), nullptr, 16);
+				}
+
+				loaded.chains.push_back(chain);
+			}
+			catch (const std::exception& e)
+			{
+				std::cout << path << ":" << line_number << " isn't a pointer chain: " << line << '\n';
+				return std::nullopt;
+			}
+		}
+
+		return loaded;
+	}
+}
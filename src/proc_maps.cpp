@@ -0,0 +1,130 @@
+#include "ProcMaps.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace harava
+{
+	// the maps of a process with tens of thousands of mappings are a few megabytes
+	static constexpr u64 read_size = 1024 * 1024;
+
+	// added by the kernel after the paths of the files that have been removed
+	static constexpr std::string_view deleted_suffix = " (deleted)";
+
+	// read a hex number starting from pos, returns false if there aren't any hex digits
+	static bool parse_hex(const std::string_view text, size_t& pos, u64& value)
+	{
+		const size_t first = pos;
+		value = 0;
+
+		for (; pos < text.size(); ++pos)
+		{
+			const char c = text[pos];
+			u8 digit;
+
+			if (c >= '0' && c <= '9')
+				digit = c - '0';
+			else if (c >= 'a' && c <= 'f')
+				digit = c - 'a' + 10;
+			else
+				break;
+
+			value = (value << 4) | digit;
+		}
+
+		return pos != first;
+	}
+
+	// move pos past the field that it points to and the spaces after it
+	static void skip_field(const std::string_view text, size_t& pos)
+	{
+		while (pos < text.size() && text[pos] != ' ')
+			++pos;
+
+		while (pos < text.size() && text[pos] == ' ')
+			++pos;
+	}
+
+	// start-end perms offset dev inode path, where the path is optional
+	static bool parse_line(const std::string_view line, mapping& mapping)
+	{
+		size_t pos{0};
+
+		if (!parse_hex(line, pos, mapping.start) || pos >= line.size() || line[pos++] != '-')
+			return false;
+
+		if (!parse_hex(line, pos, mapping.end) || pos + 5 > line.size() || line[pos] != ' ')
+			return false;
+
+		const std::string_view perms = line.substr(pos + 1, 4);
+		mapping.readable = perms[0] == 'r';
+		mapping.writable = perms[1] == 'w';
+		mapping.shared = perms[3] == 's';
+
+		pos += 1;
+		skip_field(line, pos);	// perms
+		skip_field(line, pos);	// offset
+		skip_field(line, pos);	// dev
+		skip_field(line, pos);	// inode
+
+		std::string_view path = line.substr(pos);
+		mapping.deleted = path.ends_with(deleted_suffix);
+		if (mapping.deleted)
+			path.remove_suffix(deleted_suffix.size());
+
+		mapping.path.assign(path);
+		return true;
+	}
+
+	std::vector<mapping> parse_maps(const std::string_view text)
+	{
+		std::vector<mapping> mappings;
+
+		for (size_t line_start = 0; line_start < text.size();)
+		{
+			size_t line_end = text.find('\n', line_start);
+			if (line_end == std::string_view::npos)
+				line_end = text.size();
+
+			mapping mapping;
+			if (parse_line(text.substr(line_start, line_end - line_start), mapping)) [[likely]]
+				mappings.push_back(std::move(mapping));
+
+			line_start = line_end + 1;
+		}
+
+		return mappings;
+	}
+
+	std::optional<std::vector<mapping>> read_maps(const std::string& path)
+	{
+		const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd == -1) [[unlikely]]
+			return std::nullopt;
+
+		// the kernel generates the file as it gets read, so its size isn't known beforehand
+		std::string text;
+		u64 size{0};
+		while (true)
+		{
+			text.resize(size + read_size);
+
+			const ssize_t bytes_read = read(fd, text.data() + size, read_size);
+			if (bytes_read < 0) [[unlikely]]
+			{
+				close(fd);
+				return std::nullopt;
+			}
+
+			if (bytes_read == 0)
+				break;
+
+			size += bytes_read;
+		}
+
+		close(fd);
+		text.resize(size);
+
+		return parse_maps(text);
+	}
+}
@@ -0,0 +1,212 @@
+#include "Query.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+namespace harava
+{
+	static std::optional<comparison> parse_comparison(const std::string& token)
+	{
+		if (token == "=")
+			return comparison::eq;
+
+		if (token == "<")
+			return comparison::lt;
+
+		if (token == ">")
+			return comparison::gt;
+
+		if (token == "<=")
+			return comparison::le;
+
+		if (token == ">=")
+			return comparison::ge;
+
+		return {};
+	}
+
+	std::optional<query> query::parse(const std::string& text)
+	{
+		std::vector<std::string> tokens;
+		std::istringstream stream(text);
+		for (std::string token; stream >> token;)
+			tokens.push_back(token);
+
+		query new_query;
+		clause current_clause;
+		u64 i{0};
+
+		const auto next = [&]() -> std::optional<std::string>
+		{
+			if (i >= tokens.size())
+				return {};
+
+			return tokens[i++];
+		};
+
+		while (true)
+		{
+			std::optional<std::string> token = next();
+			if (!token.has_value())
+			{
+				std::cout << "incomplete query\n";
+				return {};
+			}
+
+			// a type name limits the term to a single type
+			type_mask types = all_types;
+			const auto type_name = std::find(datatype_names.begin(), datatype_names.end(), token.value());
+			if (type_name != datatype_names.end())
+			{
+				types = 1 << (type_name - datatype_names.begin());
+				token = next();
+
+				if (!token.has_value())
+				{
+					std::cout << "incomplete query\n";
+					return {};
+				}
+			}
+
+			if (token.value() == "between")
+			{
+				const std::optional<std::string> low = next();
+				const std::optional<std::string> high = next();
+				if (!low.has_value() || !high.has_value())
+				{
+					std::cout << "between needs two values\n";
+					return {};
+				}
+
+				const type_bundle low_value(low.value());
+				const type_bundle high_value(high.value());
+				if (!low_value.valid || !high_value.valid)
+					return {};
+
+				current_clause.push_back({ comparison::ge, low_value, types });
+				current_clause.push_back({ comparison::le, high_value, types });
+			}
+			else
+			{
+				const std::optional<comparison> op = parse_comparison(token.value());
+				if (!op.has_value())
+				{
+					std::cout << "expected a comparison instead of " << token.value() << '\n';
+					return {};
+				}
+
+				const std::optional<std::string> value = next();
+				if (!value.has_value())
+				{
+					std::cout << "missing a value after " << token.value() << '\n';
+					return {};
+				}
+
+				const type_bundle term_value(value.value());
+				if (!term_value.valid)
+					return {};
+
+				current_clause.push_back({ op.value(), term_value, types });
+			}
+
+			const std::optional<std::string> joiner = next();
+			if (!joiner.has_value())
+				break;
+
+			if (joiner.value() == "or")
+			{
+				new_query.clauses_list.push_back(std::move(current_clause));
+				current_clause.clear();
+				continue;
+			}
+
+			if (joiner.value() != "and")
+			{
+				std::cout << "expected 'and' or 'or' instead of " << joiner.value() << '\n';
+				return {};
+			}
+		}
+
+		new_query.clauses_list.push_back(std::move(current_clause));
+		return new_query;
+	}
+
+	query query::single(const type_bundle& value, const comparison op)
+	{
+		query new_query;
+		new_query.clauses_list.push_back({ { op, value, all_types } });
+		return new_query;
+	}
+
+	const std::vector<query::clause>& query::clauses() const
+	{
+		return clauses_list;
+	}
+
+	const query_term* query::single_term() const
+	{
+		if (clauses_list.size() != 1 || clauses_list.front().size() != 1 || clauses_list.front().front().types != all_types)
+			return nullptr;
+
+		return &clauses_list.front().front();
+	}
+
+	bool query::applies_to(const clause& clause, const u8 type_index)
+	{
+		return std::all_of(clause.begin(), clause.end(), [type_index](const query_term& term) { return term.types & (1 << type_index); });
+	}
+
+	std::optional<std::array<type_union, 4>> query::known_values() const
+	{
+		std::array<type_union, 4> values{};
+
+		for (u8 i = 0; i < datatypes.size(); ++i)
+		{
+			bool known{false};
+
+			for (const clause& clause : clauses_list)
+			{
+				if (!applies_to(clause, i))
+					continue;
+
+				// every clause that can match the type needs an equality term
+				const auto term = std::find_if(clause.begin(), clause.end(), [](const query_term& term) { return term.op == comparison::eq; });
+				if (term == clause.end())
+					return {};
+
+				type_union value{};
+				switch (i)
+				{
+					case 0:
+						value._int = term->value_as<i32>();
+						break;
+
+					case 1:
+						value._long = term->value_as<i64>();
+						break;
+
+					case 2:
+						value._float = term->value_as<f32>();
+						break;
+
+					case 3:
+						value._double = term->value_as<f64>();
+						break;
+				}
+
+				// zero also matches negative zero
+				if ((i == 2 && value._float == 0) || (i == 3 && value._double == 0))
+					return {};
+
+				if (known && memcmp(value.bytes, values[i].bytes, sizeof(value.bytes)) != 0)
+					return {};
+
+				values[i] = value;
+				known = true;
+			}
+		}
+
+		return values;
+	}
+}
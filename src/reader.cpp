@@ -0,0 +1,239 @@
+#include "Reader.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+namespace harava
+{
+	// the kernel won't transfer more than roughly 2GB in a single call,
+	// so stay well below that
+	static constexpr size_t max_transfer_size = 1UL << 30;
+
+	static size_t page_size()
+	{
+		static const size_t size = sysconf(_SC_PAGESIZE);
+		return size;
+	}
+
+	static u64 nanoseconds_since(const std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	size_t reader::read(const size_t address, u8* destination, const size_t size)
+	{
+		const read_span span{ address, size, destination };
+		return read(std::span<const read_span>(&span, 1));
+	}
+
+	reader_stats reader::stats() const
+	{
+		return {
+			bytes_read.load(std::memory_order_relaxed),
+			syscall_count.load(std::memory_order_relaxed),
+			read_nanoseconds.load(std::memory_order_relaxed)
+		};
+	}
+
+	void reader::reset_stats()
+	{
+		bytes_read = 0;
+		syscall_count = 0;
+		read_nanoseconds = 0;
+	}
+
+	void reader::record(const u64 bytes, const u64 syscalls, const u64 nanoseconds)
+	{
+		bytes_read.fetch_add(bytes, std::memory_order_relaxed);
+		syscall_count.fetch_add(syscalls, std::memory_order_relaxed);
+		read_nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+	}
+
+	vm_reader::vm_reader(const i32 pid)
+	:pid(pid)
+	{}
+
+	size_t vm_reader::read(std::span<const read_span> spans)
+	{
+		const auto start = std::chrono::steady_clock::now();
+
+		std::vector<iovec> local, remote;
+		local.reserve(std::min<size_t>(spans.size(), IOV_MAX));
+		remote.reserve(std::min<size_t>(spans.size(), IOV_MAX));
+
+		size_t total_read{0};
+		u64 syscalls{0};
+
+		// read a single range page by page, zeroing out the pages that can't be read
+		const auto read_pagewise = [&](u8* destination, size_t address, size_t size)
+		{
+			while (size > 0)
+			{
+				const size_t chunk = std::min(size, page_size() - (address % page_size()));
+				iovec l{ destination, chunk };
+				iovec r{ reinterpret_cast<void*>(address), chunk };
+
+				const ssize_t bytes = process_vm_readv(pid, &l, 1, &r, 1, 0);
+				++syscalls;
+
+				if (bytes > 0)
+					total_read += bytes;
+
+				if (bytes < static_cast<ssize_t>(chunk)) [[unlikely]]
+					memset(destination + std::max<ssize_t>(bytes, 0), 0, chunk - std::max<ssize_t>(bytes, 0));
+
+				destination += chunk;
+				address += chunk;
+				size -= chunk;
+			}
+		};
+
+		const auto flush = [&]()
+		{
+			size_t first = 0;
+			while (first < local.size())
+			{
+				size_t batch_size{0};
+				for (size_t i = first; i < local.size(); ++i)
+					batch_size += local[i].iov_len;
+
+				const ssize_t bytes = process_vm_readv(pid, &local[first], local.size() - first, &remote[first], remote.size() - first, 0);
+				++syscalls;
+
+				if (bytes == static_cast<ssize_t>(batch_size)) [[likely]]
+				{
+					total_read += bytes;
+					break;
+				}
+
+				// the read stopped at an unreadable element, figure out
+				// where that happened and continue from the next element
+				size_t consumed = std::max<ssize_t>(bytes, 0);
+				total_read += consumed;
+
+				while (consumed >= local[first].iov_len)
+				{
+					consumed -= local[first].iov_len;
+					++first;
+				}
+
+				u8* destination = static_cast<u8*>(local[first].iov_base) + consumed;
+				const size_t address = reinterpret_cast<size_t>(remote[first].iov_base) + consumed;
+				read_pagewise(destination, address, local[first].iov_len - consumed);
+				++first;
+			}
+
+			local.clear();
+			remote.clear();
+		};
+
+		size_t batch_bytes{0};
+		for (const read_span& span : spans)
+		{
+			for (size_t offset = 0; offset < span.size; )
+			{
+				const size_t size = std::min(span.size - offset, max_transfer_size - batch_bytes);
+
+				local.push_back({ span.destination + offset, size });
+				remote.push_back({ reinterpret_cast<void*>(span.address + offset), size });
+				batch_bytes += size;
+				offset += size;
+
+				if (local.size() == IOV_MAX || batch_bytes == max_transfer_size)
+				{
+					flush();
+					batch_bytes = 0;
+				}
+			}
+		}
+		flush();
+
+		record(total_read, syscalls, nanoseconds_since(start));
+		return total_read;
+	}
+
+	std::string vm_reader::name() const
+	{
+		return "process_vm_readv";
+	}
+
+	pread_reader::pread_reader(const i32 pid)
+	:mem_path("/proc/" + std::to_string(pid) + "/mem")
+	{
+		fd = open(mem_path.c_str(), O_RDONLY);
+		if (fd == -1) [[unlikely]]
+		{
+			std::cout << "can't open " << mem_path << '\n';
+			exit(1);
+		}
+	}
+
+	pread_reader::~pread_reader()
+	{
+		if (fd != -1)
+			close(fd);
+	}
+
+	size_t pread_reader::read(std::span<const read_span> spans)
+	{
+		const auto start = std::chrono::steady_clock::now();
+
+		size_t total_read{0};
+		u64 syscalls{0};
+
+		for (const read_span& span : spans)
+		{
+			size_t offset{0};
+			while (offset < span.size)
+			{
+				const size_t size = std::min(span.size - offset, max_transfer_size);
+				const ssize_t bytes = pread(fd, span.destination + offset, size, span.address + offset);
+				++syscalls;
+
+				if (bytes > 0) [[likely]]
+				{
+					total_read += bytes;
+					offset += bytes;
+					continue;
+				}
+
+				// skip over the unreadable page
+				const size_t address = span.address + offset;
+				const size_t skip = std::min(span.size - offset, page_size() - (address % page_size()));
+				memset(span.destination + offset, 0, skip);
+				offset += skip;
+			}
+		}
+
+		record(total_read, syscalls, nanoseconds_since(start));
+		return total_read;
+	}
+
+	std::string pread_reader::name() const
+	{
+		return "pread";
+	}
+
+	std::unique_ptr<reader> make_reader(const i32 pid, const read_backend backend)
+	{
+		switch (backend)
+		{
+			case read_backend::vm:
+				return std::make_unique<vm_reader>(pid);
+
+			case read_backend::pread:
+				return std::make_unique<pread_reader>(pid);
+		}
+
+		assert(false && "unhandled read backend");
+		return nullptr;
+	}
+}
@@ -0,0 +1,674 @@
+#include "Results.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+namespace harava
+{
+	static void encode_delta(column<u8>& stream, u32 value)
+	{
+		while (value >= 0x80)
+		{
+			stream.push_back(static_cast<u8>(value) | 0x80);
+			value >>= 7;
+		}
+
+		stream.push_back(static_cast<u8>(value));
+	}
+
+	// index of the nth set bit in a type mask
+	static u8 nth_type(type_mask mask, u64 n)
+	{
+		for (; n > 0; --n)
+			mask &= mask - 1;
+
+		return std::countr_zero(mask);
+	}
+
+	template<typename T>
+	static u64 vector_size(const std::vector<T>& vec)
+	{
+		return vec.capacity() * sizeof(T);
+	}
+
+	template<typename T>
+	static u64 vector_size(const column<T>& column)
+	{
+		return column.memory_size();
+	}
+
+	result_segment result_segment::from_bitmap(const u16 region_id, const u32 first_location, const u32 span,
+			std::array<std::vector<u64>, 4>&& planes, std::vector<u8>&& values)
+	{
+		result_segment segment;
+		segment.region_id = region_id;
+		segment.representation = segment_kind::bitmap;
+		segment.bitmap_first = first_location;
+		segment.bitmap_span = span;
+		const u64 words = segment.bitmap_words();
+
+		for (u8 i = 0; i < segment.planes.size(); ++i)
+		{
+			std::vector<u64>& plane = planes[i];
+			assert(plane.empty() || plane.size() == words);
+
+			if (std::any_of(plane.begin(), plane.end(), [](const u64 word) { return word != 0; }))
+			{
+				segment.planes[i] = std::move(plane);
+				segment.combined_types |= 1 << i;
+			}
+		}
+
+		for (u64 word = 0; word < words; word += bitmap_block_words)
+		{
+			const u64 block_results = segment.bitmap_result_count(word, std::min<u64>(bitmap_block_words, words - word));
+			const u64 block = word / bitmap_block_words;
+
+			while (segment.result_samples.size() * sample_interval < segment.results_total + block_results)
+				segment.result_samples.push_back({ block, segment.results_total });
+
+			segment.block_results_before.push_back(segment.results_total);
+			segment.results_total += block_results;
+		}
+
+		for (u64 word = 0; word < words; ++word)
+			segment.bitmap_entries += std::popcount(segment.combined_word(word));
+
+		assert(values.empty() || values.size() == static_cast<u64>(span) + 7);
+		segment.value_bytes = column<u8>(std::move(values));
+
+		return segment;
+	}
+
+	bool result_segment::prefer_bitmap(const u64 entries, const u64 span, const type_mask types, const bool store_values)
+	{
+		if (entries == 0)
+			return false;
+
+		const u64 gap = span / entries;
+		const u64 delta_size = gap < (1 << 7) ? 1 : gap < (1 << 14) ? 2 : 3;
+		const u64 value_size = store_values ? type_mask_size(types) : 0;
+
+		const u64 list_size = entries * (sizeof(type_mask) + delta_size + value_size)
+			+ (entries / checkpoint_interval) * sizeof(checkpoint);
+
+		const u64 bitmap_size = std::popcount(types) * span / 8
+			+ span / (bitmap_block_words * 64) * sizeof(u64)
+			+ (store_values ? span + 7 : 0);
+
+		return bitmap_size < list_size;
+	}
+
+	void result_segment::compact()
+	{
+		if (representation != segment_kind::bitmap || prefer_bitmap(bitmap_entries, bitmap_span, combined_types, has_values()))
+			return;
+
+		segment_builder builder(region_id, has_values(), combined_types & wide_types);
+
+		for_each_entry([&](const u64 entry, const u32 location, const type_mask mask)
+		{
+			builder.add(location, mask, value_bytes.empty() ? nullptr : &value_bytes[entry]);
+		});
+
+		*this = builder.finish();
+	}
+
+	segment_kind result_segment::kind() const
+	{
+		return representation;
+	}
+
+	u32 result_segment::first_location() const
+	{
+		return bitmap_first;
+	}
+
+	u32 result_segment::span() const
+	{
+		return bitmap_span;
+	}
+
+	std::span<const u64> result_segment::plane(const u8 type_index) const
+	{
+		return planes[type_index];
+	}
+
+	std::span<const u8> result_segment::values() const
+	{
+		return value_bytes;
+	}
+
+	bool result_segment::spill(const std::shared_ptr<spill_file>& file)
+	{
+		spill_storage = file;
+
+		bool success = location_deltas.spill(*file)
+			&& checkpoints.spill(*file)
+			&& type_masks.spill(*file)
+			&& result_samples.spill(*file)
+			&& value_low.spill(*file)
+			&& value_high.spill(*file)
+			&& value_bytes.spill(*file)
+			&& block_results_before.spill(*file);
+
+		for (column<u64>& plane : planes)
+			success = success && plane.spill(*file);
+
+		return success;
+	}
+
+	bool result_segment::spilled() const
+	{
+		return spill_storage != nullptr;
+	}
+
+	void result_segment::release() const
+	{
+		if (!spilled())
+			return;
+
+		location_deltas.release();
+		checkpoints.release();
+		type_masks.release();
+		result_samples.release();
+		value_low.release();
+		value_high.release();
+		value_bytes.release();
+		block_results_before.release();
+
+		for (const column<u64>& plane : planes)
+			plane.release();
+	}
+
+	u64 result_segment::bitmap_result_count(const u64 word, const u64 count) const
+	{
+		u64 total{0};
+
+		for (const column<u64>& plane : planes)
+		{
+			if (plane.empty())
+				continue;
+
+			for (u64 i = word; i < word + count; ++i)
+				total += std::popcount(plane[i]);
+		}
+
+		return total;
+	}
+
+	u64 result_segment::entry_count() const
+	{
+		return representation == segment_kind::bitmap
+			? bitmap_entries
+			: type_masks.size();
+	}
+
+	u64 result_segment::result_count() const
+	{
+		return results_total;
+	}
+
+	u64 result_segment::total_size() const
+	{
+		return sizeof(result_segment)
+			+ vector_size(location_deltas)
+			+ vector_size(checkpoints)
+			+ vector_size(type_masks)
+			+ vector_size(result_samples)
+			+ vector_size(value_low)
+			+ vector_size(value_high)
+			+ vector_size(planes[0])
+			+ vector_size(planes[1])
+			+ vector_size(planes[2])
+			+ vector_size(planes[3])
+			+ vector_size(value_bytes)
+			+ vector_size(block_results_before);
+	}
+
+	u32 result_segment::location(const u64 entry) const
+	{
+		if (representation == segment_kind::bitmap)
+			return bitmap_first + entry;
+
+		assert(entry < type_masks.size());
+
+		const checkpoint& cp = checkpoints[entry / checkpoint_interval];
+		u64 offset = cp.delta_offset;
+		u32 location = cp.location;
+
+		for (u64 i = entry - entry % checkpoint_interval; i <= entry; ++i)
+			location += decode_delta(offset);
+
+		return location;
+	}
+
+	type_mask result_segment::mask(const u64 entry) const
+	{
+		if (representation == segment_kind::list)
+			return type_masks[entry];
+
+		type_mask mask{0};
+		for (u8 i = 0; i < planes.size(); ++i)
+			if (!planes[i].empty() && (planes[i][entry / 64] >> (entry % 64)) & 1)
+				mask |= 1 << i;
+
+		return mask;
+	}
+
+	type_mask result_segment::types() const
+	{
+		return combined_types;
+	}
+
+	bool result_segment::has_values() const
+	{
+		return representation == segment_kind::bitmap
+			? !value_bytes.empty()
+			: !value_low.empty();
+	}
+
+	bool result_segment::has_wide_values() const
+	{
+		return representation == segment_kind::bitmap
+			? !value_bytes.empty()
+			: !value_high.empty();
+	}
+
+	u64 result_segment::value_bits(const u64 entry) const
+	{
+		if (representation == segment_kind::bitmap)
+		{
+			u64 bits;
+			memcpy(&bits, &value_bytes[entry], sizeof(bits));
+			return bits;
+		}
+
+		const u64 high = value_high.empty() ? 0 : value_high[entry];
+		return value_low[entry] | (high << 32);
+	}
+
+	std::pair<u64, u8> result_segment::find_result(const u64 n) const
+	{
+		assert(n < results_total);
+
+		if (representation == segment_kind::bitmap)
+		{
+			// bitmaps are only used for dense results, so there
+			// are only a few blocks between the samples
+			const result_sample& sample = result_samples[n / sample_interval];
+			u64 block = sample.entry;
+			while (block + 1 < block_results_before.size() && block_results_before[block + 1] <= n)
+				++block;
+
+			u64 results_before = block_results_before[block];
+			for (u64 word = block * bitmap_block_words; word < bitmap_words(); ++word)
+			{
+				const u64 word_results = bitmap_result_count(word, 1);
+				if (results_before + word_results <= n)
+				{
+					results_before += word_results;
+					continue;
+				}
+
+				for (u64 bits = combined_word(word); bits != 0; bits &= bits - 1)
+				{
+					const u64 entry = word * 64 + __builtin_ctzll(bits);
+					const type_mask entry_mask = mask(entry);
+
+					if (results_before + std::popcount(entry_mask) > n)
+						return { entry, nth_type(entry_mask, n - results_before) };
+
+					results_before += std::popcount(entry_mask);
+				}
+			}
+
+			assert(false && "result not found from the bitmap");
+			__builtin_unreachable();
+		}
+
+		const result_sample& sample = result_samples[n / sample_interval];
+		u64 entry = sample.entry;
+		u64 results_before = sample.results_before;
+
+		// every entry has at least one result, so this won't
+		// take more than sample_interval steps
+		while (results_before + std::popcount(type_masks[entry]) <= n)
+		{
+			results_before += std::popcount(type_masks[entry]);
+			++entry;
+		}
+
+		return { entry, nth_type(type_masks[entry], n - results_before) };
+	}
+
+	segment_builder::segment_builder(const u16 region_id, const bool store_values, const bool wide_values)
+	:store_values(store_values), wide_values(wide_values)
+	{
+		segment.region_id = region_id;
+	}
+
+	void segment_builder::add(const u32 location, const type_mask mask, const u8* value)
+	{
+		assert(mask != 0);
+		assert(segment.type_masks.empty() || location > previous_location);
+
+		const u64 entry = segment.type_masks.size();
+
+		if (entry % result_segment::checkpoint_interval == 0)
+			segment.checkpoints.push_back({ segment.location_deltas.size(), previous_location });
+
+		encode_delta(segment.location_deltas, location - previous_location);
+		previous_location = location;
+
+		const u64 mask_results = std::popcount(mask);
+		while (segment.result_samples.size() * result_segment::sample_interval < segment.results_total + mask_results)
+			segment.result_samples.push_back({ entry, segment.results_total });
+
+		segment.type_masks.push_back(mask);
+		segment.results_total += mask_results;
+		segment.combined_types |= mask;
+
+		if (!store_values)
+			return;
+
+		u32 low;
+		memcpy(&low, value, sizeof(low));
+		segment.value_low.push_back(low);
+
+		if (wide_values)
+		{
+			u32 high{0};
+			if (mask & wide_types)
+				memcpy(&high, value + sizeof(low), sizeof(high));
+			segment.value_high.push_back(high);
+		}
+	}
+
+	u64 segment_builder::entry_count() const
+	{
+		return segment.type_masks.size();
+	}
+
+	result_segment segment_builder::finish()
+	{
+		segment.location_deltas.shrink_to_fit();
+		segment.checkpoints.shrink_to_fit();
+		segment.type_masks.shrink_to_fit();
+		segment.result_samples.shrink_to_fit();
+		segment.value_low.shrink_to_fit();
+		segment.value_high.shrink_to_fit();
+		return std::move(segment);
+	}
+
+	u64 results::total_size() const
+	{
+		u64 size = vector_size(segment_first_result) + vector_size(segment_samples);
+
+		for (const result_segment& segment : segment_list)
+			size += segment.total_size();
+
+		return size;
+	}
+
+	u64 results::count() const
+	{
+		return total_results;
+	}
+
+	std::optional<result> results::at(const u64 index) const
+	{
+		if (index >= count()) [[unlikely]]
+		{
+			std::cout << "out-of-bounds index\n";
+			return {};
+		}
+
+		// every segment has at least one result, so this won't
+		// take more than sample_interval steps
+		u64 segment_index = segment_samples[index / sample_interval];
+		while (segment_index + 1 < segment_list.size() && segment_first_result[segment_index + 1] <= index)
+			++segment_index;
+
+		const result_segment& segment = segment_list[segment_index];
+		const auto [entry, type_index] = segment.find_result(index - segment_first_result[segment_index]);
+
+		return result{ value(segment, entry, type_index), segment.location(entry), segment.region_id, datatypes[type_index] };
+	}
+
+	void results::clear()
+	{
+		segment_list.clear();
+		segment_first_result.clear();
+		segment_samples.clear();
+		total_results = 0;
+		uniform_values.reset();
+		dirty_epoch = 0;
+		text_info.reset();
+	}
+
+	void results::add_segment(result_segment&& segment)
+	{
+		if (segment.result_count() == 0)
+			return;
+
+		assert(segment_list.empty() || segment_list.back().region_id <= segment.region_id);
+
+		const u64 segment_index = segment_list.size();
+
+		while (segment_samples.size() * sample_interval < total_results + segment.result_count())
+			segment_samples.push_back(segment_index);
+
+		segment_first_result.push_back(total_results);
+		total_results += segment.result_count();
+		segment_list.emplace_back(std::move(segment));
+	}
+
+	u64 results::move_regions(const std::vector<region_move>& moves)
+	{
+		std::vector<result_segment> old_segments = std::move(segment_list);
+		segment_list.clear();
+		segment_first_result.clear();
+		segment_samples.clear();
+
+		const u64 old_total = total_results;
+		total_results = 0;
+
+		std::vector<result_segment> moved;
+		for (result_segment& segment : old_segments)
+		{
+			// the values of the last entry go at most 8 bytes past its location
+			const u64 first_location = segment.location(0);
+			const u64 last_location = segment.location(segment.entry_range() - 1) + sizeof(u64);
+
+			auto move = first_move(moves, segment.region_id, first_location);
+
+			// most segments stay where they were, at most the id of their region changes
+			if (move != moves.end() && move->region_id == segment.region_id && move->first <= first_location && last_location <= move->last
+				&& move->new_first == move->first)
+			{
+				segment.region_id = move->new_region_id;
+				moved.emplace_back(std::move(segment));
+				continue;
+			}
+
+			for (; move != moves.end() && move->region_id == segment.region_id && move->first < last_location; ++move)
+			{
+				segment_builder builder(move->new_region_id, segment.has_values(), segment.has_wide_values());
+
+				// the types of an entry that don't fit in the move anymore are dropped from its mask
+				segment.for_each_entry([&](const u64 entry, const u32 location, const type_mask mask)
+				{
+					if (location < move->first || location + sizeof(u32) > move->last)
+						return;
+
+					const type_mask fitting = location + sizeof(u64) <= move->last ? mask : mask & ~wide_types;
+					if (fitting == 0)
+						return;
+
+					const u64 bits = segment.has_values() ? segment.value_bits(entry) : 0;
+					builder.add(location - move->first + move->new_first, fitting, reinterpret_cast<const u8*>(&bits));
+				});
+
+				if (builder.entry_count() != 0)
+					moved.emplace_back(builder.finish());
+			}
+		}
+
+		// the parts that moved to new regions go after the rest
+		std::stable_sort(moved.begin(), moved.end(), [](const result_segment& a, const result_segment& b) { return a.region_id < b.region_id; });
+
+		for (result_segment& segment : moved)
+			add_segment(std::move(segment));
+
+		return old_total - total_results;
+	}
+
+	const std::vector<result_segment>& results::segments() const
+	{
+		return segment_list;
+	}
+
+	void results::set_uniform_values(const std::array<type_union, 4>& values)
+	{
+		uniform_values = values;
+	}
+
+	const std::optional<std::array<type_union, 4>>& results::uniform() const
+	{
+		return uniform_values;
+	}
+
+	void results::set_soft_dirty_epoch(const u64 epoch)
+	{
+		dirty_epoch = epoch;
+	}
+
+	u64 results::soft_dirty_epoch() const
+	{
+		return dirty_epoch;
+	}
+
+	void results::set_text(const text_match& text)
+	{
+		text_info = text;
+	}
+
+	const std::optional<results::text_match>& results::text() const
+	{
+		return text_info;
+	}
+
+	type_union results::value(const result_segment& segment, const u64 entry, const u8 type_index) const
+	{
+		if (uniform_values.has_value())
+			return uniform_values->at(type_index);
+
+		type_union value;
+		value._long = segment.value_bits(entry);
+
+		// clear out the bytes that don't belong to the type
+		if (type_size(datatypes[type_index]) == 4)
+			value._long &= 0xFFFFFFFF;
+
+		return value;
+	}
+
+	void results::update_value(const u64 index, const type_union new_value)
+	{
+		if (index >= count()) [[unlikely]]
+			return;
+
+		if (uniform_values.has_value())
+			materialize_values();
+
+		u64 segment_index = segment_samples[index / sample_interval];
+		while (segment_index + 1 < segment_list.size() && segment_first_result[segment_index + 1] <= index)
+			++segment_index;
+
+		result_segment& segment = segment_list[segment_index];
+		const auto [entry, type_index] = segment.find_result(index - segment_first_result[segment_index]);
+		write_value(segment, entry, type_index, new_value);
+	}
+
+	void results::update_all_values(const std::array<type_union, 4>& new_values)
+	{
+		if (uniform_values.has_value())
+			materialize_values();
+
+		for (result_segment& segment : segment_list)
+		{
+			segment.for_each_entry([&](const u64 entry, const u32, const type_mask mask)
+			{
+				for (u8 i = 0; i < datatypes.size(); ++i)
+					if (mask & (1 << i))
+						write_value(segment, entry, i, new_values[i]);
+			});
+		}
+	}
+
+	void results::write_value(result_segment& segment, const u64 entry, const u8 type_index, const type_union new_value)
+	{
+		if (segment.representation == segment_kind::bitmap)
+		{
+			memcpy(&segment.value_bytes[entry], new_value.bytes, type_size(datatypes[type_index]));
+			return;
+		}
+
+		memcpy(&segment.value_low[entry], new_value.bytes, sizeof(u32));
+
+		if (type_size(datatypes[type_index]) == 8)
+			memcpy(&segment.value_high[entry], new_value.bytes + sizeof(u32), sizeof(u32));
+	}
+
+	void results::materialize_values()
+	{
+		assert(uniform_values.has_value());
+
+		for (result_segment& segment : segment_list)
+		{
+			// all of the types at an address share the same bytes, so any
+			// of the matching types can be used to fill in the values
+			const auto value_of = [this](const type_mask mask)
+			{
+				type_union value = uniform_values->at(std::countr_zero(mask));
+
+				if (mask & wide_types)
+				{
+					const type_union& wide = uniform_values->at(std::countr_zero(static_cast<type_mask>(mask & wide_types)));
+					memcpy(value.bytes + sizeof(u32), wide.bytes + sizeof(u32), sizeof(u32));
+				}
+
+				return value;
+			};
+
+			if (segment.representation == segment_kind::bitmap)
+			{
+				segment.value_bytes.resize(segment.bitmap_span + 7);
+				segment.for_each_entry([&](const u64 entry, const u32, const type_mask mask)
+				{
+					memcpy(&segment.value_bytes[entry], value_of(mask).bytes, type_mask_size(mask));
+				});
+				continue;
+			}
+
+			segment.value_low.resize(segment.entry_count());
+			if (segment.combined_types & wide_types)
+				segment.value_high.resize(segment.entry_count());
+
+			segment.for_each_entry([&](const u64 entry, const u32, const type_mask mask)
+			{
+				const type_union value = value_of(mask);
+				memcpy(&segment.value_low[entry], value.bytes, sizeof(u32));
+
+				if (mask & wide_types)
+					memcpy(&segment.value_high[entry], value.bytes + sizeof(u32), sizeof(u32));
+			});
+		}
+
+		uniform_values.reset();
+	}
+}
@@ -0,0 +1,121 @@
+#include "Sampler.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+
+namespace harava
+{
+	// enough room for a couple of seconds of samples, the
+	// consumer is expected to drain the ring much more often
+	static constexpr u64 buffered_seconds = 2;
+	static constexpr u64 min_capacity = 64;
+
+	// with thousands of addresses at a high rate a couple of seconds would take
+	// gigabytes, so the ring holds fewer samples when they are large
+	static constexpr u64 max_ring_bytes = 64 * 1024 * 1024;
+
+	static u64 ring_capacity(const u32 rate, const u64 record_size)
+	{
+		const u64 wanted = std::bit_ceil(std::max<u64>(min_capacity, rate * buffered_seconds));
+		const u64 fits = std::bit_floor(std::max<u64>(min_capacity, max_ring_bytes / record_size));
+		return std::min(wanted, fits);
+	}
+
+	sampler::sampler(const i32 pid, const read_backend backend, const std::vector<u64>& addresses, const u32 rate)
+	:sample_reader(make_reader(pid, backend)), tick_rate(std::clamp<u32>(rate, 1, max_rate)),
+	 record_size(sizeof(u64) + addresses.size() * value_size),
+	 capacity(ring_capacity(tick_rate, record_size))
+	{
+		ring.resize(capacity * record_size);
+
+		spans.reserve(addresses.size());
+		for (const u64 address : addresses)
+			spans.push_back({ address, value_size, nullptr });
+
+		thread = std::thread(&sampler::run, this);
+	}
+
+	sampler::~sampler()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+
+		wake_up.notify_one();
+		thread.join();
+	}
+
+	u64 sampler::sample_size() const
+	{
+		return record_size;
+	}
+
+	bool sampler::pop(u8* destination)
+	{
+		const u64 current_tail = tail.load(std::memory_order_relaxed);
+		if (current_tail == head.load(std::memory_order_acquire))
+			return false;
+
+		memcpy(destination, &ring[(current_tail & (capacity - 1)) * record_size], record_size);
+		tail.store(current_tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	u64 sampler::dropped() const
+	{
+		return dropped_samples.load(std::memory_order_relaxed);
+	}
+
+	u32 sampler::rate() const
+	{
+		return tick_rate;
+	}
+
+	void sampler::run()
+	{
+		using clock = std::chrono::steady_clock;
+		const clock::duration period = std::chrono::duration_cast<clock::duration>(std::chrono::seconds(1)) / tick_rate;
+
+		const clock::time_point start = clock::now();
+		clock::time_point next_tick = start;
+
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake_up.wait_until(lock, next_tick, [this] { return stopping; });
+
+				if (stopping)
+					return;
+			}
+
+			const u64 current_head = head.load(std::memory_order_relaxed);
+			if (current_head - tail.load(std::memory_order_acquire) == capacity) [[unlikely]]
+			{
+				dropped_samples.fetch_add(1, std::memory_order_relaxed);
+			}
+			else
+			{
+				// the values are read straight into the free slot
+				u8* slot = &ring[(current_head & (capacity - 1)) * record_size];
+				for (u64 i = 0; i < spans.size(); ++i)
+					spans[i].destination = slot + sizeof(u64) + i * value_size;
+
+				const u64 nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+				memcpy(slot, &nanoseconds, sizeof(u64));
+				sample_reader->read(spans);
+
+				head.store(current_head + 1, std::memory_order_release);
+			}
+
+			// skip the missed ticks instead of sampling in bursts
+			next_tick += period;
+			const clock::time_point now = clock::now();
+			if (next_tick < now)
+				next_tick = now + period;
+		}
+	}
+}
@@ -0,0 +1,582 @@
+#include "ScanKernels.hpp"
+
+#include <array>
+#include <cstring>
+#include <immintrin.h>
+#include <optional>
+
+namespace harava
+{
+	static std::optional<simd_level> forced_level;
+
+	simd_level detect_simd_level()
+	{
+		if (forced_level.has_value()) [[unlikely]]
+			return forced_level.value();
+
+		static const simd_level level = []
+		{
+			__builtin_cpu_init();
+
+			if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("bmi2"))
+				return simd_level::avx512;
+
+			if (__builtin_cpu_supports("avx2"))
+				return simd_level::avx2;
+
+			return simd_level::scalar;
+		}();
+
+		return level;
+	}
+
+	void force_simd_level(const simd_level level)
+	{
+		forced_level = level;
+	}
+
+	const char* simd_level_name(const simd_level level)
+	{
+		switch (level)
+		{
+			case simd_level::scalar:
+				return "scalar";
+
+			case simd_level::avx2:
+				return "avx2";
+
+			case simd_level::avx512:
+				return "avx512";
+		}
+
+		return "unknown";
+	}
+
+	// lookup tables for spreading the lane masks of a single load
+	// out to the byte positions that the lanes started from
+	static constexpr std::array<u32, 256> stride4_table = []
+	{
+		std::array<u32, 256> table{};
+		for (u32 i = 0; i < table.size(); ++i)
+			for (u32 bit = 0; bit < 8; ++bit)
+				if (i & (1U << bit))
+					table[i] |= 1U << (bit * 4);
+		return table;
+	}();
+
+	static constexpr std::array<u32, 16> stride8_table = []
+	{
+		std::array<u32, 16> table{};
+		for (u32 i = 0; i < table.size(); ++i)
+			for (u32 bit = 0; bit < 4; ++bit)
+				if (i & (1U << bit))
+					table[i] |= 1U << (bit * 8);
+		return table;
+	}();
+
+	/////////////////
+	// scalar path //
+	/////////////////
+
+	template<typename T, comparison C, bool SkipZeroes>
+	__attribute__((always_inline))
+	static inline u64 block_mask_scalar(const u8* block_bytes, const T value)
+	{
+		u64 mask{0};
+
+		for (u8 i = 0; i < scan_block_size; ++i)
+		{
+			T mem_value;
+			memcpy(&mem_value, block_bytes + i, sizeof(T));
+
+			bool match = cmp(value, mem_value, C);
+			if constexpr (SkipZeroes)
+				match = match && mem_value != 0;
+
+			mask |= static_cast<u64>(match) << i;
+		}
+
+		return mask;
+	}
+
+	template<typename T, comparison C, bool SkipZeroes>
+	static void scan_blocks_scalar(const u8* bytes, const u64 blocks, const T value, u64* masks)
+	{
+		for (u64 block = 0; block < blocks; ++block)
+			masks[block] = block_mask_scalar<T, C, SkipZeroes>(bytes + block * scan_block_size, value);
+	}
+
+	template<comparison C, bool SkipZeroes>
+	static void scan_blocks_fused_scalar(const u8* bytes, const u64 blocks, const type_bundle& value, const filter filter,
+			const std::array<u64*, 4>& masks)
+	{
+		for (u64 block = 0; block < blocks; ++block)
+		{
+			const u8* block_bytes = bytes + block * scan_block_size;
+
+			if (filter.enable_i32)
+				masks[0][block] = block_mask_scalar<i32, C, SkipZeroes>(block_bytes, value._int);
+
+			if (filter.enable_i64)
+				masks[1][block] = block_mask_scalar<i64, C, SkipZeroes>(block_bytes, value._long);
+
+			if (filter.enable_f32)
+				masks[2][block] = block_mask_scalar<f32, C, SkipZeroes>(block_bytes, value._float);
+
+			if (filter.enable_f64)
+				masks[3][block] = block_mask_scalar<f64, C, SkipZeroes>(block_bytes, value._double);
+		}
+	}
+
+	static void diff_blocks_scalar(const u8* a, const u8* b, const u64 blocks, u64* masks)
+	{
+		for (u64 block = 0; block < blocks; ++block)
+		{
+			u64 mask{0};
+			for (u8 i = 0; i < scan_block_size; ++i)
+				mask |= static_cast<u64>(a[block * scan_block_size + i] != b[block * scan_block_size + i]) << i;
+
+			masks[block] = mask;
+		}
+	}
+
+	static void anchor_blocks_scalar(const u8* first, const u8* second, const u8 first_value, const u8 second_value,
+			const u8 first_fold, const u8 second_fold, const u64 blocks, u64* masks)
+	{
+		for (u64 block = 0; block < blocks; ++block)
+		{
+			u64 mask{0};
+			for (u8 i = 0; i < scan_block_size; ++i)
+			{
+				const u64 position = block * scan_block_size + i;
+				mask |= static_cast<u64>((first[position] | first_fold) == first_value && (second[position] | second_fold) == second_value) << i;
+			}
+
+			masks[block] = mask;
+		}
+	}
+
+	///////////////
+	// avx2 path //
+	///////////////
+
+	// returns a bit for each lane of a 256-bit load from the given address
+	template<typename T, comparison C, bool SkipZeroes>
+	__attribute__((target("avx2"), always_inline))
+	static inline u32 lane_mask_avx2(const u8* bytes, const __m256i value)
+	{
+		const __m256i mem = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes));
+		__m256i match;
+		__m256i zero;
+
+		if constexpr (std::is_same_v<T, i32>)
+		{
+			switch (C)
+			{
+				case comparison::eq: match = _mm256_cmpeq_epi32(mem, value); break;
+				case comparison::lt: match = _mm256_cmpgt_epi32(value, mem); break;
+				case comparison::gt: match = _mm256_cmpgt_epi32(mem, value); break;
+				case comparison::le: match = _mm256_xor_si256(_mm256_cmpgt_epi32(mem, value), _mm256_set1_epi32(-1)); break;
+				case comparison::ge: match = _mm256_xor_si256(_mm256_cmpgt_epi32(value, mem), _mm256_set1_epi32(-1)); break;
+			}
+			zero = _mm256_cmpeq_epi32(mem, _mm256_setzero_si256());
+		}
+		else if constexpr (std::is_same_v<T, i64>)
+		{
+			switch (C)
+			{
+				case comparison::eq: match = _mm256_cmpeq_epi64(mem, value); break;
+				case comparison::lt: match = _mm256_cmpgt_epi64(value, mem); break;
+				case comparison::gt: match = _mm256_cmpgt_epi64(mem, value); break;
+				case comparison::le: match = _mm256_xor_si256(_mm256_cmpgt_epi64(mem, value), _mm256_set1_epi32(-1)); break;
+				case comparison::ge: match = _mm256_xor_si256(_mm256_cmpgt_epi64(value, mem), _mm256_set1_epi32(-1)); break;
+			}
+			zero = _mm256_cmpeq_epi64(mem, _mm256_setzero_si256());
+		}
+		else if constexpr (std::is_same_v<T, f32>)
+		{
+			const __m256 mem_f = _mm256_castsi256_ps(mem);
+			const __m256 value_f = _mm256_castsi256_ps(value);
+			switch (C)
+			{
+				case comparison::eq: match = _mm256_castps_si256(_mm256_cmp_ps(mem_f, value_f, _CMP_EQ_OQ)); break;
+				case comparison::lt: match = _mm256_castps_si256(_mm256_cmp_ps(mem_f, value_f, _CMP_LT_OQ)); break;
+				case comparison::gt: match = _mm256_castps_si256(_mm256_cmp_ps(mem_f, value_f, _CMP_GT_OQ)); break;
+				case comparison::le: match = _mm256_castps_si256(_mm256_cmp_ps(mem_f, value_f, _CMP_LE_OQ)); break;
+				case comparison::ge: match = _mm256_castps_si256(_mm256_cmp_ps(mem_f, value_f, _CMP_GE_OQ)); break;
+			}
+			zero = _mm256_castps_si256(_mm256_cmp_ps(mem_f, _mm256_setzero_ps(), _CMP_EQ_OQ));
+		}
+		else
+		{
+			const __m256d mem_d = _mm256_castsi256_pd(mem);
+			const __m256d value_d = _mm256_castsi256_pd(value);
+			switch (C)
+			{
+				case comparison::eq: match = _mm256_castpd_si256(_mm256_cmp_pd(mem_d, value_d, _CMP_EQ_OQ)); break;
+				case comparison::lt: match = _mm256_castpd_si256(_mm256_cmp_pd(mem_d, value_d, _CMP_LT_OQ)); break;
+				case comparison::gt: match = _mm256_castpd_si256(_mm256_cmp_pd(mem_d, value_d, _CMP_GT_OQ)); break;
+				case comparison::le: match = _mm256_castpd_si256(_mm256_cmp_pd(mem_d, value_d, _CMP_LE_OQ)); break;
+				case comparison::ge: match = _mm256_castpd_si256(_mm256_cmp_pd(mem_d, value_d, _CMP_GE_OQ)); break;
+			}
+			zero = _mm256_castpd_si256(_mm256_cmp_pd(mem_d, _mm256_setzero_pd(), _CMP_EQ_OQ));
+		}
+
+		if constexpr (SkipZeroes)
+			match = _mm256_andnot_si256(zero, match);
+
+		if constexpr (sizeof(T) == 4)
+			return _mm256_movemask_ps(_mm256_castsi256_ps(match));
+		else
+			return _mm256_movemask_pd(_mm256_castsi256_pd(match));
+	}
+
+	template<typename T>
+	__attribute__((target("avx2"), always_inline))
+	static inline __m256i broadcast_avx2(const T value)
+	{
+		if constexpr (sizeof(T) == 4)
+		{
+			i32 value_bits;
+			memcpy(&value_bits, &value, sizeof(T));
+			return _mm256_set1_epi32(value_bits);
+		}
+		else
+		{
+			i64 value_bits;
+			memcpy(&value_bits, &value, sizeof(T));
+			return _mm256_set1_epi64x(value_bits);
+		}
+	}
+
+	template<typename T, comparison C, bool SkipZeroes>
+	__attribute__((target("avx2"), always_inline))
+	static inline u64 block_mask_avx2(const u8* block_bytes, const __m256i value)
+	{
+		u64 mask{0};
+
+		// a load starting from byte k covers the positions k, k + sizeof(T), k + 2 * sizeof(T) ...
+		for (u8 half = 0; half < scan_block_size; half += 32)
+		{
+			for (u8 k = 0; k < sizeof(T); ++k)
+			{
+				const u32 lanes = lane_mask_avx2<T, C, SkipZeroes>(block_bytes + half + k, value);
+
+				if constexpr (sizeof(T) == 4)
+					mask |= static_cast<u64>(stride4_table[lanes]) << (half + k);
+				else
+					mask |= static_cast<u64>(stride8_table[lanes]) << (half + k);
+			}
+		}
+
+		return mask;
+	}
+
+	template<typename T, comparison C, bool SkipZeroes>
+	__attribute__((target("avx2")))
+	static void scan_blocks_avx2(const u8* bytes, const u64 blocks, const T value, u64* masks)
+	{
+		const __m256i value_vec = broadcast_avx2(value);
+
+		for (u64 block = 0; block < blocks; ++block)
+			masks[block] = block_mask_avx2<T, C, SkipZeroes>(bytes + block * scan_block_size, value_vec);
+	}
+
+	template<comparison C, bool SkipZeroes>
+	__attribute__((target("avx2")))
+	static void scan_blocks_fused_avx2(const u8* bytes, const u64 blocks, const type_bundle& value, const filter filter,
+			const std::array<u64*, 4>& masks)
+	{
+		const __m256i int_vec = broadcast_avx2(value._int);
+		const __m256i long_vec = broadcast_avx2(value._long);
+		const __m256i float_vec = broadcast_avx2(value._float);
+		const __m256i double_vec = broadcast_avx2(value._double);
+
+		for (u64 block = 0; block < blocks; ++block)
+		{
+			const u8* block_bytes = bytes + block * scan_block_size;
+
+			if (filter.enable_i32)
+				masks[0][block] = block_mask_avx2<i32, C, SkipZeroes>(block_bytes, int_vec);
+
+			if (filter.enable_i64)
+				masks[1][block] = block_mask_avx2<i64, C, SkipZeroes>(block_bytes, long_vec);
+
+			if (filter.enable_f32)
+				masks[2][block] = block_mask_avx2<f32, C, SkipZeroes>(block_bytes, float_vec);
+
+			if (filter.enable_f64)
+				masks[3][block] = block_mask_avx2<f64, C, SkipZeroes>(block_bytes, double_vec);
+		}
+	}
+
+	__attribute__((target("avx2")))
+	static void diff_blocks_avx2(const u8* a, const u8* b, const u64 blocks, u64* masks)
+	{
+		for (u64 block = 0; block < blocks; ++block)
+		{
+			u64 mask{0};
+
+			for (u8 half = 0; half < scan_block_size; half += 32)
+			{
+				const __m256i a_vec = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + block * scan_block_size + half));
+				const __m256i b_vec = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + block * scan_block_size + half));
+				const u32 equal = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a_vec, b_vec));
+				mask |= static_cast<u64>(~equal) << half;
+			}
+
+			masks[block] = mask;
+		}
+	}
+
+	__attribute__((target("avx2")))
+	static void anchor_blocks_avx2(const u8* first, const u8* second, const u8 first_value, const u8 second_value,
+			const u8 first_fold, const u8 second_fold, const u64 blocks, u64* masks)
+	{
+		const __m256i first_vec = _mm256_set1_epi8(static_cast<char>(first_value));
+		const __m256i second_vec = _mm256_set1_epi8(static_cast<char>(second_value));
+		const __m256i first_fold_vec = _mm256_set1_epi8(static_cast<char>(first_fold));
+		const __m256i second_fold_vec = _mm256_set1_epi8(static_cast<char>(second_fold));
+
+		for (u64 block = 0; block < blocks; ++block)
+		{
+			u64 mask{0};
+
+			for (u8 half = 0; half < scan_block_size; half += 32)
+			{
+				const u64 offset = block * scan_block_size + half;
+				const __m256i first_mem = _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(first + offset)), first_fold_vec);
+				const __m256i second_mem = _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(second + offset)), second_fold_vec);
+
+				const __m256i match = _mm256_and_si256(_mm256_cmpeq_epi8(first_mem, first_vec), _mm256_cmpeq_epi8(second_mem, second_vec));
+				mask |= static_cast<u64>(static_cast<u32>(_mm256_movemask_epi8(match))) << half;
+			}
+
+			masks[block] = mask;
+		}
+	}
+
+	/////////////////
+	// avx512 path //
+	/////////////////
+
+	// returns a bit for each lane of a 512-bit load from the given address
+	template<typename T, comparison C, bool SkipZeroes>
+	__attribute__((target("avx512f"), always_inline))
+	static inline u16 lane_mask_avx512(const u8* bytes, const __m512i value)
+	{
+		const __m512i mem = _mm512_loadu_si512(bytes);
+		u16 match;
+		u16 nonzero;
+
+		constexpr int int_predicate =
+			C == comparison::eq ? _MM_CMPINT_EQ :
+			C == comparison::lt ? _MM_CMPINT_LT :
+			C == comparison::gt ? _MM_CMPINT_NLE :
+			C == comparison::le ? _MM_CMPINT_LE :
+			_MM_CMPINT_NLT;
+
+		constexpr int float_predicate =
+			C == comparison::eq ? _CMP_EQ_OQ :
+			C == comparison::lt ? _CMP_LT_OQ :
+			C == comparison::gt ? _CMP_GT_OQ :
+			C == comparison::le ? _CMP_LE_OQ :
+			_CMP_GE_OQ;
+
+		if constexpr (std::is_same_v<T, i32>)
+		{
+			match = _mm512_cmp_epi32_mask(mem, value, int_predicate);
+			nonzero = _mm512_test_epi32_mask(mem, mem);
+		}
+		else if constexpr (std::is_same_v<T, i64>)
+		{
+			match = _mm512_cmp_epi64_mask(mem, value, int_predicate);
+			nonzero = _mm512_test_epi64_mask(mem, mem);
+		}
+		else if constexpr (std::is_same_v<T, f32>)
+		{
+			match = _mm512_cmp_ps_mask(_mm512_castsi512_ps(mem), _mm512_castsi512_ps(value), float_predicate);
+			nonzero = _mm512_cmp_ps_mask(_mm512_castsi512_ps(mem), _mm512_setzero_ps(), _CMP_NEQ_UQ);
+		}
+		else
+		{
+			match = _mm512_cmp_pd_mask(_mm512_castsi512_pd(mem), _mm512_castsi512_pd(value), float_predicate);
+			nonzero = _mm512_cmp_pd_mask(_mm512_castsi512_pd(mem), _mm512_setzero_pd(), _CMP_NEQ_UQ);
+		}
+
+		if constexpr (SkipZeroes)
+			return match & nonzero;
+		else
+			return match;
+	}
+
+	template<typename T>
+	__attribute__((target("avx512f"), always_inline))
+	static inline __m512i broadcast_avx512(const T value)
+	{
+		if constexpr (sizeof(T) == 4)
+		{
+			i32 value_bits;
+			memcpy(&value_bits, &value, sizeof(T));
+			return _mm512_set1_epi32(value_bits);
+		}
+		else
+		{
+			i64 value_bits;
+			memcpy(&value_bits, &value, sizeof(T));
+			return _mm512_set1_epi64(value_bits);
+		}
+	}
+
+	template<typename T, comparison C, bool SkipZeroes>
+	__attribute__((target("avx512f,bmi2"), always_inline))
+	static inline u64 block_mask_avx512(const u8* block_bytes, const __m512i value)
+	{
+		// every sizeof(T)th bit of the block mask
+		constexpr u64 stride_mask = sizeof(T) == 4 ? 0x1111111111111111 : 0x0101010101010101;
+
+		u64 mask{0};
+		for (u8 k = 0; k < sizeof(T); ++k)
+			mask |= _pdep_u64(lane_mask_avx512<T, C, SkipZeroes>(block_bytes + k, value), stride_mask) << k;
+
+		return mask;
+	}
+
+	template<typename T, comparison C, bool SkipZeroes>
+	__attribute__((target("avx512f,bmi2")))
+	static void scan_blocks_avx512(const u8* bytes, const u64 blocks, const T value, u64* masks)
+	{
+		const __m512i value_vec = broadcast_avx512(value);
+
+		for (u64 block = 0; block < blocks; ++block)
+			masks[block] = block_mask_avx512<T, C, SkipZeroes>(bytes + block * scan_block_size, value_vec);
+	}
+
+	template<comparison C, bool SkipZeroes>
+	__attribute__((target("avx512f,bmi2")))
+	static void scan_blocks_fused_avx512(const u8* bytes, const u64 blocks, const type_bundle& value, const filter filter,
+			const std::array<u64*, 4>& masks)
+	{
+		const __m512i int_vec = broadcast_avx512(value._int);
+		const __m512i long_vec = broadcast_avx512(value._long);
+		const __m512i float_vec = broadcast_avx512(value._float);
+		const __m512i double_vec = broadcast_avx512(value._double);
+
+		for (u64 block = 0; block < blocks; ++block)
+		{
+			const u8* block_bytes = bytes + block * scan_block_size;
+
+			if (filter.enable_i32)
+				masks[0][block] = block_mask_avx512<i32, C, SkipZeroes>(block_bytes, int_vec);
+
+			if (filter.enable_i64)
+				masks[1][block] = block_mask_avx512<i64, C, SkipZeroes>(block_bytes, long_vec);
+
+			if (filter.enable_f32)
+				masks[2][block] = block_mask_avx512<f32, C, SkipZeroes>(block_bytes, float_vec);
+
+			if (filter.enable_f64)
+				masks[3][block] = block_mask_avx512<f64, C, SkipZeroes>(block_bytes, double_vec);
+		}
+	}
+
+	//////////////
+	// dispatch //
+	//////////////
+
+	template<typename T, comparison C, bool SkipZeroes>
+	static void scan_blocks_dispatch(const u8* bytes, const u64 blocks, const T value, u64* masks)
+	{
+		switch (detect_simd_level())
+		{
+			case simd_level::avx512:
+				scan_blocks_avx512<T, C, SkipZeroes>(bytes, blocks, value, masks);
+				return;
+
+			case simd_level::avx2:
+				scan_blocks_avx2<T, C, SkipZeroes>(bytes, blocks, value, masks);
+				return;
+
+			case simd_level::scalar:
+				scan_blocks_scalar<T, C, SkipZeroes>(bytes, blocks, value, masks);
+				return;
+		}
+	}
+
+	template<typename T>
+	void scan_blocks(const u8* bytes, const u64 blocks, const T value, const comparison comparison, const bool skip_zeroes, u64* masks)
+	{
+		dispatch_variant(comparison, skip_zeroes, [&](const auto c, const auto skip)
+		{
+			scan_blocks_dispatch<T, c.value, skip.value>(bytes, blocks, value, masks);
+		});
+	}
+
+	template<comparison C, bool SkipZeroes>
+	static void scan_blocks_fused_dispatch(const u8* bytes, const u64 blocks, const type_bundle& value, const filter filter,
+			const std::array<u64*, 4>& masks)
+	{
+		switch (detect_simd_level())
+		{
+			case simd_level::avx512:
+				scan_blocks_fused_avx512<C, SkipZeroes>(bytes, blocks, value, filter, masks);
+				return;
+
+			case simd_level::avx2:
+				scan_blocks_fused_avx2<C, SkipZeroes>(bytes, blocks, value, filter, masks);
+				return;
+
+			case simd_level::scalar:
+				scan_blocks_fused_scalar<C, SkipZeroes>(bytes, blocks, value, filter, masks);
+				return;
+		}
+	}
+
+	void scan_blocks_fused(const u8* bytes, const u64 blocks, const type_bundle& value, const filter filter,
+			const comparison comparison, const bool skip_zeroes, const std::array<u64*, 4>& masks)
+	{
+		dispatch_variant(comparison, skip_zeroes, [&](const auto c, const auto skip)
+		{
+			scan_blocks_fused_dispatch<c.value, skip.value>(bytes, blocks, value, filter, masks);
+		});
+	}
+
+	void diff_blocks(const u8* a, const u8* b, const u64 blocks, u64* masks)
+	{
+		// byte compares would need avx512bw, and the avx2 version
+		// is already limited by the memory bandwidth
+		switch (detect_simd_level())
+		{
+			case simd_level::avx512:
+			case simd_level::avx2:
+				diff_blocks_avx2(a, b, blocks, masks);
+				return;
+
+			case simd_level::scalar:
+				diff_blocks_scalar(a, b, blocks, masks);
+				return;
+		}
+	}
+
+	void anchor_blocks(const u8* first, const u8* second, const u8 first_value, const u8 second_value,
+			const u8 first_fold, const u8 second_fold, const u64 blocks, u64* masks)
+	{
+		// same as with diff_blocks, the avx2 version is enough to keep up with the memory
+		switch (detect_simd_level())
+		{
+			case simd_level::avx512:
+			case simd_level::avx2:
+				anchor_blocks_avx2(first, second, first_value, second_value, first_fold, second_fold, blocks, masks);
+				return;
+
+			case simd_level::scalar:
+				anchor_blocks_scalar(first, second, first_value, second_value, first_fold, second_fold, blocks, masks);
+				return;
+		}
+	}
+
+	template void scan_blocks<i32>(const u8*, const u64, const i32, const comparison, const bool, u64*);
+	template void scan_blocks<i64>(const u8*, const u64, const i64, const comparison, const bool, u64*);
+	template void scan_blocks<f32>(const u8*, const u64, const f32, const comparison, const bool, u64*);
+	template void scan_blocks<f64>(const u8*, const u64, const f64, const comparison, const bool, u64*);
+}
@@ -0,0 +1,376 @@
+#include "Session.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace harava
+{
+	static constexpr u64 column_alignment = 64;
+
+	static constexpr u64 align(const u64 offset)
+	{
+		return (offset + column_alignment - 1) / column_alignment * column_alignment;
+	}
+
+	struct session_header
+	{
+		char magic[4];
+		u32 version;
+		i32 pid;
+		u32 region_count;
+		u64 segment_count;
+		u64 chunk_count;
+		u64 file_size;
+		u64 text_size;
+		std::array<type_union, 4> uniform_values;
+		u8 has_uniform_values;
+		u8 has_text;
+		u8 text_encoding;
+		u8 padding[5];
+	};
+
+	struct region_record
+	{
+		u64 start;
+		u64 end;
+		u16 id;
+		u8 shared;
+		u8 padding[5];
+	};
+
+	// where the elements of a column start in the file
+	struct column_record
+	{
+		u64 offset;
+		u64 count;
+	};
+
+	static constexpr u8 segment_columns = 12;
+
+	struct segment_record
+	{
+		std::array<column_record, segment_columns> columns;
+		u64 bitmap_entries;
+		u64 results_total;
+		u32 bitmap_first;
+		u32 bitmap_span;
+		u16 region_id;
+		u8 kind;
+		u8 combined_types;
+		u8 padding[4];
+	};
+
+	struct chunk_record
+	{
+		u64 location;
+		u64 size;
+		column_record page_indices;
+		column_record pages;
+		u16 region_id;
+		u8 padding[6];
+	};
+
+	template<typename Segment, typename F>
+	void session::for_each_column(Segment& segment, F&& f)
+	{
+		f(segment.location_deltas);
+		f(segment.checkpoints);
+		f(segment.type_masks);
+		f(segment.result_samples);
+		f(segment.value_low);
+		f(segment.value_high);
+
+		for (auto& plane : segment.planes)
+			f(plane);
+
+		f(segment.value_bytes);
+		f(segment.block_results_before);
+	}
+
+	bool session::save(const std::string& path, const i32 pid, const std::map<u16, memory_region>& regions,
+			const results& results, const snapshot& snapshot)
+	{
+		// the old file stays as it was until the new one has been written completely
+		const std::string temporary_path = path + ".tmp";
+		std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+
+		if (!file.is_open()) [[unlikely]]
+		{
+			std::cout << "can't open " << temporary_path << '\n';
+			return false;
+		}
+
+		const std::vector<result_segment>& segments = results.segments();
+		const std::vector<snapshot::chunk>& chunks = snapshot.chunks;
+
+		// the columns go after all of the records in the same order as the records
+		const u64 records_size = sizeof(session_header) + regions.size() * sizeof(region_record)
+			+ segments.size() * sizeof(segment_record) + chunks.size() * sizeof(chunk_record);
+		u64 offset = align(records_size);
+
+		const auto place = [&offset](const auto& column)
+		{
+			const column_record record{ column.empty() ? 0 : offset, column.size() };
+			offset = align(offset + column.size() * sizeof(*column.data()));
+			return record;
+		};
+
+		std::vector<region_record> region_records;
+		region_records.reserve(regions.size());
+		for (const auto& [region_id, region] : regions)
+			region_records.push_back({ region.start, region.end, region_id, region.shared, {} });
+
+		std::vector<segment_record> segment_records(segments.size());
+		for (u64 i = 0; i < segments.size(); ++i)
+		{
+			const result_segment& segment = segments[i];
+			segment_record& record = segment_records[i];
+
+			u8 column_index{0};
+			for_each_column(segment, [&](const auto& column) { record.columns[column_index++] = place(column); });
+
+			record.bitmap_entries = segment.bitmap_entries;
+			record.results_total = segment.results_total;
+			record.bitmap_first = segment.bitmap_first;
+			record.bitmap_span = segment.bitmap_span;
+			record.region_id = segment.region_id;
+			record.kind = static_cast<u8>(segment.representation);
+			record.combined_types = segment.combined_types;
+		}
+
+		std::vector<chunk_record> chunk_records(chunks.size());
+		for (u64 i = 0; i < chunks.size(); ++i)
+		{
+			chunk_records[i].location = chunks[i].location;
+			chunk_records[i].size = chunks[i].size;
+			chunk_records[i].page_indices = place(chunks[i].page_indices);
+			chunk_records[i].pages = place(chunks[i].pages);
+			chunk_records[i].region_id = chunks[i].region_id;
+		}
+
+		session_header header{};
+		memcpy(header.magic, magic, sizeof(magic));
+		header.version = version;
+		header.pid = pid;
+		header.region_count = regions.size();
+		header.segment_count = segments.size();
+		header.chunk_count = chunks.size();
+		header.file_size = offset;
+
+		if (results.uniform().has_value())
+		{
+			header.has_uniform_values = true;
+			header.uniform_values = results.uniform().value();
+		}
+
+		if (results.text().has_value())
+		{
+			header.has_text = true;
+			header.text_encoding = static_cast<u8>(results.text()->encoding);
+			header.text_size = results.text()->size;
+		}
+
+		const auto write_records = [&file](const auto& records)
+		{
+			file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(records[0]));
+		};
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		write_records(region_records);
+		write_records(segment_records);
+		write_records(chunk_records);
+
+		const std::array<char, column_alignment> zeroes{};
+		const auto write_column = [&](const auto& column)
+		{
+			const u64 size = column.size() * sizeof(*column.data());
+			file.write(reinterpret_cast<const char*>(column.data()), size);
+			file.write(zeroes.data(), align(size) - size);
+		};
+
+		file.write(zeroes.data(), align(records_size) - records_size);
+
+		for (const result_segment& segment : segments)
+			for_each_column(segment, write_column);
+
+		for (const snapshot::chunk& chunk : chunks)
+		{
+			write_column(chunk.page_indices);
+			write_column(chunk.pages);
+		}
+
+		file.close();
+
+		std::error_code error;
+		if (!file.fail())
+			std::filesystem::rename(temporary_path, path, error);
+
+		if (file.fail() || error) [[unlikely]]
+		{
+			std::cout << "can't write " << path << '\n';
+			std::filesystem::remove(temporary_path, error);
+			return false;
+		}
+
+		return true;
+	}
+
+	std::optional<session> session::load(const std::string& path, const std::function<bool(const memory_region&)>& keep_region)
+	{
+		const std::shared_ptr<spill_file> file = spill_file::map_existing(path);
+		if (!file)
+			return std::nullopt;
+
+		u8* const data = file->data();
+		const u64 file_size = file->size();
+
+		const auto invalid = [&path](const std::string& reason) -> std::optional<session>
+		{
+			std::cout << path << " isn't a valid session file: " << reason << '\n';
+			return std::nullopt;
+		};
+
+		if (file_size < sizeof(session_header))
+			return invalid("the header is missing");
+
+		session_header header;
+		memcpy(&header, data, sizeof(header));
+
+		if (memcmp(header.magic, magic, sizeof(magic)) != 0)
+			return invalid("wrong magic bytes");
+
+		if (header.version != version)
+			return invalid("version " + std::to_string(header.version) + " isn't supported");
+
+		if (header.file_size != file_size)
+			return invalid("the file is " + std::to_string(file_size) + " bytes instead of " + std::to_string(header.file_size));
+
+		// the records follow each other right after the header
+		u64 records_end = sizeof(session_header);
+		const auto records = [&](const u64 count, const u64 record_size) -> const u8*
+		{
+			if (count > (file_size - records_end) / record_size)
+				return nullptr;
+
+			const u8* first = data + records_end;
+			records_end += count * record_size;
+			return first;
+		};
+
+		const auto* region_records = reinterpret_cast<const region_record*>(records(header.region_count, sizeof(region_record)));
+		const auto* segment_records = reinterpret_cast<const segment_record*>(records(header.segment_count, sizeof(segment_record)));
+		const auto* chunk_records = reinterpret_cast<const chunk_record*>(records(header.chunk_count, sizeof(chunk_record)));
+
+		if (region_records == nullptr || segment_records == nullptr || chunk_records == nullptr)
+			return invalid("the records don't fit in the file");
+
+		// the columns are used straight from the mapped file
+		const auto map_column = [&]<typename T>(column<T>& target, const column_record& record)
+		{
+			if (record.count == 0)
+				return true;
+
+			if (record.offset % alignof(T) != 0 || record.offset > file_size || record.count > (file_size - record.offset) / sizeof(T))
+				return false;
+
+			target.use_mapped(reinterpret_cast<T*>(data + record.offset), record.count);
+			return true;
+		};
+
+		session loaded;
+		loaded.pid = header.pid;
+
+		std::map<u16, memory_region> saved_regions;
+		for (u32 i = 0; i < header.region_count; ++i)
+		{
+			memory_region region;
+			region.start = region_records[i].start;
+			region.end = region_records[i].end;
+			region.shared = region_records[i].shared;
+
+			if (region.end <= region.start || saved_regions.contains(region_records[i].id))
+				return invalid("region " + std::to_string(region_records[i].id) + " is damaged");
+
+			saved_regions[region_records[i].id] = region;
+			if (keep_region(region))
+				loaded.regions[region_records[i].id] = region;
+		}
+
+		for (u64 i = 0; i < header.segment_count; ++i)
+		{
+			const segment_record& record = segment_records[i];
+
+			if (!saved_regions.contains(record.region_id) || record.kind > static_cast<u8>(segment_kind::bitmap)
+				|| (i > 0 && record.region_id < segment_records[i - 1].region_id))
+				return invalid("segment " + std::to_string(i) + " is damaged");
+
+			if (!loaded.regions.contains(record.region_id))
+			{
+				loaded.dropped_results += record.results_total;
+				continue;
+			}
+
+			result_segment segment;
+			segment.region_id = record.region_id;
+			segment.representation = static_cast<segment_kind>(record.kind);
+			segment.bitmap_first = record.bitmap_first;
+			segment.bitmap_span = record.bitmap_span;
+			segment.bitmap_entries = record.bitmap_entries;
+			segment.results_total = record.results_total;
+			segment.combined_types = record.combined_types;
+
+			bool mapped{true};
+			u8 column_index{0};
+			for_each_column(segment, [&](auto& column) { mapped = map_column(column, record.columns[column_index++]) && mapped; });
+
+			// the columns that the segment is walked through with have to agree on the amount of entries
+			const u64 entries = segment.type_masks.size();
+			const bool consistent = segment.representation == segment_kind::bitmap
+				? std::all_of(segment.planes.begin(), segment.planes.end(), [&](const column<u64>& plane) { return plane.empty() || plane.size() == segment.bitmap_words(); })
+					&& (segment.value_bytes.empty() || segment.value_bytes.size() == segment.bitmap_span + sizeof(u64) - 1)
+				: segment.checkpoints.size() == (entries + result_segment::checkpoint_interval - 1) / result_segment::checkpoint_interval
+					&& (segment.value_low.empty() || segment.value_low.size() == entries)
+					&& (segment.value_high.empty() || segment.value_high.size() == entries)
+					&& (segment.checkpoints.empty() || segment.checkpoints.back().delta_offset < segment.location_deltas.size());
+
+			if (!mapped || !consistent)
+				return invalid("segment " + std::to_string(i) + " is damaged");
+
+			segment.spill_storage = file;
+			loaded.saved_results.add_segment(std::move(segment));
+		}
+
+		for (u64 i = 0; i < header.chunk_count; ++i)
+		{
+			const chunk_record& record = chunk_records[i];
+
+			if (!saved_regions.contains(record.region_id))
+				return invalid("snapshot chunk " + std::to_string(i) + " is damaged");
+
+			if (!loaded.regions.contains(record.region_id))
+				continue;
+
+			snapshot::chunk chunk{ record.region_id, record.location, record.size, {}, {}, {} };
+			const bool mapped = map_column(chunk.page_indices, record.page_indices) && map_column(chunk.pages, record.pages);
+
+			const u64 stored_pages = chunk.pages.size() / snapshot::page_size;
+			if (!mapped || chunk.page_indices.size() != (record.size + snapshot::page_size - 1) / snapshot::page_size
+				|| std::any_of(chunk.page_indices.begin(), chunk.page_indices.end(), [&](const u32 page) { return page != snapshot::zero_page && page >= stored_pages; }))
+				return invalid("snapshot chunk " + std::to_string(i) + " is damaged");
+
+			chunk.spill_storage = file;
+			loaded.saved_snapshot.add_chunk(std::move(chunk));
+		}
+
+		if (header.has_uniform_values)
+			loaded.saved_results.set_uniform_values(header.uniform_values);
+
+		if (header.has_text)
+			loaded.saved_results.set_text({ static_cast<text_encoding>(header.text_encoding), header.text_size });
+
+		return loaded;
+	}
+}
@@ -1,16 +1,26 @@
+#include "Freezer.hpp"
 #include "Memory.hpp"
+#include "Pattern.hpp"
+#include "Query.hpp"
+#include "Sampler.hpp"
 #include "ScopeTimer.hpp"
 #include "Shell.hpp"
+#include "Text.hpp"
 
 #include <algorithm>
+#include <charconv>
+#include <cstring>
 #include <execution>
+#include <fstream>
 #include <functional>
 #include <iomanip>
 #include <map>
 #include <memory>
 #include <optional>
+#include <poll.h>
 #include <sstream>
 #include <string>
+#include <unistd.h>
 #include <vector>
 
 namespace harava
@@ -60,21 +70,617 @@ namespace harava
 			{ "f64", &filter.enable_f64 }
 		};
 
+		// the frozen values are kept through resets
+		harava::freezer freezer(opts.pid, opts.freeze_rate);
+
 		results results;
 		bool first_search = true;
 		bool running = true;
 
+		// memory copy from an unknown initial value scan that
+		// the first change comparison gets done against
+		harava::snapshot unknown_snapshot;
+
 		const std::string scan_duration_str = "scan duration: ";
 		const std::string do_initial_search_notif_str = "do an initial scan first";
 		const auto print_result_count = [&results]() { std::cout << "results: " << results.count() << '\n'; };
 
+		const auto refine_change = [&](const harava::value_change change)
+		{
+			if (unknown_snapshot.empty())
+			{
+				results = process_memory->refine_search_change(results, change);
+				return;
+			}
+
+			results = process_memory->refine_snapshot(opts, filter, unknown_snapshot, change);
+			unknown_snapshot.clear();
+		};
+
+		const auto run_query = [&](const harava::query& query)
+		{
+			harava::scope_timer timer(scan_duration_str);
+
+			// a value search after an unknown scan has to look through everything
+			const bool full_search = first_search || !unknown_snapshot.empty();
+			unknown_snapshot.clear();
+
+			results = full_search
+				? process_memory->search(opts, filter, query)
+				: process_memory->refine_search(query, results);
+
+			first_search = false;
+			print_result_count();
+		};
+
+		// the comparison commands are queries with a single term
+		const auto run_comparison = [&](const std::string& value_str, const harava::comparison comparison)
+		{
+			const harava::type_bundle value(value_str);
+			if (value.valid)
+				run_query(harava::query::single(value, comparison));
+		};
+
+		// the words of a text are split into separate arguments
+		const auto join_args = [](const std::vector<std::string>& args, const size_t first)
+		{
+			std::string text;
+			for (size_t i = first; i < args.size(); ++i)
+				text += (i == first ? "" : " ") + args.at(i);
+
+			return text;
+		};
+
+		const auto search_text = [&](const std::vector<std::string>& args, const harava::text_encoding encoding)
+		{
+			const bool ignore_case = args.at(0) == "-i";
+			const std::optional<harava::text_pattern> pattern = harava::text_pattern::parse(join_args(args, ignore_case ? 1 : 0), encoding, ignore_case);
+			if (!pattern.has_value())
+				return;
+
+			harava::scope_timer timer(scan_duration_str);
+
+			// text results of the same encoding get refined with the new text, anything else starts a new search
+			const bool refine = !first_search && unknown_snapshot.empty()
+				&& results.text().has_value() && results.text()->encoding == encoding;
+			unknown_snapshot.clear();
+
+			results = refine
+				? process_memory->refine_text(pattern.value(), results)
+				: process_memory->search_text(opts, pattern.value());
+
+			first_search = false;
+			print_result_count();
+		};
+
+		// text results are set by writing the encoded text over the old one, shorter
+		// texts get a terminating zero so that they end at the right place
+		const auto encode_new_text = [&](const std::string& text)
+		{
+			const harava::results::text_match& match = results.text().value();
+			std::optional<std::vector<u8>> bytes = harava::encode_text(text, match.encoding);
+			if (!bytes.has_value())
+				return bytes;
+
+			if (bytes->size() < match.size)
+				bytes->resize(bytes->size() + (match.encoding == harava::text_encoding::utf16 ? 2 : 1), 0);
+			else if (bytes->size() > match.size)
+				std::cout << "the new text is longer than the old one and might overwrite something else\n";
+
+			return bytes;
+		};
+
+		const auto set_text = [&](const harava::result& result, const std::string& text)
+		{
+			const std::optional<std::vector<u8>> bytes = encode_new_text(text);
+			if (bytes.has_value())
+				process_memory->write(result, bytes.value());
+		};
+
+		const auto parse_index = [](const std::string& arg) -> std::optional<u64>
+		{
+			try
+			{
+				return std::stoull(arg);
+			}
+			catch (const std::exception& e)
+			{
+				std::cout << "invalid argument: " << arg << '\n';
+				return {};
+			}
+		};
+
+		// the current bytes of a result, text results get the whole text
+		const auto result_bytes = [&](const harava::result& result)
+		{
+			return process_memory->read(result, results.text().has_value() ? results.text()->size : type_size(result.type));
+		};
+
+		// human readable form of the bytes of a result
+		const auto describe_bytes = [&](const harava::result& result, const std::vector<u8>& bytes)
+		{
+			std::ostringstream stream;
+
+			if (results.text().has_value())
+			{
+				const harava::text_encoding encoding = results.text()->encoding;
+				stream << (encoding == harava::text_encoding::utf16 ? "utf16 " : "utf8 ") << harava::decode_text(bytes.data(), bytes.size(), encoding);
+				return stream.str();
+			}
+
+			type_union value;
+			memcpy(value.bytes, bytes.data(), std::min<size_t>(bytes.size(), sizeof(value.bytes)));
+			stream << datatype_names[type_index(result.type)] << ' ';
+
+			switch (result.type)
+			{
+				case datatype::INT:
+					stream << value._int;
+					break;
+
+				case datatype::LONG:
+					stream << value._long;
+					break;
+
+				case datatype::FLOAT:
+					stream << value._float;
+					break;
+
+				case datatype::DOUBLE:
+					stream << value._double;
+					break;
+			}
+
+			return stream.str();
+		};
+
+		const auto freeze_result = [&](const harava::result& result, const std::vector<u8>& bytes)
+		{
+			freezer.freeze(process_memory->address(result), bytes, describe_bytes(result, bytes));
+		};
+
+		// format a value with std::to_chars to the end of the output
+		const auto append_value = [](std::string& output, const datatype type, const u8* bytes)
+		{
+			type_union value;
+			memcpy(value.bytes, bytes, type_size(type));
+
+			char number[64];
+			std::to_chars_result result{ number, {} };
+
+			switch (type)
+			{
+				case datatype::INT:
+					result = std::to_chars(number, number + sizeof(number), value._int);
+					break;
+
+				case datatype::LONG:
+					result = std::to_chars(number, number + sizeof(number), value._long);
+					break;
+
+				case datatype::FLOAT:
+					result = std::to_chars(number, number + sizeof(number), value._float);
+					break;
+
+				case datatype::DOUBLE:
+					result = std::to_chars(number, number + sizeof(number), value._double);
+					break;
+			}
+
+			output.append(number, result.ptr);
+		};
+
+		constexpr u64 default_page_size = 100;
+
+		// the values of the page are read with a single batch and
+		// formatted into one buffer that gets printed all at once
+		const auto list_results = [&](const u64 offset, const u64 count)
+		{
+			const u64 total = results.count();
+			if (offset >= total)
+			{
+				std::cout << (total == 0 ? "no results\n" : "out-of-bounds index\n");
+				return;
+			}
+
+			const u64 last = offset + std::min(count, total - offset);
+
+			std::vector<harava::result> page;
+			page.reserve(last - offset);
+			for (u64 i = offset; i < last; ++i)
+				page.push_back(results.at(i).value());
+
+			const std::optional<harava::results::text_match>& text = results.text();
+			const u64 value_size = text.has_value() ? text->size : sizeof(type_union);
+			const std::vector<u8> bytes = process_memory->read_results(page, value_size);
+
+			std::string output;
+			output.reserve(page.size() * 64);
+
+			char number[64];
+			const auto append_number = [&](const auto value, const auto... base)
+			{
+				const std::to_chars_result result = std::to_chars(number, number + sizeof(number), value, base...);
+				output.append(number, result.ptr);
+			};
+
+			// the location is right aligned like the old listing
+			const auto append_location = [&](const u32 location)
+			{
+				const std::to_chars_result result = std::to_chars(number, number + sizeof(number), location, 16);
+				output.append(std::max<i64>(0, 5 - (result.ptr - number)), ' ');
+				output.append(number, result.ptr);
+			};
+
+			for (u64 i = 0; i < page.size(); ++i)
+			{
+				const harava::result& r = page[i];
+				const u8* value_bytes = &bytes[i * value_size];
+
+				output += '[';
+				append_number(offset + i);
+				output += "] ";
+				append_number(process_memory->address(r), 16);
+				output += " | ";
+				append_location(r.location);
+				output += " | ";
+
+				if (text.has_value())
+				{
+					output += text->encoding == harava::text_encoding::utf16 ? "utf16 | " : "utf8 | ";
+					output += harava::decode_text(value_bytes, value_size, text->encoding);
+					output += '\n';
+					continue;
+				}
+
+				output += datatype_names[type_index(r.type)];
+				output += " | ";
+				append_value(output, r.type, value_bytes);
+				output += '\n';
+			}
+
+			if (last < total)
+			{
+				output += "showing ";
+				append_number(offset);
+				output += '-';
+				append_number(last - 1);
+				output += " of ";
+				append_number(total);
+				output += ", use 'list [offset] [count]' to see the rest\n";
+			}
+
+			std::cout.write(output.data(), output.size());
+		};
+
+		// sample the results at the given indices (like 0,2,5-9) until enter is pressed
+		//
+		// the samples can also be recorded to a file, which is csv if the name ends with
+		// .csv and binary otherwise. the binary format starts with "HRVW", a u32 version,
+		// the u32 rate and the u32 address count, followed by the u64 address and the u8
+		// datatype of each address. after the header each sample is the u64 nanoseconds
+		// since the start and 8 bytes for each address, all in native byte order
+		const auto watch_results = [&](const std::string& index_list, const std::string& rate_str, const std::string& path)
+		{
+			if (results.text().has_value())
+			{
+				std::cout << "text results can't be watched\n";
+				return;
+			}
+
+			constexpr u64 max_watched = 4096;
+			std::vector<u64> indices;
+
+			for (const std::string& part : tokenize_string(index_list, ','))
+			{
+				const size_t dash = part.find('-');
+				const std::optional<u64> first = parse_index(part.substr(0, dash));
+				const std::optional<u64> last = dash == std::string::npos ? first : parse_index(part.substr(dash + 1));
+				if (!first.has_value() || !last.has_value())
+					return;
+
+				if (last.value() < first.value() || last.value() - first.value() >= max_watched)
+				{
+					std::cout << "invalid range: " << part << '\n';
+					return;
+				}
+
+				for (u64 i = first.value(); i <= last.value(); ++i)
+					indices.push_back(i);
+			}
+
+			if (indices.empty() || indices.size() > max_watched)
+			{
+				std::cout << "watch between 1 and " << max_watched << " results at a time\n";
+				return;
+			}
+
+			const std::optional<u64> rate = parse_index(rate_str);
+			if (!rate.has_value())
+				return;
+
+			if (rate.value() == 0 || rate.value() > harava::sampler::max_rate)
+			{
+				std::cout << "the rate has to be between 1 and " << harava::sampler::max_rate << "Hz\n";
+				return;
+			}
+
+			std::vector<harava::result> watched;
+			std::vector<u64> addresses;
+			for (const u64 index : indices)
+			{
+				const std::optional<harava::result> result = results.at(index);
+				if (!result.has_value())
+					return;
+
+				watched.push_back(result.value());
+				addresses.push_back(process_memory->address(result.value()));
+			}
+
+			std::ofstream dump;
+			const bool csv = path.ends_with(".csv");
+
+			if (!path.empty())
+			{
+				dump.open(path, std::ios::binary);
+				if (!dump.is_open())
+				{
+					std::cout << "can't open " << path << '\n';
+					return;
+				}
+			}
+
+			// the header records the rate that the sampler actually runs at
+			harava::sampler sampler(opts.pid, opts.backend, addresses, rate.value());
+
+			if (dump.is_open())
+			{
+				std::string header;
+				if (csv)
+				{
+					header = "nanoseconds";
+					for (u64 i = 0; i < watched.size(); ++i)
+					{
+						std::ostringstream column;
+						column << ",[" << indices[i] << "] " << std::hex << addresses[i] << ' ' << datatype_names[type_index(watched[i].type)];
+						header += column.str();
+					}
+					header += '\n';
+				}
+				else
+				{
+					const auto append_raw = [&header](const auto value) { header.append(reinterpret_cast<const char*>(&value), sizeof(value)); };
+
+					constexpr u32 version = 1;
+					header = "HRVW";
+					append_raw(version);
+					append_raw(sampler.rate());
+					append_raw(static_cast<u32>(watched.size()));
+
+					for (u64 i = 0; i < watched.size(); ++i)
+					{
+						append_raw(addresses[i]);
+						append_raw(static_cast<u8>(watched[i].type));
+					}
+				}
+
+				dump.write(header.data(), header.size());
+			}
+
+			std::vector<u8> sample(sampler.sample_size());
+			std::vector<u8> latest(watched.size() * harava::sampler::value_size);
+			std::vector<u64> changes(watched.size());
+			u64 sample_count{0};
+			std::string csv_rows;
+
+			const auto drain = [&]
+			{
+				while (sampler.pop(sample.data()))
+				{
+					const u8* values = sample.data() + sizeof(u64);
+
+					for (u64 i = 0; i < watched.size(); ++i)
+					{
+						const u8* value = values + i * harava::sampler::value_size;
+						u8* previous = &latest[i * harava::sampler::value_size];
+						const u8 size = type_size(watched[i].type);
+
+						if (sample_count != 0 && memcmp(previous, value, size) != 0)
+							++changes[i];
+
+						memcpy(previous, value, size);
+					}
+
+					++sample_count;
+
+					if (!dump.is_open())
+						continue;
+
+					if (!csv)
+					{
+						dump.write(reinterpret_cast<const char*>(sample.data()), sample.size());
+						continue;
+					}
+
+					u64 nanoseconds;
+					memcpy(&nanoseconds, sample.data(), sizeof(u64));
+
+					char number[32];
+					csv_rows.append(number, std::to_chars(number, number + sizeof(number), nanoseconds).ptr);
+					for (u64 i = 0; i < watched.size(); ++i)
+					{
+						csv_rows += ',';
+						append_value(csv_rows, watched[i].type, values + i * harava::sampler::value_size);
+					}
+					csv_rows += '\n';
+				}
+
+				dump.write(csv_rows.data(), csv_rows.size());
+				csv_rows.clear();
+			};
+
+			// redraw the view in place with ansi escapes, only the first rows fit on the screen
+			constexpr u64 max_rows = 16;
+			const u64 rows = std::min<u64>(watched.size(), max_rows);
+			bool drawn{false};
+
+			const auto draw = [&]
+			{
+				std::ostringstream view;
+				const u64 lines = rows + 1 + (watched.size() > rows ? 1 : 0);
+
+				if (drawn)
+					view << "\x1b[" << lines << 'F';
+
+				view << "\x1b[2K" << "samples: " << sample_count << " at " << sampler.rate() << "Hz, dropped: " << sampler.dropped()
+					<< " (press enter to stop)\n";
+
+				for (u64 i = 0; i < rows; ++i)
+				{
+					std::string value;
+					if (sample_count != 0)
+						append_value(value, watched[i].type, &latest[i * harava::sampler::value_size]);
+
+					view << "\x1b[2K[" << indices[i] << "] " << std::hex << addresses[i] << std::dec << " | "
+						<< datatype_names[type_index(watched[i].type)] << " | " << value << " | changes: " << changes[i] << '\n';
+				}
+
+				if (watched.size() > rows)
+					view << "\x1b[2K" << watched.size() - rows << " more not shown\n";
+
+				std::cout << view.str() << std::flush;
+				drawn = true;
+			};
+
+			constexpr i32 refresh_milliseconds = 100;
+			pollfd input{ STDIN_FILENO, POLLIN, 0 };
+
+			while (poll(&input, 1, refresh_milliseconds) == 0)
+			{
+				drain();
+				draw();
+			}
+
+			drain();
+			draw();
+
+			// consume the line that stopped the watch
+			std::string line;
+			std::getline(std::cin, line);
+
+			if (dump.is_open())
+				std::cout << "recorded " << sample_count << " samples to " << path << '\n';
+		};
+
+		// print the first chains and the addresses that they lead to
+		const auto print_chains = [](const harava::pointer_chains& chains, const std::vector<u64>& addresses)
+		{
+			constexpr u64 max_printed = 20;
+			for (u64 i = 0; i < std::min<u64>(chains.chains.size(), max_printed); ++i)
+				std::cout << chains.format(chains.chains[i]) << " = " << std::hex << addresses[i] << std::dec << '\n';
+
+			if (chains.chains.size() > max_printed)
+				std::cout << "showing " << max_printed << " of " << chains.chains.size() << " chains\n";
+		};
+
+		const auto pointer_scan = [&](const std::string& index_str, const std::string& depth_str, const std::string& offset_str, const std::string& path)
+		{
+			const std::optional<u64> index = parse_index(index_str);
+			const std::optional<u64> depth = parse_index(depth_str);
+			if (!index.has_value() || !depth.has_value())
+				return;
+
+			if (depth.value() == 0 || depth.value() > harava::pointer_chain::max_depth)
+			{
+				std::cout << "the depth has to be between 1 and " << static_cast<u32>(harava::pointer_chain::max_depth) << '\n';
+				return;
+			}
+
+			u32 max_offset;
+			try
+			{
+				max_offset = std::stoul(offset_str, nullptr, 16);
+			}
+			catch (const std::exception& e)
+			{
+				std::cout << "invalid offset: " << offset_str << '\n';
+				return;
+			}
+
+			const std::optional<harava::result> result = results.at(index.value());
+			if (!result.has_value())
+				return;
+
+			harava::scope_timer timer(scan_duration_str);
+			const u64 target = process_memory->address(result.value());
+			const harava::pointer_chains chains = process_memory->pointer_scan(target, depth.value(), max_offset);
+
+			std::cout << "chains: " << chains.chains.size() << '\n';
+			print_chains(chains, std::vector<u64>(chains.chains.size(), target));
+
+			if (!path.empty() && chains.write(path))
+				std::cout << "wrote the chains to " << path << '\n';
+		};
+
+		// with an index, only the chains that lead to the result are kept in the file
+		const auto check_pointers = [&](const std::string& path, const std::string& index_str)
+		{
+			std::optional<harava::pointer_chains> chains = harava::pointer_chains::read(path);
+			if (!chains.has_value())
+				return;
+
+			const std::vector<u64> addresses = process_memory->follow(chains.value());
+
+			if (index_str.empty())
+			{
+				harava::pointer_chains leading;
+				leading.modules = chains->modules;
+
+				std::vector<u64> leading_addresses;
+				for (u64 i = 0; i < addresses.size(); ++i)
+				{
+					if (addresses[i] == 0)
+						continue;
+
+					leading.chains.push_back(chains->chains[i]);
+					leading_addresses.push_back(addresses[i]);
+				}
+
+				std::cout << leading.chains.size() << " of " << chains->chains.size() << " chains can be followed\n";
+				print_chains(leading, leading_addresses);
+				return;
+			}
+
+			const std::optional<u64> index = parse_index(index_str);
+			if (!index.has_value())
+				return;
+
+			const std::optional<harava::result> result = results.at(index.value());
+			if (!result.has_value())
+				return;
+
+			const u64 target = process_memory->address(result.value());
+			const u64 total = chains->chains.size();
+
+			std::vector<harava::pointer_chain> kept;
+			for (u64 i = 0; i < addresses.size(); ++i)
+				if (addresses[i] == target)
+					kept.push_back(chains->chains[i]);
+
+			chains->chains = std::move(kept);
+			print_chains(chains.value(), std::vector<u64>(chains->chains.size(), target));
+
+			if (chains->write(path))
+				std::cout << "kept " << chains->chains.size() << " of " << total << " chains in " << path << '\n';
+		};
+
 		std::cout << "type 'help' for a list of commands\n";
 
 		while (running)
 		{
 			std::cout << " > ";
 
-			constexpr size_t max_command_size = 64;
+			constexpr size_t max_command_size = 256;
 
 			char buffer[max_command_size];
 			std::cin.getline(buffer, max_command_size, '\n');
@@ -105,6 +711,9 @@ namespace harava
 
 							std::cout << std::setw(cmd_name_arg_width) << cmd_name + " " + arg_desc << cmd_desc << '\n';
 						}
+
+						std::cout << "\nconditions can be combined with 'and' and 'or' and limited to a type,\n"
+							<< "for example '> 5 and < 9' or 'i32 = 7 or f32 = 7.5'\n";
 					}
 				},
 				{
@@ -119,105 +728,88 @@ namespace harava
 					"[value]",
 					"find matching values",
 					1,
-					[&]
-					{
-						harava::scope_timer timer(scan_duration_str);
-						harava::type_bundle value(command.args.at(0));
-						if (!value.valid)
-							return;
-
-						results = first_search
-							? process_memory->search(opts, filter, value, harava::comparison::eq)
-							: process_memory->refine_search(value, results, harava::comparison::eq);
-
-						first_search = false;
-						print_result_count();
-					}
+					[&] { run_comparison(command.args.at(0), harava::comparison::eq); }
 				},
 				{
 					">",
 					"[value]",
 					"find values higher than the given value",
 					1,
-					[&]
-					{
-						harava::scope_timer timer(scan_duration_str);
-						harava::type_bundle value(command.args.at(0));
-						if (!value.valid)
-							return;
-
-						results = first_search
-							? process_memory->search(opts, filter, value, harava::comparison::gt)
-							: process_memory->refine_search(value, results, harava::comparison::gt);
-
-						first_search = false;
-						print_result_count();
-					}
+					[&] { run_comparison(command.args.at(0), harava::comparison::gt); }
 				},
 				{
 					"<",
 					"[value]",
 					"find values lower than the given value",
 					1,
-					[&]
-					{
-						harava::scope_timer timer(scan_duration_str);
-						harava::type_bundle value(command.args.at(0));
-						if (!value.valid)
-							return;
-
-						results = first_search
-							? process_memory->search(opts, filter, value, harava::comparison::lt)
-							: process_memory->refine_search(value, results, harava::comparison::lt);
-
-						first_search = false;
-						print_result_count();
-					}
+					[&] { run_comparison(command.args.at(0), harava::comparison::lt); }
 				},
 				{
 					">=",
 					"[value]",
 					"find values higher than or equal to the given value",
 					1,
+					[&] { run_comparison(command.args.at(0), harava::comparison::ge); }
+				},
+				{
+					"<=",
+					"[value]",
+					"find values lower than or equal to the given value",
+					1,
+					[&] { run_comparison(command.args.at(0), harava::comparison::le); }
+				},
+				{
+					"between",
+					"[low] [high]",
+					"find values between low and high (inclusive)",
+					2,
 					[&]
 					{
-						harava::scope_timer timer(scan_duration_str);
-						harava::type_bundle value(command.args.at(0));
-						if (!value.valid)
+						const std::optional<harava::query> query = harava::query::parse("between " + command.args.at(0) + " " + command.args.at(1));
+						if (query.has_value())
+							run_query(query.value());
+					}
+				},
+				{
+					"=",
+					"",
+					"find values that have not changed since last scan",
+					0,
+					[&]
+					{
+						if (first_search)
+						{
+							std::cout << do_initial_search_notif_str << '\n';
 							return;
+						}
 
-						results = first_search
-							? process_memory->search(opts, filter, value, harava::comparison::ge)
-							: process_memory->refine_search(value, results, harava::comparison::ge);
-
-						first_search = false;
+						harava::scope_timer timer(scan_duration_str);
+						refine_change(harava::value_change::unchanged);
 						print_result_count();
 					}
 				},
 				{
-					"<=",
-					"[value]",
-					"find values lower than or equal to the given value",
-					1,
+					"!",
+					"",
+					"find values that have changed since last scan",
+					0,
 					[&]
 					{
-						harava::scope_timer timer(scan_duration_str);
-						harava::type_bundle value(command.args.at(0));
-						if (!value.valid)
+						if (first_search)
+						{
+							std::cout << do_initial_search_notif_str << '\n';
 							return;
+						}
 
-						results = first_search
-							? process_memory->search(opts, filter, value, harava::comparison::le)
-							: process_memory->refine_search(value, results, harava::comparison::le);
-
-						first_search = false;
+						harava::scope_timer timer(scan_duration_str);
+						refine_change(harava::value_change::changed);
 						print_result_count();
 					}
 				},
 				{
-					"=",
+					"+",
 					"",
-					"find values that have not changed since last scan",
+					"find values that have increased since last scan",
 					0,
 					[&]
 					{
@@ -228,14 +820,14 @@ namespace harava
 						}
 
 						harava::scope_timer timer(scan_duration_str);
-						results = process_memory->refine_search_change(results, true);
+						refine_change(harava::value_change::increased);
 						print_result_count();
 					}
 				},
 				{
-					"!",
+					"-",
 					"",
-					"find values that have changed since last scan",
+					"find values that have decreased since last scan",
 					0,
 					[&]
 					{
@@ -246,13 +838,69 @@ namespace harava
 						}
 
 						harava::scope_timer timer(scan_duration_str);
-						results = process_memory->refine_search_change(results, false);
+						refine_change(harava::value_change::decreased);
+						print_result_count();
+					}
+				},
+				{
+					"unknown",
+					"",
+					"take a snapshot of the memory to compare against when the initial value isn't known",
+					0,
+					[&]
+					{
+						harava::scope_timer timer(scan_duration_str);
+						results.clear();
+						unknown_snapshot = process_memory->take_snapshot();
+
+						if (unknown_snapshot.empty())
+							return;
+
+						first_search = false;
+						std::cout << "snapshot: " << unknown_snapshot.byte_count() / 1'000'000 << "MB ("
+							<< unknown_snapshot.total_size() / 1'000'000 << "MB without the zero pages)\n";
+					}
+				},
+				{
+					"aob",
+					"[pattern]",
+					"find a pattern of bytes like 48 8B ?? ?? 00 FF, ? matches any nibble",
+					-1,
+					[&]
+					{
+						std::string pattern_str;
+						for (const std::string& arg : command.args)
+							pattern_str += arg;
+
+						const std::optional<harava::byte_pattern> pattern = harava::byte_pattern::parse(pattern_str);
+						if (!pattern.has_value())
+							return;
+
+						harava::scope_timer timer(scan_duration_str);
+						unknown_snapshot.clear();
+						results = process_memory->search_pattern(opts, pattern.value());
+
+						first_search = false;
 						print_result_count();
 					}
 				},
+				{
+					"text",
+					"[-i] [text]",
+					"find utf-8 text, -i ignores the case of ascii letters",
+					-1,
+					[&] { search_text(command.args, harava::text_encoding::utf8); }
+				},
+				{
+					"text16",
+					"[-i] [text]",
+					"find utf-16 (little endian) text, -i ignores the case of ascii letters",
+					-1,
+					[&] { search_text(command.args, harava::text_encoding::utf16); }
+				},
 				{
 					"repeat",
-					"[!|=] [count]",
+					"[!|=|+|-] [count]",
 					"repeat a comparison multiple times in a row with a slight delay",
 					2,
 					[&]
@@ -289,11 +937,19 @@ namespace harava
 							switch (comparison)
 							{
 								case '!':
-									results = process_memory->refine_search_change(results, false);
+									refine_change(harava::value_change::changed);
 									break;
 
 								case '=':
-									results = process_memory->refine_search_change(results, true);
+									refine_change(harava::value_change::unchanged);
+									break;
+
+								case '+':
+									refine_change(harava::value_change::increased);
+									break;
+
+								case '-':
+									refine_change(harava::value_change::decreased);
 									break;
 
 								default:
@@ -319,7 +975,7 @@ namespace harava
 				},
 				{
 					"repeat",
-					"[!|=]",
+					"[!|=|+|-]",
 					"repeat a comparison until the result count stops changing",
 					1,
 					[&]
@@ -341,11 +997,19 @@ namespace harava
 							switch (comparison)
 							{
 								case '!':
-									results = process_memory->refine_search_change(results, false);
+									refine_change(harava::value_change::changed);
 									break;
 
 								case '=':
-									results = process_memory->refine_search_change(results, true);
+									refine_change(harava::value_change::unchanged);
+									break;
+
+								case '+':
+									refine_change(harava::value_change::increased);
+									break;
+
+								case '-':
+									refine_change(harava::value_change::decreased);
 									break;
 
 								default:
@@ -360,94 +1024,321 @@ namespace harava
 				{
 					"list",
 					"",
-					"list out all results found so far",
+					"list the first page of results",
 					0,
-					[&results, &process_memory]
+					[&] { list_results(0, default_page_size); }
+				},
+				{
+					"list",
+					"[offset]",
+					"list a page of results starting from the given index",
+					1,
+					[&]
+					{
+						const std::optional<u64> offset = parse_index(command.args.at(0));
+						if (offset.has_value())
+							list_results(offset.value(), default_page_size);
+					}
+				},
+				{
+					"list",
+					"[offset] [count]",
+					"list count results starting from the given index",
+					2,
+					[&]
+					{
+						const std::optional<u64> offset = parse_index(command.args.at(0));
+						const std::optional<u64> count = offset.has_value() ? parse_index(command.args.at(1)) : std::nullopt;
+						if (count.has_value())
+							list_results(offset.value(), count.value());
+					}
+				},
+				{
+					"watch",
+					"[indices] [hz]",
+					"sample results (like 0,2,5-9) hz times per second and show them until enter is pressed",
+					2,
+					[&] { watch_results(command.args.at(0), command.args.at(1), ""); }
+				},
+				{
+					"watch",
+					"[indices] [hz] [file]",
+					"same as above, and record the samples to a csv (.csv) or binary file",
+					3,
+					[&] { watch_results(command.args.at(0), command.args.at(1), command.args.at(2)); }
+				},
+				{
+					"set",
+					"[index] [value|text]",
+					"set a new value for a result",
+					-1,
+					[&]
 					{
-						u64 counter{0};
+						if (command.args.size() < 2)
+						{
+							std::cout << "missing the new value\n";
+							return;
+						}
+
+						i32 index{0};
 
-						const auto print_value = [&process_memory](const harava::result result)
+						try
 						{
-							switch (result.type)
-							{
-								case datatype::INT:
-									std::cout << std::dec << process_memory->get_result_value<i32>(result);
-									break;
+							index = std::stoi(command.args.at(0));
+						}
+						catch (const std::exception& e)
+						{
+							std::cout << "invalid argument: " << command.args.at(0) << '\n';
+							return;
+						}
 
-								case datatype::LONG:
-									std::cout << std::dec << process_memory->get_result_value<i64>(result);
-									break;
+						if (results.text().has_value())
+						{
+							const std::optional<harava::result> result = results.at(index);
+							if (result.has_value())
+								set_text(result.value(), join_args(command.args, 1));
 
-								case datatype::FLOAT:
-									std::cout << std::dec << process_memory->get_result_value<f32>(result);
-									break;
+							return;
+						}
 
-								case datatype::DOUBLE:
-									std::cout << std::dec << process_memory->get_result_value<f64>(result);
-									break;
-							}
-						};
+						if (command.args.size() != 2)
+						{
+							std::cout << "invalid argument: " << command.args.at(2) << '\n';
+							return;
+						}
+
+						const std::string& new_value = command.args.at(1);
+
+						harava::type_bundle value(new_value);
+						if (!value.valid)
+							return;
+
+						std::optional<harava::result> result = results.at(index);
+
+						if (!result.has_value())
+							return;
+
+						process_memory->set(result.value(), value);
+						results.update_value(index, result->value);
+					}
+				},
+				{
+					"setall",
+					"[-v] [value|text]",
+					"set a new value for all results, -v reads the values back to check that the writes stuck",
+					-1,
+					[&]
+					{
+						const bool verify = command.args.at(0) == "-v";
+						const size_t first_arg = verify ? 1 : 0;
+
+						if (command.args.size() <= first_arg)
+						{
+							std::cout << "missing the new value\n";
+							return;
+						}
 
-						const auto result_vecs = results.result_vecs();
+						// the value is converted once and written to every result of its type
+						std::array<std::vector<u8>, 4> values;
+						std::array<type_union, 4> new_values{};
+
+						if (results.text().has_value())
+						{
+							const std::optional<std::vector<u8>> bytes = encode_new_text(join_args(command.args, first_arg));
+							if (!bytes.has_value())
+								return;
 
-						for (const auto& [index, vec] : result_vecs)
+							values.fill(bytes.value());
+						}
+						else
 						{
-							for (const result r : *vec)
+							if (command.args.size() != first_arg + 1)
 							{
-								const u8 type_index = (static_cast<u8>(r.type) & 0xF0) >> 4UL;
-								std::cout << std::dec << "[" << counter++ << "] "
-									<< std::right << std::hex << std::setw(5) << r.location << " | "
-									<< datatype_names[type_index] << " | ";
+								std::cout << "invalid argument: " << command.args.at(first_arg + 1) << '\n';
+								return;
+							}
 
-								print_value(r);
-								std::cout << '\n';
+							const harava::type_bundle value(command.args.at(first_arg));
+							if (!value.valid)
+								return;
+
+							for (u8 i = 0; i < datatypes.size(); ++i)
+							{
+								const u8* data = reinterpret_cast<const u8*>(value.str_ptr.at(i));
+								values[i].assign(data, data + type_size(datatypes[i]));
+								memcpy(new_values[i].bytes, data, type_size(datatypes[i]));
 							}
 						}
+
+						harava::scope_timer timer("write duration: ");
+						const u64 failed = process_memory->set_all(results, values, verify);
+
+						if (!results.text().has_value())
+							results.update_all_values(new_values);
+
+						if (verify)
+							std::cout << failed << " of " << results.count() << " writes didn't stick\n";
 					}
 				},
 				{
-					"set",
-					"[index] [value]",
-					"set a new value for a result",
-					2,
-					[&command, &results, &process_memory]
+					"freeze",
+					"[index|all]",
+					"keep the current value of a result (or all of them) from changing",
+					1,
+					[&]
 					{
-						i32 index{0};
+						if (command.args.at(0) != "all")
+						{
+							const std::optional<u64> index = parse_index(command.args.at(0));
+							if (!index.has_value())
+								return;
 
-						try
+							const std::optional<harava::result> result = results.at(index.value());
+							if (result.has_value())
+								freeze_result(result.value(), result_bytes(result.value()));
+
+							return;
+						}
+
+						// the values are written on every tick, so freezing a
+						// huge amount of results would only hammer the target
+						constexpr u64 max_frozen_results = 1 << 16;
+						if (results.count() > max_frozen_results)
 						{
-							index = std::stoi(command.args.at(0));
+							std::cout << "too many results to freeze (" << results.count() << "), narrow them down first\n";
+							return;
 						}
-						catch (const std::exception& e)
+
+						results.for_each([&](const harava::result& result)
 						{
-							std::cout << "invalid argument: " << command.args.at(0) << '\n';
+							freeze_result(result, result_bytes(result));
+						});
+
+						std::cout << "frozen: " << freezer.values().size() << '\n';
+					}
+				},
+				{
+					"freeze",
+					"[index] [value|text]",
+					"keep writing a value to a result",
+					-1,
+					[&]
+					{
+						const std::optional<u64> index = parse_index(command.args.at(0));
+						if (!index.has_value())
+							return;
+
+						const std::optional<harava::result> result = results.at(index.value());
+						if (!result.has_value())
+							return;
+
+						if (results.text().has_value())
+						{
+							const std::optional<std::vector<u8>> bytes = encode_new_text(join_args(command.args, 1));
+							if (bytes.has_value())
+								freeze_result(result.value(), bytes.value());
+
 							return;
 						}
 
-						const std::string& new_value = command.args.at(1);
+						if (command.args.size() != 2)
+						{
+							std::cout << "invalid argument: " << command.args.at(2) << '\n';
+							return;
+						}
 
-						harava::type_bundle value(new_value);
+						harava::type_bundle value(command.args.at(1));
 						if (!value.valid)
 							return;
 
-						std::optional<result*> result = results.at(index);
-
-						if (result.has_value())
-							process_memory->set(*result.value(), value);
+						const char* data = value.str_ptr.at(type_index(result->type));
+						freeze_result(result.value(), std::vector<u8>(data, data + type_size(result->type)));
 					}
 				},
 				{
-					"setall",
-					"[value]",
-					"set a new value for all results",
+					"unfreeze",
+					"[index|all]",
+					"stop freezing a value, the index is from the frozen list",
 					1,
-					[&command, &results, &process_memory]
+					[&]
 					{
-						for (auto& [index, vec] : results.result_vecs())
+						if (command.args.at(0) == "all")
 						{
-							for (harava::result& r : *vec)
-								process_memory->set(r, command.args.at(0));
+							freezer.clear();
+							return;
 						}
+
+						const std::optional<u64> index = parse_index(command.args.at(0));
+						if (index.has_value() && !freezer.unfreeze(index.value()))
+							std::cout << "out-of-bounds index\n";
+					}
+				},
+				{
+					"frozen",
+					"",
+					"list the frozen values",
+					0,
+					[&]
+					{
+						const std::vector<harava::freezer::frozen_value> values = freezer.values();
+						for (u64 i = 0; i < values.size(); ++i)
+							std::cout << std::dec << "[" << i << "] " << std::hex << values[i].address << std::dec << " | " << values[i].description << '\n';
+
+						std::cout << "written " << freezer.rate() << " times per second";
+						if (freezer.failed_bytes() != 0)
+							std::cout << ", " << freezer.failed_bytes() << " bytes couldn't be written during the last tick";
+
+						std::cout << '\n';
+					}
+				},
+				{
+					"pointerscan",
+					"[index] [max_depth] [max_offset]",
+					"find pointer chains from static addresses to a result, the offset is in hex",
+					3,
+					[&]
+					{
+						pointer_scan(command.args.at(0), command.args.at(1), command.args.at(2), "");
+					}
+				},
+				{
+					"pointerscan",
+					"[index] [max_depth] [max_offset] [file]",
+					"same as above, and write the chains to a file",
+					4,
+					[&]
+					{
+						pointer_scan(command.args.at(0), command.args.at(1), command.args.at(2), command.args.at(3));
+					}
+				},
+				{
+					"pointercheck",
+					"[file]",
+					"show where the chains in a file lead to",
+					1,
+					[&]
+					{
+						check_pointers(command.args.at(0), "");
+					}
+				},
+				{
+					"pointercheck",
+					"[file] [index]",
+					"keep the chains in a file that still lead to a result, like after restarting the target",
+					2,
+					[&]
+					{
+						check_pointers(command.args.at(0), command.args.at(1));
+					}
+				},
+				{
+					"stats",
+					"",
+					"show where the time went during the latest scan or refinement",
+					0,
+					[&process_memory]
+					{
+						process_memory->last_metrics().print();
 					}
 				},
 				{
@@ -497,18 +1388,52 @@ namespace harava
 							*type_filter_mappings.at(*it) = true;
 					}
 				},
+				{
+					"save",
+					"[file]",
+					"save the results (and the snapshot of an unknown scan) to continue later with load",
+					1,
+					[&]
+					{
+						process_memory->save(command.args.at(0), results, unknown_snapshot);
+					}
+				},
+				{
+					"load",
+					"[file]",
+					"continue a saved session, the results in regions that aren't mapped anymore are left out",
+					1,
+					[&]
+					{
+						if (!process_memory->load(command.args.at(0), results, unknown_snapshot))
+							return;
+
+						first_search = results.count() == 0 && unknown_snapshot.empty();
+					}
+				},
+				{
+					"refresh",
+					"",
+					"update the regions after the process has mapped or unmapped memory, the search continues where it was",
+					0,
+					[&]
+					{
+						process_memory->refresh(results, unknown_snapshot);
+					}
+				},
 				{
 					"reset",
 					"",
 					"clear the result list and start a new search",
 					0,
-					[&results, &first_search, &process_memory, opts]
+					[&results, &unknown_snapshot, &first_search, &process_memory]
 					{
 						results.clear();
+						unknown_snapshot.clear();
 						first_search = true;
 
-						process_memory.reset();
-						process_memory = std::make_unique<harava::memory>(opts.pid, opts);
+						// with nothing to keep, this only picks up the current regions
+						process_memory->refresh(results, unknown_snapshot);
 					}
 				}
 			};
@@ -525,7 +1450,21 @@ namespace harava
 
 			if (command_to_run == commands.end())
 			{
-				std::cout << "unknown command\n";
+				// lines that start like a condition are parsed as queries
+				const bool query_like = command.cmd == "between"
+					|| std::find(datatype_names.begin(), datatype_names.end(), command.cmd) != datatype_names.end()
+					|| std::string("=<>").find(command.cmd.front()) != std::string::npos;
+
+				if (!query_like)
+				{
+					std::cout << "unknown command\n";
+					continue;
+				}
+
+				const std::optional<harava::query> query = harava::query::parse(buffer);
+				if (query.has_value())
+					run_query(query.value());
+
 				continue;
 			}
 
@@ -0,0 +1,189 @@
+#include "Snapshot.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace harava
+{
+	snapshot::chunk snapshot::compress(const u16 region_id, const u64 location, const u8* bytes, const u64 size)
+	{
+		chunk chunk{ region_id, location, size, {}, {}, {} };
+
+		std::vector<u32> page_indices;
+		page_indices.reserve((size + page_size - 1) / page_size);
+
+		for (u64 offset = 0; offset < size; offset += page_size)
+		{
+			const u64 bytes_left = std::min(page_size, size - offset);
+
+			if (std::all_of(bytes + offset, bytes + offset + bytes_left, [](const u8 byte) { return byte == 0; }))
+			{
+				page_indices.push_back(zero_page);
+				continue;
+			}
+
+			// the last page of the chunk gets padded with zeroes
+			page_indices.push_back(chunk.pages.size() / page_size);
+			chunk.pages.resize(chunk.pages.size() + page_size);
+			memcpy(&chunk.pages[chunk.pages.size() - page_size], bytes + offset, bytes_left);
+		}
+
+		chunk.page_indices = column<u32>(std::move(page_indices));
+		chunk.pages.shrink_to_fit();
+		return chunk;
+	}
+
+	bool snapshot::chunk::spill(const std::shared_ptr<spill_file>& file)
+	{
+		spill_storage = file;
+		return pages.spill(*file);
+	}
+
+	void snapshot::add_chunk(chunk&& chunk)
+	{
+		assert(chunks.empty()
+			|| chunks.back().region_id < chunk.region_id
+			|| (chunks.back().region_id == chunk.region_id && chunks.back().location < chunk.location));
+
+		chunks.emplace_back(std::move(chunk));
+	}
+
+	void snapshot::merge(snapshot&& other)
+	{
+		const auto middle = chunks.insert(chunks.end(), std::make_move_iterator(other.chunks.begin()), std::make_move_iterator(other.chunks.end()));
+		other.clear();
+
+		std::inplace_merge(chunks.begin(), middle, chunks.end(), [](const chunk& a, const chunk& b)
+		{
+			return a.region_id < b.region_id || (a.region_id == b.region_id && a.location < b.location);
+		});
+	}
+
+	void snapshot::move_regions(const std::vector<region_move>& moves)
+	{
+		std::vector<chunk> moved;
+		std::vector<u8> bytes;
+
+		for (chunk& chunk : chunks)
+		{
+			const u64 chunk_end = chunk.location + chunk.size;
+			auto move = first_move(moves, chunk.region_id, chunk.location);
+
+			// most chunks stay where they were, at most the id of their region changes
+			if (move != moves.end() && move->region_id == chunk.region_id && move->first <= chunk.location && chunk_end <= move->last
+				&& move->new_first == move->first)
+			{
+				chunk.region_id = move->new_region_id;
+				moved.emplace_back(std::move(chunk));
+				continue;
+			}
+
+			// the parts that are still mapped get compressed again at their new locations
+			for (; move != moves.end() && move->region_id == chunk.region_id && move->first < chunk_end; ++move)
+			{
+				const u64 first = std::max(chunk.location, move->first);
+				const u64 last = std::min(chunk_end, move->last);
+
+				bytes.resize(last - first);
+				copy_bytes(chunk, first - chunk.location, bytes.data(), bytes.size());
+				moved.emplace_back(compress(move->new_region_id, first - move->first + move->new_first, bytes.data(), bytes.size()));
+			}
+		}
+
+		std::sort(moved.begin(), moved.end(), [](const snapshot::chunk& a, const snapshot::chunk& b)
+		{
+			return a.region_id < b.region_id || (a.region_id == b.region_id && a.location < b.location);
+		});
+
+		chunks = std::move(moved);
+	}
+
+	void snapshot::read(const u16 region_id, const u64 location, u8* destination, const u64 size) const
+	{
+		// find the last chunk that starts before the location
+		auto it = std::upper_bound(chunks.begin(), chunks.end(), std::make_pair(region_id, location), [](const auto& key, const chunk& chunk)
+		{
+			return key.first < chunk.region_id || (key.first == chunk.region_id && key.second < chunk.location);
+		});
+
+		if (it != chunks.begin())
+			--it;
+
+		u64 done{0};
+		while (done < size)
+		{
+			const u64 current = location + done;
+
+			if (it == chunks.end() || it->region_id != region_id || current < it->location || current >= it->location + it->size) [[unlikely]]
+			{
+				memset(destination + done, 0, size - done);
+				return;
+			}
+
+			const u64 offset = current - it->location;
+			const u64 count = std::min(size - done, it->size - offset);
+
+			copy_bytes(*it, offset, destination + done, count);
+			done += count;
+			++it;
+		}
+	}
+
+	void snapshot::copy_bytes(const chunk& chunk, const u64 offset, u8* destination, const u64 size)
+	{
+		for (u64 done = 0; done < size;)
+		{
+			const u64 page = (offset + done) / page_size;
+			const u64 page_offset = (offset + done) % page_size;
+			const u64 count = std::min(size - done, page_size - page_offset);
+
+			if (chunk.page_indices[page] == zero_page)
+				memset(destination + done, 0, count);
+			else
+				memcpy(destination + done, &chunk.pages[chunk.page_indices[page] * page_size + page_offset], count);
+
+			done += count;
+		}
+	}
+
+	bool snapshot::empty() const
+	{
+		return chunks.empty();
+	}
+
+	void snapshot::clear()
+	{
+		chunks.clear();
+		chunks.shrink_to_fit();
+		dirty_epoch = 0;
+	}
+
+	void snapshot::set_soft_dirty_epoch(const u64 epoch)
+	{
+		dirty_epoch = epoch;
+	}
+
+	u64 snapshot::soft_dirty_epoch() const
+	{
+		return dirty_epoch;
+	}
+
+	u64 snapshot::byte_count() const
+	{
+		u64 count{0};
+		for (const chunk& chunk : chunks)
+			count += chunk.size;
+
+		return count;
+	}
+
+	u64 snapshot::total_size() const
+	{
+		u64 size = chunks.capacity() * sizeof(chunk);
+		for (const chunk& chunk : chunks)
+			size += chunk.page_indices.memory_size() + chunk.pages.memory_size();
+
+		return size;
+	}
+}
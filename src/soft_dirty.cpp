@@ -0,0 +1,141 @@
+#include "SoftDirty.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+namespace harava
+{
+	static constexpr u64 soft_dirty_bit = 1ULL << 55;
+
+	// pagemap entries read with a single pread
+	static constexpr u64 pagemap_batch = 8192;
+
+	static bool write_clear_refs(const std::string& path)
+	{
+		const int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+		if (fd == -1)
+			return false;
+
+		const bool written = write(fd, "4", 1) == 1;
+		close(fd);
+		return written;
+	}
+
+	static bool read_pagemap_entry(const int fd, const void* address, u64& entry)
+	{
+		const off_t offset = reinterpret_cast<u64>(address) / soft_dirty_tracker::page_size * sizeof(u64);
+		return pread(fd, &entry, sizeof(entry), offset) == sizeof(entry);
+	}
+
+	// clear_refs accepts the soft-dirty request even if the kernel was built
+	// without CONFIG_MEM_SOFT_DIRTY, in which case the bit is never set, so
+	// check that the bit works on a page of our own before trusting it
+	static bool kernel_support()
+	{
+		if (static_cast<u64>(sysconf(_SC_PAGESIZE)) != soft_dirty_tracker::page_size)
+			return false;
+
+		void* page = mmap(nullptr, soft_dirty_tracker::page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (page == MAP_FAILED) [[unlikely]]
+			return false;
+
+		bool supported{false};
+		const int fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+
+		if (fd != -1)
+		{
+			volatile u8* byte = static_cast<volatile u8*>(page);
+			*byte = 1;
+
+			u64 clean_entry{0}, dirty_entry{0};
+			if (write_clear_refs("/proc/self/clear_refs") && read_pagemap_entry(fd, page, clean_entry))
+			{
+				*byte = 2;
+				supported = read_pagemap_entry(fd, page, dirty_entry)
+					&& !(clean_entry & soft_dirty_bit)
+					&& (dirty_entry & soft_dirty_bit);
+			}
+
+			close(fd);
+		}
+
+		munmap(page, soft_dirty_tracker::page_size);
+		return supported;
+	}
+
+	soft_dirty_tracker::soft_dirty_tracker(const i32 pid, const bool enabled)
+	:clear_refs_path("/proc/" + std::to_string(pid) + "/clear_refs")
+	{
+		if (!enabled || !kernel_support())
+			return;
+
+		const std::string pagemap_path = "/proc/" + std::to_string(pid) + "/pagemap";
+		pagemap_fd = open(pagemap_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+		if (pagemap_fd == -1) [[unlikely]]
+			std::cout << "can't open " << pagemap_path << ": " << strerror(errno) << '\n';
+	}
+
+	soft_dirty_tracker::~soft_dirty_tracker()
+	{
+		if (pagemap_fd != -1)
+			close(pagemap_fd);
+	}
+
+	bool soft_dirty_tracker::available() const
+	{
+		return pagemap_fd != -1;
+	}
+
+	void soft_dirty_tracker::clear()
+	{
+		if (!available())
+			return;
+
+		if (!write_clear_refs(clear_refs_path)) [[unlikely]]
+		{
+			std::cout << "can't clear the soft-dirty bits: " << strerror(errno) << '\n';
+			close(pagemap_fd);
+			pagemap_fd = -1;
+			current_epoch = 0;
+			return;
+		}
+
+		++current_epoch;
+	}
+
+	u64 soft_dirty_tracker::epoch() const
+	{
+		return current_epoch;
+	}
+
+	bool soft_dirty_tracker::dirty_pages(const size_t address, const u64 pages, u64* dirty) const
+	{
+		if (current_epoch == 0)
+			return false;
+
+		std::vector<u64> entries(std::min(pages, pagemap_batch));
+		const u64 first_page = address / page_size;
+
+		for (u64 done = 0; done < pages; done += entries.size())
+		{
+			const u64 count = std::min<u64>(entries.size(), pages - done);
+			const ssize_t bytes = pread(pagemap_fd, entries.data(), count * sizeof(u64), (first_page + done) * sizeof(u64));
+
+			if (bytes != static_cast<ssize_t>(count * sizeof(u64))) [[unlikely]]
+				return false;
+
+			for (u64 i = 0; i < count; ++i)
+				if (entries[i] & soft_dirty_bit)
+					dirty[(done + i) / 64] |= 1ULL << ((done + i) % 64);
+		}
+
+		return true;
+	}
+}
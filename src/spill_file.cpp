@@ -0,0 +1,208 @@
+#include "SpillFile.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace harava
+{
+	// extents are allocated at least this big to keep the amount of mappings low
+	static constexpr u64 min_extent_size = 256UL * 1024 * 1024;
+
+	// allocations are aligned so that the columns in the file can be read with vector loads
+	static constexpr u64 allocation_alignment = 64;
+
+	spill_file::spill_file(const std::string& directory)
+	{
+		// the file doesn't have a name, so it disappears with the last reference
+		fd = open(directory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+
+		// not all filesystems support O_TMPFILE
+		if (fd == -1)
+		{
+			std::string path = directory + "/harava-spill-XXXXXX";
+			fd = mkostemp(path.data(), O_CLOEXEC);
+
+			if (fd != -1)
+				unlink(path.c_str());
+		}
+
+		if (fd == -1) [[unlikely]]
+			std::cout << "can't create a spill file to " << directory << ": " << strerror(errno) << '\n';
+	}
+
+	spill_file::~spill_file()
+	{
+		for (const extent& extent : extents)
+			munmap(extent.address, extent.size);
+
+		if (fd != -1)
+			close(fd);
+	}
+
+	std::shared_ptr<spill_file> spill_file::map_existing(const std::string& path)
+	{
+		std::shared_ptr<spill_file> file(new spill_file());
+
+		file->fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (file->fd == -1) [[unlikely]]
+		{
+			std::cout << "can't open " << path << ": " << strerror(errno) << '\n';
+			return nullptr;
+		}
+
+		const off_t size = lseek(file->fd, 0, SEEK_END);
+		if (size <= 0) [[unlikely]]
+		{
+			std::cout << path << " is empty\n";
+			return nullptr;
+		}
+
+		// private mappings can be written to without touching the file
+		void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file->fd, 0);
+		if (address == MAP_FAILED) [[unlikely]]
+		{
+			std::cout << "can't map " << path << ": " << strerror(errno) << '\n';
+			return nullptr;
+		}
+
+		file->extents.push_back({ static_cast<u8*>(address), static_cast<u64>(size), static_cast<u64>(size) });
+		file->file_size = size;
+		file->allocated = size;
+
+		return file;
+	}
+
+	bool spill_file::valid() const
+	{
+		return fd != -1;
+	}
+
+	u8* spill_file::data() const
+	{
+		return extents.empty() ? nullptr : extents.front().address;
+	}
+
+	u8* spill_file::allocate(const u64 size)
+	{
+		const u64 aligned_size = (size + allocation_alignment - 1) / allocation_alignment * allocation_alignment;
+
+		std::lock_guard<std::mutex> guard(mutex);
+
+		if (extents.empty() || extents.back().used + aligned_size > extents.back().size)
+		{
+			const u64 extent_size = std::max(min_extent_size, (aligned_size + min_extent_size - 1) / min_extent_size * min_extent_size);
+
+			if (ftruncate(fd, file_size + extent_size) != 0) [[unlikely]]
+			{
+				std::cout << "can't grow the spill file: " << strerror(errno) << '\n';
+				return nullptr;
+			}
+
+			void* address = mmap(nullptr, extent_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, file_size);
+			if (address == MAP_FAILED) [[unlikely]]
+			{
+				std::cout << "can't map the spill file: " << strerror(errno) << '\n';
+				return nullptr;
+			}
+
+			// spilled data gets streamed through in order
+			madvise(address, extent_size, MADV_SEQUENTIAL);
+
+			extents.push_back({ static_cast<u8*>(address), extent_size, 0 });
+			file_size += extent_size;
+		}
+
+		extent& extent = extents.back();
+		u8* address = extent.address + extent.used;
+		extent.used += aligned_size;
+		allocated += aligned_size;
+
+		return address;
+	}
+
+	u8* spill_file::store(const void* bytes, const u64 size)
+	{
+		u8* address = allocate(size);
+		if (address != nullptr) [[likely]]
+			memcpy(address, bytes, size);
+
+		return address;
+	}
+
+	u64 spill_file::size() const
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		return allocated;
+	}
+
+	void spill_file::release(const void* address, const u64 size)
+	{
+		// the pages are written back to the file before they get dropped,
+		// so only the whole pages inside of the range can be released
+		const u64 page = sysconf(_SC_PAGESIZE);
+		const u64 start = (reinterpret_cast<u64>(address) + page - 1) / page * page;
+		const u64 end = (reinterpret_cast<u64>(address) + size) / page * page;
+
+#ifdef MADV_PAGEOUT
+		if (end > start)
+			madvise(reinterpret_cast<void*>(start), end - start, MADV_PAGEOUT);
+#endif
+	}
+
+	memory_budget::memory_budget(const u64 limit, const u64 used)
+	:limit(limit), used(used)
+	{}
+
+	bool memory_budget::reserve(const u64 bytes)
+	{
+		if (used.fetch_add(bytes) + bytes <= limit) [[likely]]
+			return true;
+
+		used -= bytes;
+		return false;
+	}
+
+	std::shared_ptr<spill_file> memory_budget::results_file()
+	{
+		return open_file(results_spill);
+	}
+
+	std::shared_ptr<spill_file> memory_budget::scratch_file()
+	{
+		return open_file(scratch_spill);
+	}
+
+	u64 memory_budget::spilled() const
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		return (results_spill ? results_spill->size() : 0) + (scratch_spill ? scratch_spill->size() : 0);
+	}
+
+	std::shared_ptr<spill_file> memory_budget::open_file(std::shared_ptr<spill_file>& file)
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+
+		// if the file can't be created, everything stays in the memory
+		// like it would without the spill files
+		if (!file && !spill_failed)
+		{
+			std::error_code error;
+			const std::filesystem::path directory = std::filesystem::temp_directory_path(error);
+
+			file = std::make_shared<spill_file>(error ? "/tmp" : directory.string());
+			if (!file->valid()) [[unlikely]]
+			{
+				file.reset();
+				spill_failed = true;
+			}
+		}
+
+		return file;
+	}
+}
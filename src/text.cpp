@@ -0,0 +1,262 @@
+#include "Text.hpp"
+
+#include <iostream>
+
+namespace harava
+{
+	// decode the utf-8 code points of a string, returns nothing for invalid utf-8
+	static std::optional<std::vector<u32>> decode_utf8(const u8* bytes, const u64 size)
+	{
+		std::vector<u32> code_points;
+
+		for (u64 i = 0; i < size;)
+		{
+			const u8 lead = bytes[i];
+			u8 length{0};
+			u32 code_point{0};
+
+			if (lead < 0x80)
+			{
+				length = 1;
+				code_point = lead;
+			}
+			else if ((lead & 0xE0) == 0xC0)
+			{
+				length = 2;
+				code_point = lead & 0x1F;
+			}
+			else if ((lead & 0xF0) == 0xE0)
+			{
+				length = 3;
+				code_point = lead & 0x0F;
+			}
+			else if ((lead & 0xF8) == 0xF0)
+			{
+				length = 4;
+				code_point = lead & 0x07;
+			}
+			else
+			{
+				return {};
+			}
+
+			if (i + length > size)
+				return {};
+
+			for (u8 j = 1; j < length; ++j)
+			{
+				if ((bytes[i + j] & 0xC0) != 0x80)
+					return {};
+
+				code_point = code_point << 6 | (bytes[i + j] & 0x3F);
+			}
+
+			// overlong encodings and surrogates aren't valid utf-8
+			constexpr u32 min_code_point[] = { 0, 0, 0x80, 0x800, 0x10000 };
+			if (code_point < min_code_point[length] || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point <= 0xDFFF))
+				return {};
+
+			code_points.push_back(code_point);
+			i += length;
+		}
+
+		return code_points;
+	}
+
+	static void append_utf8(std::string& text, const u32 code_point)
+	{
+		if (code_point < 0x80)
+		{
+			text += static_cast<char>(code_point);
+		}
+		else if (code_point < 0x800)
+		{
+			text += static_cast<char>(0xC0 | code_point >> 6);
+			text += static_cast<char>(0x80 | (code_point & 0x3F));
+		}
+		else if (code_point < 0x10000)
+		{
+			text += static_cast<char>(0xE0 | code_point >> 12);
+			text += static_cast<char>(0x80 | (code_point >> 6 & 0x3F));
+			text += static_cast<char>(0x80 | (code_point & 0x3F));
+		}
+		else
+		{
+			text += static_cast<char>(0xF0 | code_point >> 18);
+			text += static_cast<char>(0x80 | (code_point >> 12 & 0x3F));
+			text += static_cast<char>(0x80 | (code_point >> 6 & 0x3F));
+			text += static_cast<char>(0x80 | (code_point & 0x3F));
+		}
+	}
+
+	std::optional<std::vector<u8>> encode_text(const std::string& text, const text_encoding encoding)
+	{
+		const std::optional<std::vector<u32>> code_points = decode_utf8(reinterpret_cast<const u8*>(text.data()), text.size());
+		if (!code_points.has_value())
+		{
+			std::cout << "invalid utf-8 text: " << text << '\n';
+			return {};
+		}
+
+		if (encoding == text_encoding::utf8)
+			return std::vector<u8>(text.begin(), text.end());
+
+		std::vector<u8> bytes;
+		const auto append_unit = [&bytes](const u16 unit)
+		{
+			bytes.push_back(unit & 0xFF);
+			bytes.push_back(unit >> 8);
+		};
+
+		for (const u32 code_point : code_points.value())
+		{
+			if (code_point < 0x10000)
+			{
+				append_unit(code_point);
+				continue;
+			}
+
+			append_unit(0xD800 | (code_point - 0x10000) >> 10);
+			append_unit(0xDC00 | ((code_point - 0x10000) & 0x3FF));
+		}
+
+		return bytes;
+	}
+
+	std::string decode_text(const u8* bytes, const u64 size, const text_encoding encoding)
+	{
+		std::string text;
+
+		const auto append = [&text](const u32 code_point)
+		{
+			if (code_point < 0x20 || code_point == 0x7F)
+				text += '.';
+			else
+				append_utf8(text, code_point);
+		};
+
+		if (encoding == text_encoding::utf8)
+		{
+			for (u64 i = 0; i < size;)
+			{
+				// decode one character at a time so that broken bytes only replace themselves
+				const u8 lead = bytes[i];
+				const u8 length = lead < 0x80 ? 1 : (lead & 0xE0) == 0xC0 ? 2 : (lead & 0xF0) == 0xE0 ? 3 : (lead & 0xF8) == 0xF0 ? 4 : 0;
+				const std::optional<std::vector<u32>> code_point = length == 0 || i + length > size
+					? std::nullopt
+					: decode_utf8(bytes + i, length);
+
+				if (!code_point.has_value())
+				{
+					text += '.';
+					++i;
+					continue;
+				}
+
+				append(code_point->front());
+				i += length;
+			}
+
+			return text;
+		}
+
+		for (u64 i = 0; i + 1 < size; i += 2)
+		{
+			const u16 unit = bytes[i] | bytes[i + 1] << 8;
+
+			if (unit >= 0xD800 && unit <= 0xDBFF && i + 3 < size)
+			{
+				const u16 low = bytes[i + 2] | bytes[i + 3] << 8;
+				if (low >= 0xDC00 && low <= 0xDFFF)
+				{
+					append(0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00));
+					i += 2;
+					continue;
+				}
+			}
+
+			if (unit >= 0xD800 && unit <= 0xDFFF)
+				text += '.';
+			else
+				append(unit);
+		}
+
+		return text;
+	}
+
+	std::optional<text_pattern> text_pattern::parse(const std::string& text, const text_encoding encoding, const bool ignore_case)
+	{
+		if (text.empty())
+		{
+			std::cout << "the text can't be empty\n";
+			return {};
+		}
+
+		const std::optional<std::vector<u8>> bytes = encode_text(text, encoding);
+		if (!bytes.has_value())
+			return {};
+
+		text_pattern pattern;
+		pattern.text_encoding_type = encoding;
+		pattern.values = bytes.value();
+		pattern.folds.resize(pattern.values.size());
+
+		// ascii letters only differ by the 0x20 bit, and in utf-16 they are
+		// always the low byte of a unit that has a zero high byte
+		const u8 unit_size = encoding == text_encoding::utf16 ? 2 : 1;
+		for (u64 i = 0; ignore_case && i < pattern.values.size(); i += unit_size)
+		{
+			const u8 byte = pattern.values[i];
+			const bool ascii = unit_size == 1 || pattern.values[i + 1] == 0;
+
+			if (ascii && ((byte >= 'A' && byte <= 'Z') || (byte >= 'a' && byte <= 'z')))
+			{
+				pattern.values[i] = byte | 0x20;
+				pattern.folds[i] = 0x20;
+			}
+		}
+
+		return pattern;
+	}
+
+	text_encoding text_pattern::encoding() const
+	{
+		return text_encoding_type;
+	}
+
+	u64 text_pattern::size() const
+	{
+		return values.size();
+	}
+
+	u64 text_pattern::first_anchor() const
+	{
+		return 0;
+	}
+
+	u64 text_pattern::second_anchor() const
+	{
+		// the high byte of the last utf-16 unit is usually zero, so the
+		// low byte tells more about the last character
+		return text_encoding_type == text_encoding::utf16 ? values.size() - 2 : values.size() - 1;
+	}
+
+	u8 text_pattern::at(const u64 offset) const
+	{
+		return values[offset];
+	}
+
+	u8 text_pattern::fold(const u64 offset) const
+	{
+		return folds[offset];
+	}
+
+	bool text_pattern::matches(const u8* bytes) const
+	{
+		for (u64 i = 0; i < values.size(); ++i)
+			if ((bytes[i] | folds[i]) != values[i])
+				return false;
+
+		return true;
+	}
+}
@@ -0,0 +1,181 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace harava
+{
+	static thread_local const thread_pool* current_pool = nullptr;
+	static thread_local u32 current_worker_index = 0;
+
+	thread_pool::thread_pool(const u32 thread_count)
+	{
+		const u32 count = thread_count == 0
+			? std::max(1U, std::thread::hardware_concurrency())
+			: thread_count;
+
+		for (u32 i = 0; i < count + 1; ++i)
+			queues.emplace_back(std::make_unique<task_queue>());
+
+		for (u32 i = 0; i < count; ++i)
+			threads.emplace_back(&thread_pool::worker_loop, this, i);
+	}
+
+	thread_pool::~thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> guard(sleep_mutex);
+			stopping = true;
+		}
+		wake_up.notify_all();
+
+		for (std::thread& thread : threads)
+			thread.join();
+	}
+
+	void thread_pool::submit(std::function<void()> task)
+	{
+		// tasks submitted from a worker go to its own queue so that
+		// related work stays on the same thread unless it gets stolen
+		task_queue& queue = *queues[worker_index()];
+
+		{
+			std::lock_guard<std::mutex> guard(sleep_mutex);
+			++queued_tasks;
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(queue.mutex);
+			queue.tasks.push_back(std::move(task));
+		}
+
+		wake_up.notify_one();
+	}
+
+	bool thread_pool::run_pending_task()
+	{
+		std::function<void()> task;
+		if (!pop_task(worker_index(), task))
+			return false;
+
+		task();
+		return true;
+	}
+
+	u32 thread_pool::size() const
+	{
+		return threads.size();
+	}
+
+	u32 thread_pool::worker_index() const
+	{
+		return current_pool == this ? current_worker_index : threads.size();
+	}
+
+	void thread_pool::worker_loop(const u32 index)
+	{
+		current_pool = this;
+		current_worker_index = index;
+
+		while (true)
+		{
+			std::function<void()> task;
+			if (pop_task(index, task))
+			{
+				task();
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(sleep_mutex);
+			wake_up.wait(lock, [this] { return stopping || queued_tasks > 0; });
+
+			if (stopping && queued_tasks == 0)
+				return;
+		}
+	}
+
+	bool thread_pool::pop_task(const u32 index, std::function<void()>& task)
+	{
+		if (queued_tasks == 0)
+			return false;
+
+		// the newest task from the own queue is the most likely
+		// to still have its data in the cache
+		{
+			task_queue& queue = *queues[index];
+			std::lock_guard<std::mutex> guard(queue.mutex);
+			if (!queue.tasks.empty())
+			{
+				task = std::move(queue.tasks.back());
+				queue.tasks.pop_back();
+				--queued_tasks;
+				return true;
+			}
+		}
+
+		// steal the oldest task from some other queue
+		for (u32 i = 1; i < queues.size(); ++i)
+		{
+			task_queue& queue = *queues[(index + i) % queues.size()];
+			std::lock_guard<std::mutex> guard(queue.mutex);
+			if (!queue.tasks.empty())
+			{
+				task = std::move(queue.tasks.front());
+				queue.tasks.pop_front();
+				--queued_tasks;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	task_group::task_group(thread_pool& pool)
+	:pool(pool)
+	{}
+
+	task_group::~task_group()
+	{
+		wait();
+	}
+
+	void task_group::run(std::function<void()> task)
+	{
+		++remaining;
+		pool.submit([this, task = std::move(task)]
+		{
+			task();
+
+			std::lock_guard<std::mutex> guard(finish_mutex);
+			if (--remaining == 0)
+				finished.notify_all();
+		});
+	}
+
+	void task_group::wait()
+	{
+		// help out with the queued tasks, and if there is nothing
+		// left to do, sleep until the running tasks have finished
+		while (remaining > 0)
+		{
+			if (pool.run_pending_task())
+				continue;
+
+			std::unique_lock<std::mutex> lock(finish_mutex);
+			finished.wait(lock, [this] { return remaining == 0; });
+		}
+
+		// make sure that the last task has let go of the mutex
+		std::lock_guard<std::mutex> guard(finish_mutex);
+	}
+
+	void parallel_for(thread_pool& pool, const u64 count, const std::function<void(const u64)>& task)
+	{
+		task_group group(pool);
+
+		for (u64 i = 0; i < count; ++i)
+			group.run([&task, i] { task(i); });
+
+		group.wait();
+	}
+}
@@ -0,0 +1,132 @@
+#include "Writer.hpp"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+namespace harava
+{
+	// same limit as with the reads
+	static constexpr size_t max_transfer_size = 1UL << 30;
+
+	writer::writer(const i32 pid)
+	:pid(pid), mem_path("/proc/" + std::to_string(pid) + "/mem")
+	{}
+
+	writer::~writer()
+	{
+		if (fd != -1)
+			close(fd);
+	}
+
+	size_t writer::write_fallback(const u8* source, const size_t address, const size_t size)
+	{
+		// the mem file is only needed if something can't be written with process_vm_writev
+		if (fd == -1)
+			fd = open(mem_path.c_str(), O_WRONLY);
+
+		if (fd == -1) [[unlikely]]
+			return 0;
+
+		size_t written{0};
+		while (written < size)
+		{
+			const ssize_t bytes = pwrite(fd, source + written, size - written, address + written);
+			if (bytes <= 0) [[unlikely]]
+				break;
+
+			written += bytes;
+		}
+
+		return written;
+	}
+
+	size_t writer::write(std::span<const write_span> spans)
+	{
+		std::vector<iovec> local, remote;
+		local.reserve(std::min<size_t>(spans.size(), IOV_MAX));
+		remote.reserve(std::min<size_t>(spans.size(), IOV_MAX));
+
+		size_t total_written{0};
+
+		const auto flush = [&]()
+		{
+			size_t first = 0;
+			while (first < local.size())
+			{
+				size_t batch_size{0};
+				for (size_t i = first; i < local.size(); ++i)
+					batch_size += local[i].iov_len;
+
+				const ssize_t bytes = process_vm_writev(pid, &local[first], local.size() - first, &remote[first], remote.size() - first, 0);
+
+				if (bytes == static_cast<ssize_t>(batch_size)) [[likely]]
+				{
+					total_written += bytes;
+					break;
+				}
+
+				// the write stopped at an element that couldn't be written, write
+				// the rest of it through the mem file and continue after it
+				size_t consumed = std::max<ssize_t>(bytes, 0);
+				total_written += consumed;
+
+				while (consumed >= local[first].iov_len)
+				{
+					consumed -= local[first].iov_len;
+					++first;
+				}
+
+				const u8* source = static_cast<const u8*>(local[first].iov_base) + consumed;
+				const size_t address = reinterpret_cast<size_t>(remote[first].iov_base) + consumed;
+				total_written += write_fallback(source, address, local[first].iov_len - consumed);
+				++first;
+			}
+
+			local.clear();
+			remote.clear();
+		};
+
+		size_t batch_bytes{0};
+		for (const write_span& span : spans)
+		{
+			for (size_t offset = 0; offset < span.size; )
+			{
+				const size_t size = std::min(span.size - offset, max_transfer_size - batch_bytes);
+				u8* source = const_cast<u8*>(span.source + offset);
+				void* address = reinterpret_cast<void*>(span.address + offset);
+
+				// extend the previous element if this continues it on both sides
+				const bool adjacent = !local.empty()
+					&& static_cast<u8*>(local.back().iov_base) + local.back().iov_len == source
+					&& static_cast<u8*>(remote.back().iov_base) + remote.back().iov_len == address;
+
+				if (adjacent)
+				{
+					local.back().iov_len += size;
+					remote.back().iov_len += size;
+				}
+				else
+				{
+					local.push_back({ source, size });
+					remote.push_back({ address, size });
+				}
+
+				batch_bytes += size;
+				offset += size;
+
+				if (local.size() == IOV_MAX || batch_bytes == max_transfer_size)
+				{
+					flush();
+					batch_bytes = 0;
+				}
+			}
+		}
+		flush();
+
+		return total_written;
+	}
+}